@@ -0,0 +1,117 @@
+/** @file adaptive_splits.cpp */
+// description: check of the split policies and the rectangular root on
+// skewed data. tall and wide data sets are built with every policy, their
+// long cells are cut across and leave flat children out. queries must
+// match a scan, and removing an object by value must find it even when it
+// lies on the edge of a flat child.
+// exits with 1 on any failed check.
+// usage: adaptive_splits [objects]
+// last updated: aug.28.2011
+
+// Copyright (C) 2011 Rim Zaidullin <tinybit@yandex.ru>
+
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+
+#include <cstdlib>
+
+#include "check_common.hpp"
+
+// triangles in a strip 20 wide along y (or x when wide), every other one
+// with a vertex on the long edge at 0, where the flat children are
+static std::vector<tri2d> make_strip(size_t count, bool wide, std::mt19937& rng) {
+	std::uniform_real_distribution<double> along(0.0, domain_size);
+	std::uniform_real_distribution<double> across(0.0, 20.0);
+	std::uniform_real_distribution<double> extent(0.5, 4.0);
+
+	std::vector<tri2d> tris;
+
+	for (size_t i = 0; i < count; ++i) {
+		point2d at(i % 2 ? across(rng) : 0.0, along(rng));
+		tri2d tri(at, point2d(at.x + extent(rng), at.y), point2d(at.x, at.y + extent(rng)));
+
+		if (wide) {
+			for (size_t j = 0; j < 3; ++j) {
+				tri.point[j] = point2d(tri.point[j].y, tri.point[j].x);
+			}
+		}
+
+		tris.push_back(tri);
+	}
+
+	return tris;
+}
+
+// queries against a scan, then every object removed by value
+static size_t run_strip(const std::vector<tri2d>& tris, rz_split_policy policy, const query_set& queries) {
+	rz_quadtree_options options;
+	options.objects_threshold = 4;
+	options.depth_threshold = 16;
+	options.split_policy = policy;
+	options.rectangular_root = true;
+
+	tree_type tree(tris, options);
+	size_t wrong = 0;
+
+	for (size_t i = 0; i < queries.boxes.size(); ++i) {
+		wrong += box_result(tree, queries.boxes[i]) != scan_box(tris, queries.boxes[i]) ? 1 : 0;
+		wrong += point_result(tree, queries.points[i]) != scan_point(tris, queries.points[i]) ? 1 : 0;
+	}
+
+	for (size_t i = 0; i < tris.size(); ++i) {
+		wrong += tree.remove(tris[i]) ? 0 : 1;
+	}
+
+	return wrong + (tree.count() != 0 ? 1 : 0);
+}
+
+int main(int argc, char** argv) {
+	size_t objects_count = argc > 1 ? (size_t)atol(argv[1]) : 2000;
+
+	std::mt19937 rng(1);
+	std::vector<tri2d> tall = make_strip(objects_count, false, rng);
+	std::vector<tri2d> wide = make_strip(objects_count, true, rng);
+
+	// queries over the strips, points on the long edge at 0 included
+	std::uniform_real_distribution<double> along(0.0, domain_size);
+	std::uniform_real_distribution<double> across(0.0, 20.0);
+	query_set tall_queries, wide_queries;
+
+	for (size_t i = 0; i < 500; ++i) {
+		point2d at(i % 2 ? across(rng) : 0.0, along(rng));
+		point2d far(at.x + across(rng), at.y + across(rng));
+
+		tall_queries.boxes.push_back(aabb2d(at, far));
+		tall_queries.points.push_back(at);
+		wide_queries.boxes.push_back(aabb2d(point2d(at.y, at.x), point2d(far.y, far.x)));
+		wide_queries.points.push_back(point2d(at.y, at.x));
+	}
+
+	const char* names[3] = { "midpoint", "median", "sah" };
+	const rz_split_policy policies[3] = { RZ_SPLIT_MIDPOINT, RZ_SPLIT_MEDIAN, RZ_SPLIT_SAH };
+	bool ok = true;
+
+	printf("%zu objects per strip\n", objects_count);
+	for (size_t i = 0; i < 3; ++i) {
+		char name[32];
+
+		snprintf(name, sizeof(name), "tall strip, %s", names[i]);
+		ok &= report(name, run_strip(tall, policies[i], tall_queries));
+
+		snprintf(name, sizeof(name), "wide strip, %s", names[i]);
+		ok &= report(name, run_strip(wide, policies[i], wide_queries));
+	}
+
+	return ok ? 0 : 1;
+}
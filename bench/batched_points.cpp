@@ -0,0 +1,109 @@
+/** @file batched_points.cpp */
+// description: check of the batched point queries. the results of every
+// point must match a query of its own, with and without the exact test,
+// and the exact ones a scan. the data pins the root cell, so a grid at
+// the split coordinates puts points on cell edges and corners. points outside the root and object vertices are included.
+// exits with 1 on any failed check.
+// usage: batched_points [objects]
+// last updated: aug.28.2011
+
+// Copyright (C) 2011 Rim Zaidullin <tinybit@yandex.ru>
+
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+
+#include <cstdlib>
+
+#include "check_common.hpp"
+
+// batched results against one query per point, exact ones against a scan
+static size_t run_batched(const tree_type& tree, const std::vector<point2d>& points, unsigned int flags) {
+	index_vector indices;
+	std::vector<size_t> offsets;
+	tree.get_indices_from_points(points, indices, offsets, flags);
+
+	size_t wrong = offsets.size() != points.size() + 1 || offsets.back() != indices.size() ? 1 : 0;
+	index_vector expected;
+
+	for (size_t i = 0; i + 1 < offsets.size() && i < points.size(); ++i) {
+		index_vector batched(indices.begin() + offsets[i], indices.begin() + offsets[i + 1]);
+		tree.get_indices_from_point(points[i], expected, flags);
+
+		wrong += sorted(batched) != sorted(expected) ? 1 : 0;
+		wrong += (flags & RZ_QUERY_EXACT) && sorted(batched) != scan_point(tree, points[i]) ? 1 : 0;
+	}
+
+	return wrong;
+}
+
+int main(int argc, char** argv) {
+	size_t objects_count = argc > 1 ? (size_t)atol(argv[1]) : 10000;
+
+	std::mt19937 rng(1);
+	std::vector<tri2d> tris = make_tris(objects_count, rng);
+	query_set queries = make_queries(2000, rng);
+
+	// point objects pin the root cell to 0..1024, past the objects sticking
+	// out of the domain. its split coordinates are exact binary fractions
+	const double root_size = 1024.0;
+	tris.push_back(tri2d(point2d(0.0, 0.0), point2d(0.0, 0.0), point2d(0.0, 0.0)));
+	tris.push_back(tri2d(point2d(root_size, root_size), point2d(root_size, root_size), point2d(root_size, root_size)));
+
+	rz_quadtree_options options;
+	options.objects_threshold = 16;
+	options.depth_threshold = 16;
+	tree_type tree(tris, options);
+
+	// split coordinates down to cells of root_size / 64
+	std::vector<point2d> grid;
+	for (size_t i = 0; i <= 64; ++i) {
+		for (size_t j = 0; j <= 64; ++j) {
+			grid.push_back(point2d(root_size * i / 64.0, root_size * j / 64.0));
+		}
+	}
+
+	// outside the root on each side and beyond the corners
+	std::vector<point2d> outside;
+	const double coords[4] = { -1.0, root_size / 3.0, root_size + 1.0, root_size * 2.0 };
+	for (size_t i = 0; i < 4; ++i) {
+		for (size_t j = 0; j < 4; ++j) {
+			if (i != 1 || j != 1) {
+				outside.push_back(point2d(coords[i], coords[j]));
+			}
+		}
+	}
+
+	std::vector<point2d> vertices;
+	for (size_t i = 0; i < 2000 && i < tris.size(); ++i) {
+		vertices.push_back(tris[i].point[i % 3]);
+	}
+
+	// everything in one batch too, duplicates included
+	std::vector<point2d> mixed = queries.points;
+	mixed.insert(mixed.end(), grid.begin(), grid.end());
+	mixed.insert(mixed.end(), outside.begin(), outside.end());
+	mixed.insert(mixed.end(), vertices.begin(), vertices.end());
+	mixed.insert(mixed.end(), grid.begin(), grid.begin() + 100);
+
+	const char* names[5] = { "random points", "cell edges", "outside root", "object vertices", "mixed batch" };
+	const std::vector<point2d>* sets[5] = { &queries.points, &grid, &outside, &vertices, &mixed };
+	bool ok = true;
+
+	printf("%zu objects, %zu points in the mixed batch\n", tree.size(), mixed.size());
+	for (size_t i = 0; i < 5; ++i) {
+		ok &= report(names[i], run_batched(tree, *sets[i], RZ_QUERY_DEFAULT) + run_batched(tree, *sets[i], RZ_QUERY_EXACT));
+	}
+
+	return ok ? 0 : 1;
+}
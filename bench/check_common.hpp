@@ -0,0 +1,193 @@
+/** @file check_common.hpp */
+// description: data and brute force answers shared by the checks. random
+// small triangles over a square domain, random query boxes, points and
+// segments, and scans testing every object on its own.
+// last updated: aug.28.2011
+
+// Copyright (C) 2011 Rim Zaidullin <tinybit@yandex.ru>
+
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+
+#ifndef _CHECK_COMMON_HPP_INCLUDED_
+#define _CHECK_COMMON_HPP_INCLUDED_
+
+#include <algorithm>
+#include <cstdio>
+#include <random>
+#include <vector>
+
+#include "rz_quadtree.hpp"
+
+using namespace rimz;
+
+typedef rz_point_2d<double> point2d;
+typedef rz_aabb<point2d> aabb2d;
+typedef rz_line<point2d> line2d;
+typedef rz_tri<point2d> tri2d;
+typedef rz_quadtree<tri2d> tree_type;
+typedef tree_type::index_vector index_vector;
+typedef std::vector<std::pair<tree_type::index_type, tree_type::index_type> > pair_vector;
+
+static const double domain_size = 1000.0;
+static const unsigned int aabb_flags = RZ_QUERY_UNIQUE | RZ_QUERY_EXACT;
+
+struct query_set {
+	std::vector<aabb2d> boxes;
+	std::vector<point2d> points;
+	std::vector<line2d> lines;
+};
+
+inline std::vector<tri2d> make_tris(size_t count, std::mt19937& rng) {
+	std::uniform_real_distribution<double> position(0.0, domain_size);
+	std::uniform_real_distribution<double> extent(0.5, 4.0);
+
+	std::vector<tri2d> tris;
+	tris.reserve(count);
+
+	for (size_t i = 0; i < count; ++i) {
+		point2d at(position(rng), position(rng));
+		tris.push_back(tri2d(at, point2d(at.x + extent(rng), at.y), point2d(at.x, at.y + extent(rng))));
+	}
+
+	return tris;
+}
+
+inline query_set make_queries(size_t count, std::mt19937& rng) {
+	std::uniform_real_distribution<double> position(0.0, domain_size);
+	std::uniform_real_distribution<double> extent(1.0, 20.0);
+
+	query_set queries;
+
+	for (size_t i = 0; i < count; ++i) {
+		point2d at(position(rng), position(rng));
+		queries.boxes.push_back(aabb2d(at, point2d(at.x + extent(rng), at.y + extent(rng))));
+		queries.points.push_back(point2d(position(rng), position(rng)));
+		queries.lines.push_back(line2d(at, point2d(position(rng), position(rng))));
+	}
+
+	return queries;
+}
+
+// objects in the lower left corner of the domain, a quarter of its size on
+// each axis. they keep the density of the whole set but are few enough for
+// scans
+inline std::vector<tri2d> corner_objects(const std::vector<tri2d>& tris) {
+	std::vector<tri2d> objects;
+
+	for (size_t i = 0; i < tris.size(); ++i) {
+		if (tris[i].point[0].x < domain_size / 4.0 && tris[i].point[0].y < domain_size / 4.0) {
+			objects.push_back(tris[i]);
+		}
+	}
+
+	return objects;
+}
+
+// the queries taken into the corner of corner_objects
+inline query_set corner_queries(const query_set& queries) {
+	query_set corner;
+
+	for (size_t i = 0; i < queries.boxes.size(); ++i) {
+		const aabb2d& box = queries.boxes[i];
+		point2d at(box.min.x / 4.0, box.min.y / 4.0);
+
+		corner.boxes.push_back(aabb2d(at, at + (box.max - box.min)));
+		corner.points.push_back(point2d(queries.points[i].x / 4.0, queries.points[i].y / 4.0));
+		corner.lines.push_back(line2d(point2d(queries.lines[i].begin.x / 4.0, queries.lines[i].begin.y / 4.0),
+			point2d(queries.lines[i].end.x / 4.0, queries.lines[i].end.y / 4.0)));
+	}
+
+	return corner;
+}
+
+inline tri2d moved(const tri2d& tri, double dx, double dy) {
+	point2d offset(dx, dy);
+	return tri2d(tri.point[0] + offset, tri.point[1] + offset, tri.point[2] + offset);
+}
+
+inline index_vector sorted(index_vector indices) {
+	std::sort(indices.begin(), indices.end());
+	return indices;
+}
+
+inline index_vector box_result(const tree_type& tree, const aabb2d& box) {
+	index_vector indices;
+	tree.get_indices_from_aabb(box, indices, aabb_flags);
+	return sorted(indices);
+}
+
+inline index_vector point_result(const tree_type& tree, const point2d& pt) {
+	index_vector indices;
+	tree.get_indices_from_point(pt, indices, RZ_QUERY_EXACT);
+	return sorted(indices);
+}
+
+inline index_vector line_result(const tree_type& tree, const line2d& line) {
+	index_vector indices;
+	tree.get_indices_from_line(line, indices);
+	return indices;
+}
+
+// brute force answers, indices of the objects passing the test, ascending
+template <typename F>
+inline index_vector scan(const std::vector<tri2d>& objects, F test) {
+	index_vector indices;
+
+	for (size_t i = 0; i < objects.size(); ++i) {
+		if (test(objects[i])) {
+			indices.push_back((tree_type::index_type)i);
+		}
+	}
+
+	return indices;
+}
+
+// the same over the live objects of a tree, removed slots are skipped
+template <typename F>
+inline index_vector scan(const tree_type& tree, F test) {
+	index_vector indices;
+
+	for (size_t i = 0; i < tree.size(); ++i) {
+		tree_type::index_type index = (tree_type::index_type)i;
+
+		if (tree.contains(index) && test(tree.object(index))) {
+			indices.push_back(index);
+		}
+	}
+
+	return indices;
+}
+
+template <typename Objects>
+inline index_vector scan_box(const Objects& objects, const aabb2d& box) {
+	return scan(objects, [&box](const tri2d& tri) { return intersect_2d(box, tri); });
+}
+
+template <typename Objects>
+inline index_vector scan_point(const Objects& objects, const point2d& pt) {
+	return scan(objects, [&pt](const tri2d& tri) { return intersect_2d(tri, pt); });
+}
+
+template <typename Objects>
+inline index_vector scan_line(const Objects& objects, const line2d& line) {
+	return scan(objects, [&line](const tri2d& tri) { return intersect_2d(line, tri); });
+}
+
+inline bool report(const char* name, size_t wrong) {
+	printf("%-24s %8zu wrong\n", name, wrong);
+	return wrong == 0;
+}
+
+#endif // _CHECK_COMMON_HPP_INCLUDED_
@@ -0,0 +1,159 @@
+/** @file concurrent_queries.cpp */
+// description: check of concurrent read-only querying. one tree is built
+// sequentially and once more with a thread pool, then queried by several
+// threads at once (aabb, point, line and nearest queries) and by pooled
+// batched aabb queries and a pooled self join. every result must match the
+// one of the same query run alone on the calling thread, join pairs must
+// come in the same order. build it with -fsanitize=thread to have races
+// reported as well.
+// exits with 1 on any failed check.
+// usage: concurrent_queries [objects] [threads]
+// last updated: aug.28.2011
+
+// Copyright (C) 2011 Rim Zaidullin <tinybit@yandex.ru>
+
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+
+#include <atomic>
+#include <cstdlib>
+#include <thread>
+
+#include "check_common.hpp"
+
+// results of every query, in query order
+struct query_results {
+	std::vector<index_vector> boxes;
+	std::vector<index_vector> points;
+	std::vector<index_vector> lines;
+	std::vector<index_vector> nearest;
+};
+
+static index_vector nearest_result(const tree_type& tree, const point2d& pt) {
+	tree_type::neighbour_vector neighbours;
+	tree.nearest(pt, 4, neighbours);
+
+	index_vector indices;
+	for (size_t i = 0; i < neighbours.size(); ++i) {
+		indices.push_back(neighbours[i].first);
+	}
+
+	return indices;
+}
+
+static query_results run_serial(const tree_type& tree, const query_set& queries) {
+	query_results results;
+
+	for (size_t i = 0; i < queries.boxes.size(); ++i) {
+		results.boxes.push_back(box_result(tree, queries.boxes[i]));
+		results.points.push_back(point_result(tree, queries.points[i]));
+		results.lines.push_back(line_result(tree, queries.lines[i]));
+		results.nearest.push_back(nearest_result(tree, queries.points[i]));
+	}
+
+	return results;
+}
+
+// every thread runs all the queries, starting at its own offset so the
+// threads are in different parts of the tree at any moment
+static size_t run_threads(const tree_type& tree, const query_set& queries, const query_results& expected, size_t threads_count) {
+	std::atomic<size_t> wrong(0);
+	std::vector<std::thread> threads;
+
+	for (size_t t = 0; t < threads_count; ++t) {
+		threads.push_back(std::thread([&, t]() {
+			size_t count = queries.boxes.size();
+
+			for (size_t n = 0; n < count; ++n) {
+				size_t i = (n + t * count / threads_count) % count;
+
+				if (box_result(tree, queries.boxes[i]) != expected.boxes[i] ||
+					point_result(tree, queries.points[i]) != expected.points[i] ||
+					line_result(tree, queries.lines[i]) != expected.lines[i] ||
+					nearest_result(tree, queries.points[i]) != expected.nearest[i]) {
+					++wrong;
+				}
+			}
+		}));
+	}
+
+	for (size_t t = 0; t < threads.size(); ++t) {
+		threads[t].join();
+	}
+
+	return wrong;
+}
+
+static size_t run_batch(const tree_type& tree, const query_set& queries, const query_results& expected, rz_thread_pool& pool) {
+	index_vector indices;
+	std::vector<size_t> offsets;
+	tree.get_indices_from_aabbs(queries.boxes, indices, offsets, aabb_flags, &pool);
+
+	size_t wrong = 0;
+
+	for (size_t i = 0; i < queries.boxes.size(); ++i) {
+		index_vector result(indices.begin() + offsets[i], indices.begin() + offsets[i + 1]);
+		wrong += sorted(result) != expected.boxes[i] ? 1 : 0;
+	}
+
+	return wrong;
+}
+
+// pairs in the order they were reported
+static pair_vector self_join(const tree_type& tree, rz_thread_pool* pool) {
+	pair_vector pairs;
+
+	join(tree, tree, [&pairs](tree_type::index_type a, tree_type::index_type b) {
+		pairs.push_back(std::make_pair(a, b));
+		return true;
+	}, pool);
+
+	return pairs;
+}
+
+int main(int argc, char** argv) {
+	size_t objects_count = argc > 1 ? (size_t)atol(argv[1]) : 50000;
+	size_t threads_count = argc > 2 ? (size_t)atol(argv[2]) : 4;
+
+	std::mt19937 rng(1);
+	std::vector<tri2d> tris = make_tris(objects_count, rng);
+	query_set queries = make_queries(2000, rng);
+
+	rz_thread_pool pool(threads_count);
+
+	rz_quadtree_options options;
+	options.objects_threshold = 16;
+	options.depth_threshold = 16;
+	tree_type tree(tris, options);
+
+	options.thread_pool = &pool;
+	options.parallel_cutoff = 1024;
+	tree_type pooled_tree(tris, options);
+
+	query_results expected = run_serial(tree, queries);
+	query_results pooled_expected = run_serial(pooled_tree, queries);
+
+	bool ok = true;
+
+	printf("%zu objects, %zu queries of each kind, %zu threads\n", objects_count, queries.boxes.size(), threads_count);
+	ok &= report("parallel build", pooled_expected.boxes != expected.boxes || pooled_expected.points != expected.points ||
+		pooled_expected.lines != expected.lines || pooled_expected.nearest != expected.nearest ? 1 : 0);
+	ok &= report("threads", run_threads(tree, queries, expected, threads_count));
+	ok &= report("batched aabb, pool", run_batch(tree, queries, expected, pool));
+	pair_vector pairs = self_join(tree, NULL);
+	ok &= report("self join, pool", self_join(tree, &pool) != pairs ? 1 : 0);
+	ok &= report("self join, pooled build", self_join(pooled_tree, &pool) != pairs ? 1 : 0);
+
+	return ok ? 0 : 1;
+}
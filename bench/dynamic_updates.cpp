@@ -0,0 +1,110 @@
+/** @file dynamic_updates.cpp */
+// description: check of dynamic inserts, removes and moves. after random
+// batches of them aabb and point queries must match a scan of the live
+// objects. the objects and queries are those in the lower left corner of
+// the domain, so the scans stay short.
+// exits with 1 on any failed check.
+// usage: dynamic_updates [objects]
+// last updated: aug.28.2011
+
+// Copyright (C) 2011 Rim Zaidullin <tinybit@yandex.ru>
+
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+
+#include <cstdlib>
+
+#include "check_common.hpp"
+
+// rounds of removes, inserts, a batch of moves and single moves. moves are
+// either small, mostly staying in the same leaves, or jumps across the
+// area, some of them past its border so the root grows. removed indices
+// may be picked again, their updates are skipped. after every round some
+// of the queries are checked against a scan
+static size_t run_random_updates(const std::vector<tri2d>& objects, const rz_quadtree_options& options, const query_set& queries, std::mt19937& rng) {
+	const size_t rounds = 10;
+	const size_t checked = queries.boxes.size() / rounds;
+	const double quarter = domain_size / 4.0;
+
+	size_t live = objects.size();
+	tree_type tree(objects, options);
+	std::vector<tri2d> inserted = make_tris(rounds * 200, rng);
+
+	std::uniform_real_distribution<double> nudge(-2.0, 2.0);
+	std::uniform_real_distribution<double> jump(-quarter * 0.6, quarter * 0.6);
+	std::uniform_int_distribution<int> kind(0, 3);
+	size_t wrong = 0;
+
+	for (size_t round = 0; round < rounds; ++round) {
+		std::uniform_int_distribution<size_t> pick(0, tree.size() - 1);
+
+		for (size_t n = 0; n < 100; ++n) {
+			live -= tree.remove((tree_type::index_type)pick(rng)) ? 1 : 0;
+		}
+
+		for (size_t n = 0; n < 200; ++n) {
+			const tri2d& tri = inserted[round * 200 + n];
+			tree.insert(moved(tri, tri.point[0].x / 4.0 - tri.point[0].x, tri.point[0].y / 4.0 - tri.point[0].y));
+			++live;
+		}
+
+		pick = std::uniform_int_distribution<size_t>(0, tree.size() - 1);
+
+		auto move = [&](tree_type::index_type index) {
+			bool far = kind(rng) == 0;
+			return moved(tree.object(index), far ? jump(rng) : nudge(rng), far ? jump(rng) : nudge(rng));
+		};
+
+		tree_type::update_vector updates;
+		for (size_t n = 0; n < 300; ++n) {
+			tree_type::index_type index = (tree_type::index_type)pick(rng);
+			updates.push_back(std::make_pair(index, move(index)));
+		}
+
+		tree.apply_updates(updates);
+
+		for (size_t n = 0; n < 50; ++n) {
+			tree_type::index_type index = (tree_type::index_type)pick(rng);
+			tree.update(index, move(index));
+		}
+
+		wrong += tree.count() != live ? 1 : 0;
+
+		for (size_t i = round * checked; i < (round + 1) * checked; ++i) {
+			wrong += box_result(tree, queries.boxes[i]) != scan_box(tree, queries.boxes[i]) ? 1 : 0;
+			wrong += point_result(tree, queries.points[i]) != scan_point(tree, queries.points[i]) ? 1 : 0;
+		}
+	}
+
+	return wrong;
+}
+
+int main(int argc, char** argv) {
+	size_t objects_count = argc > 1 ? (size_t)atol(argv[1]) : 50000;
+
+	std::mt19937 rng(1);
+	std::vector<tri2d> tris = make_tris(objects_count, rng);
+	query_set queries = make_queries(2000, rng);
+
+	rz_quadtree_options options;
+	options.objects_threshold = 16;
+	options.depth_threshold = 16;
+
+	std::vector<tri2d> objects = corner_objects(tris);
+
+	printf("%zu objects\n", objects.size());
+	bool ok = report("random updates, scan", run_random_updates(objects, options, corner_queries(queries), rng));
+
+	return ok ? 0 : 1;
+}
@@ -0,0 +1,627 @@
+/** @file intersect_kernels.cpp */
+// description: differential check and microbenchmark of the separating axis
+// tri / aabb, slab line / aabb, divide free point in tri and closed aabb /
+// aabb and point in aabb kernels against the versions they replaced. random
+// inputs have no exact touching cases, so the kernels must agree everywhere
+// except within a small distance of a boundary. grid inputs are small
+// integers with lots of touching and degenerate shapes, there the kernels
+// are exact and must match an integer oracle of the closed convention, the
+// previous kernels (open or half open, and wrong for zero width boxes and
+// collinear lines) are only counted. the line / line crossing point is
+// checked on grid data too, it must lie on both segments. the scalar, sse2
+// and avx2 leaf bounds filters the cpu supports must give the same positions
+// over every tail length and keep every box touching the query.
+// exits with 1 on any failed check.
+// usage: intersect_kernels [cases]
+// last updated: aug.28.2011
+
+// Copyright (C) 2011 Rim Zaidullin <tinybit@yandex.ru>
+
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <vector>
+
+#include "rz_bounds_filter.hpp"
+#include "rz_geometry_math.hpp"
+
+using namespace rimz;
+
+typedef rz_point_2d<double> point2d;
+typedef rz_aabb<point2d> aabb2d;
+typedef rz_line<point2d> line2d;
+typedef rz_tri<point2d> tri2d;
+
+// kernels as they were before the separating axis and closed versions
+namespace reference {
+
+inline bool intersect_2d(const aabb2d& aabb, const aabb2d& aabb_b) {
+	if (aabb == aabb_b) {
+		return true;
+	}
+
+	double total_boxes_x_len = fabs(fmax(aabb.max.x, aabb_b.max.x) - fmin(aabb.min.x, aabb_b.min.x));
+	double total_boxes_y_len = fabs(fmax(aabb.max.y, aabb_b.max.y) - fmin(aabb.min.y, aabb_b.min.y));
+
+	return total_boxes_x_len < (aabb.width() + aabb_b.width()) && total_boxes_y_len < (aabb.height() + aabb_b.height());
+}
+
+inline bool intersect_2d(const aabb2d& aabb, const point2d& pt) {
+	return (pt.x > aabb.min.x && pt.x <= aabb.max.x && pt.y > aabb.min.y && pt.y <= aabb.max.y);
+}
+
+inline bool intersect_2d(const tri2d& tri, const point2d& pt) {
+	point2d v0 = tri.point[2] - tri.point[0];
+	point2d v1 = tri.point[1] - tri.point[0];
+	point2d v2 = pt - tri.point[0];
+
+	double dot00 = dot_product(v0, v0);
+	double dot01 = dot_product(v0, v1);
+	double dot02 = dot_product(v0, v2);
+	double dot11 = dot_product(v1, v1);
+	double dot12 = dot_product(v1, v2);
+
+	double invDenom = 1.0 / (dot00 * dot11 - dot01 * dot01);
+	double u = (dot11 * dot02 - dot01 * dot12) * invDenom;
+	double v = (dot00 * dot12 - dot01 * dot02) * invDenom;
+
+	return (u > 0.0) && (v > 0.0) && (u + v < 1.0);
+}
+
+inline bool intersect_2d(const aabb2d& aabb, const tri2d& tri) {
+	if (reference::intersect_2d(tri.aabb(), aabb) == false) {
+		return false;
+	}
+
+	for (int i = 0; i < 3; ++i) {
+		if (tri.point[i].x > aabb.min.x && tri.point[i].x < aabb.max.x &&
+			tri.point[i].y > aabb.min.y && tri.point[i].y < aabb.max.y) {
+			return true;
+		}
+	}
+
+	point2d corners[4] = { aabb.min, point2d(aabb.min.x, aabb.max.y), aabb.max, point2d(aabb.max.x, aabb.min.y) };
+
+	for (int i = 0; i < 4; ++i) {
+		if (intersect_2d(tri, corners[i])) {
+			return true;
+		}
+	}
+
+	for (int i = 0; i < 4; ++i) {
+		for (int j = 0; j < 3; ++j) {
+			if (rimz::intersect_2d(line2d(corners[i], corners[(i + 1) % 4]), line2d(tri.point[j], tri.point[(j + 1) % 3]))) {
+				return true;
+			}
+		}
+	}
+
+	return false;
+}
+
+inline bool intersect_2d(const aabb2d& aabb, const line2d& line) {
+	if (line.begin.x > aabb.min.x && line.begin.x < aabb.max.x &&
+		line.begin.y > aabb.min.y && line.begin.y < aabb.max.y) {
+		return true;
+	}
+
+	if (line.end.x > aabb.min.x && line.end.x < aabb.max.x &&
+		line.end.y > aabb.min.y && line.end.y < aabb.max.y) {
+		return true;
+	}
+
+	point2d corners[4] = { aabb.min, point2d(aabb.min.x, aabb.max.y), aabb.max, point2d(aabb.max.x, aabb.min.y) };
+
+	for (int i = 0; i < 4; ++i) {
+		if (rimz::intersect_2d(line, line2d(corners[i], corners[(i + 1) % 4]))) {
+			return true;
+		}
+	}
+
+	return false;
+}
+
+} // namespace reference
+
+// exact closed convention on integer coordinates: shapes intersect if a
+// vertex of one is in the other, or two edges cross or touch
+namespace oracle {
+
+inline long long orientation(const point2d& a, const point2d& b, const point2d& p) {
+	long long value = (long long)(b.x - a.x) * (long long)(p.y - a.y) - (long long)(b.y - a.y) * (long long)(p.x - a.x);
+	return value > 0 ? 1 : (value < 0 ? -1 : 0);
+}
+
+inline bool on_segment(const point2d& a, const point2d& b, const point2d& p) {
+	return orientation(a, b, p) == 0 && p.x >= std::min(a.x, b.x) && p.x <= std::max(a.x, b.x) &&
+		p.y >= std::min(a.y, b.y) && p.y <= std::max(a.y, b.y);
+}
+
+inline bool segments_touch(const point2d& a, const point2d& b, const point2d& c, const point2d& d) {
+	long long o1 = orientation(a, b, c);
+	long long o2 = orientation(a, b, d);
+	long long o3 = orientation(c, d, a);
+	long long o4 = orientation(c, d, b);
+
+	if (o1 * o2 < 0 && o3 * o4 < 0) {
+		return true;
+	}
+
+	return on_segment(a, b, c) || on_segment(a, b, d) || on_segment(c, d, a) || on_segment(c, d, b);
+}
+
+// convex polygon, maybe degenerate. closed: on an edge or strictly inside
+inline bool contains(const point2d* poly, int count, const point2d& p) {
+	long long sides[2] = { 0, 0 };
+
+	for (int i = 0; i < count; ++i) {
+		const point2d& a = poly[i];
+		const point2d& b = poly[(i + 1) % count];
+
+		if (on_segment(a, b, p)) {
+			return true;
+		}
+
+		long long side = orientation(a, b, p);
+		sides[side > 0 ? 0 : 1] += side != 0 ? 1 : 0;
+	}
+
+	return sides[0] == count || sides[1] == count;
+}
+
+inline bool polygons_touch(const point2d* a, int count_a, const point2d* b, int count_b) {
+	for (int i = 0; i < count_a; ++i) {
+		if (contains(b, count_b, a[i])) {
+			return true;
+		}
+	}
+
+	for (int i = 0; i < count_b; ++i) {
+		if (contains(a, count_a, b[i])) {
+			return true;
+		}
+	}
+
+	for (int i = 0; i < count_a; ++i) {
+		for (int j = 0; j < count_b; ++j) {
+			if (segments_touch(a[i], a[(i + 1) % count_a], b[j], b[(j + 1) % count_b])) {
+				return true;
+			}
+		}
+	}
+
+	return false;
+}
+
+inline void corners(const aabb2d& aabb, point2d* out) {
+	out[0] = aabb.min;
+	out[1] = point2d(aabb.max.x, aabb.min.y);
+	out[2] = aabb.max;
+	out[3] = point2d(aabb.min.x, aabb.max.y);
+}
+
+inline bool intersect_2d(const aabb2d& aabb, const tri2d& tri) {
+	point2d box[4];
+	corners(aabb, box);
+	return polygons_touch(box, 4, tri.point, 3);
+}
+
+inline bool intersect_2d(const aabb2d& aabb, const line2d& line) {
+	point2d box[4];
+	corners(aabb, box);
+	point2d segment[2] = { line.begin, line.end };
+	return polygons_touch(box, 4, segment, 2);
+}
+
+inline bool intersect_2d(const tri2d& tri, const point2d& pt) {
+	return contains(tri.point, 3, pt);
+}
+
+inline bool intersect_2d(const aabb2d& aabb, const aabb2d& aabb_b) {
+	point2d box[4];
+	point2d box_b[4];
+	corners(aabb, box);
+	corners(aabb_b, box_b);
+	return polygons_touch(box, 4, box_b, 4);
+}
+
+inline bool intersect_2d(const aabb2d& aabb, const point2d& pt) {
+	point2d box[4];
+	corners(aabb, box);
+	return contains(box, 4, pt);
+}
+
+} // namespace oracle
+
+static aabb2d grown(const aabb2d& aabb, double delta) {
+	return aabb2d(point2d(aabb.min.x - delta, aabb.min.y - delta), point2d(aabb.max.x + delta, aabb.max.y + delta));
+}
+
+// the answer changes within delta of the inputs
+template <typename Object>
+static bool boundary_case(const aabb2d& aabb, const Object& object, double delta) {
+	aabb2d outer = grown(aabb, delta);
+	aabb2d inner = grown(aabb, -delta);
+
+	return rimz::intersect_2d(outer, object) != rimz::intersect_2d(inner, object) ||
+		reference::intersect_2d(outer, object) != reference::intersect_2d(inner, object);
+}
+
+static bool boundary_case(const tri2d& tri, const point2d& pt, double delta) {
+	bool inside = rimz::intersect_2d(tri, pt);
+
+	for (int i = 0; i < 4; ++i) {
+		point2d moved(pt.x + (i == 0 ? delta : (i == 1 ? -delta : 0.0)), pt.y + (i == 2 ? delta : (i == 3 ? -delta : 0.0)));
+
+		if (rimz::intersect_2d(tri, moved) != inside) {
+			return true;
+		}
+	}
+
+	return false;
+}
+
+struct dataset {
+	std::vector<aabb2d> boxes;
+	std::vector<aabb2d> other_boxes;
+	std::vector<tri2d> tris;
+	std::vector<line2d> lines;
+	std::vector<line2d> other_lines;
+	std::vector<point2d> points;
+};
+
+// objects around the boxes, so that about half of the pairs intersect
+static dataset make_random(size_t count, unsigned int seed) {
+	std::mt19937 rng(seed);
+	std::uniform_real_distribution<double> position(0.0, 1000.0);
+	std::uniform_real_distribution<double> extent(1.0, 50.0);
+	std::uniform_real_distribution<double> offset(-60.0, 60.0);
+
+	dataset data;
+
+	for (size_t i = 0; i < count; ++i) {
+		point2d min(position(rng), position(rng));
+		point2d max(min.x + extent(rng), min.y + extent(rng));
+		data.boxes.push_back(aabb2d(min, max));
+
+		point2d center((min.x + max.x) / 2.0, (min.y + max.y) / 2.0);
+		point2d a(center.x + offset(rng), center.y + offset(rng));
+
+		data.tris.push_back(tri2d(a, point2d(a.x + offset(rng), a.y + offset(rng)), point2d(a.x + offset(rng), a.y + offset(rng))));
+		data.lines.push_back(line2d(a, point2d(a.x + offset(rng), a.y + offset(rng))));
+		data.points.push_back(point2d(center.x + offset(rng), center.y + offset(rng)));
+		data.other_boxes.push_back(aabb2d(a, point2d(a.x + extent(rng), a.y + extent(rng))));
+	}
+
+	return data;
+}
+
+// small integer coordinates, lots of shared vertices, edges and degenerate shapes
+static dataset make_grid(size_t count, unsigned int seed) {
+	std::mt19937 rng(seed);
+	std::uniform_int_distribution<int> coord(0, 8);
+	std::uniform_int_distribution<int> extent(0, 4);
+
+	dataset data;
+
+	for (size_t i = 0; i < count; ++i) {
+		point2d min(coord(rng), coord(rng));
+		point2d max(min.x + extent(rng), min.y + extent(rng));
+		data.boxes.push_back(aabb2d(min, max));
+
+		point2d a(coord(rng), coord(rng));
+		data.tris.push_back(tri2d(a, point2d(coord(rng), coord(rng)), point2d(coord(rng), coord(rng))));
+		data.lines.push_back(line2d(a, point2d(coord(rng), coord(rng))));
+		data.points.push_back(point2d(coord(rng), coord(rng)));
+		data.other_boxes.push_back(aabb2d(a, point2d(a.x + extent(rng), a.y + extent(rng))));
+		data.other_lines.push_back(line2d(point2d(coord(rng), coord(rng)), point2d(coord(rng), coord(rng))));
+	}
+
+	return data;
+}
+
+struct mismatches {
+	mismatches() : total(0), unexplained(0) {}
+	size_t total;
+	size_t unexplained;
+};
+
+template <typename Object>
+static mismatches compare(const std::vector<aabb2d>& boxes, const std::vector<Object>& objects, double delta) {
+	mismatches result;
+
+	for (size_t i = 0; i < boxes.size(); ++i) {
+		if (rimz::intersect_2d(boxes[i], objects[i]) != reference::intersect_2d(boxes[i], objects[i])) {
+			result.total++;
+			result.unexplained += boundary_case(boxes[i], objects[i], delta) ? 0 : 1;
+		}
+	}
+
+	return result;
+}
+
+static mismatches compare_points(const std::vector<tri2d>& tris, const std::vector<point2d>& points, double delta) {
+	mismatches result;
+
+	for (size_t i = 0; i < tris.size(); ++i) {
+		if (rimz::intersect_2d(tris[i], points[i]) != reference::intersect_2d(tris[i], points[i])) {
+			result.total++;
+			result.unexplained += boundary_case(tris[i], points[i], delta) ? 0 : 1;
+		}
+	}
+
+	return result;
+}
+
+// grid data: the kernels against the oracle, the previous ones only counted
+template <typename Object>
+static mismatches compare_exact(const std::vector<aabb2d>& boxes, const std::vector<Object>& objects, size_t& previous) {
+	mismatches result;
+
+	for (size_t i = 0; i < boxes.size(); ++i) {
+		bool expected = oracle::intersect_2d(boxes[i], objects[i]);
+		result.unexplained += rimz::intersect_2d(boxes[i], objects[i]) != expected ? 1 : 0;
+		previous += reference::intersect_2d(boxes[i], objects[i]) != expected ? 1 : 0;
+	}
+
+	return result;
+}
+
+static mismatches compare_points_exact(const std::vector<tri2d>& tris, const std::vector<point2d>& points, size_t& previous) {
+	mismatches result;
+
+	for (size_t i = 0; i < tris.size(); ++i) {
+		bool expected = oracle::intersect_2d(tris[i], points[i]);
+		result.unexplained += rimz::intersect_2d(tris[i], points[i]) != expected ? 1 : 0;
+		previous += reference::intersect_2d(tris[i], points[i]) != expected ? 1 : 0;
+	}
+
+	return result;
+}
+
+// grid data: crossing point of the segments, collinear and zero length ones
+// included. the hit must match the oracle and the point must lie on both.
+// a segment starting on the other one touches it first at its begin, the
+// start of the overlap for coincident ones
+static mismatches compare_crossings_exact(const std::vector<line2d>& lines, const std::vector<line2d>& others) {
+	mismatches result;
+
+	for (size_t i = 0; i < lines.size(); ++i) {
+		const line2d& a = lines[i];
+		const line2d& b = others[i];
+
+		result.total++;
+
+		point2d crossing;
+		bool hit = rimz::intersect_2d(a, b, crossing);
+		bool on_both = distance_2d(a, crossing) < 1e-9 && distance_2d(b, crossing) < 1e-9;
+		bool first = !hit || !oracle::on_segment(b.begin, b.end, a.begin) || (crossing - a.begin).length() < 1e-9;
+		result.unexplained += (hit != oracle::segments_touch(a.begin, a.end, b.begin, b.end) || (hit && !on_both) || !first) ? 1 : 0;
+	}
+
+	return result;
+}
+
+// float bounds rounded outwards, laid out as the quadtree leaves keep them
+struct bounds_soa {
+	std::vector<float> min_x;
+	std::vector<float> min_y;
+	std::vector<float> max_x;
+	std::vector<float> max_y;
+};
+
+static bounds_soa make_bounds(const std::vector<aabb2d>& boxes) {
+	bounds_soa bounds;
+
+	for (size_t i = 0; i < boxes.size(); ++i) {
+		bounds.min_x.push_back(float_down_2d(boxes[i].min.x));
+		bounds.min_y.push_back(float_down_2d(boxes[i].min.y));
+		bounds.max_x.push_back(float_up_2d(boxes[i].max.x));
+		bounds.max_y.push_back(float_up_2d(boxes[i].max.y));
+	}
+
+	return bounds;
+}
+
+struct filter_kernel {
+	filter_kernel(const char* name, rz_bounds_filter_fn filter) : name(name), filter(filter) {}
+	const char* name;
+	rz_bounds_filter_fn filter;
+};
+
+// the kernels the running cpu can execute
+static std::vector<filter_kernel> filter_kernels() {
+	std::vector<filter_kernel> kernels;
+	kernels.push_back(filter_kernel("scalar", filter_bounds_2d_scalar));
+
+#ifdef RZ_BOUNDS_FILTER_X86
+	__builtin_cpu_init();
+
+	if (__builtin_cpu_supports("sse2")) {
+		kernels.push_back(filter_kernel("sse2", filter_bounds_2d_sse2));
+	}
+
+	if (__builtin_cpu_supports("avx2")) {
+		kernels.push_back(filter_kernel("avx2", filter_bounds_2d_avx2));
+	}
+#endif
+
+	return kernels;
+}
+
+// slices of 0 to 40 bounds, so every tail length is hit, each against its
+// own query. a kernel is wrong on a slice when its positions differ from the
+// scalar ones or miss a box whose double bounds touch the query
+static mismatches compare_filter(const filter_kernel& kernel, const std::vector<aabb2d>& boxes, const std::vector<aabb2d>& queries) {
+	bounds_soa bounds = make_bounds(boxes);
+	std::vector<uint32_t> expected(41);
+	std::vector<uint32_t> positions(41);
+	mismatches result;
+
+	for (size_t offset = 0, slice = 0; offset < boxes.size(); offset += slice % 41, ++slice) {
+		size_t count = std::min(slice % 41, boxes.size() - offset);
+		const aabb2d& box = queries[slice % queries.size()];
+		rz_bounds_query query(box.min.x, box.min.y, box.max.x, box.max.y);
+
+		size_t expected_count = filter_bounds_2d_scalar(&bounds.min_x[offset], &bounds.min_y[offset], &bounds.max_x[offset], &bounds.max_y[offset],
+			count, query, expected.data());
+		size_t found = kernel.filter(&bounds.min_x[offset], &bounds.min_y[offset], &bounds.max_x[offset], &bounds.max_y[offset],
+			count, query, positions.data());
+
+		bool wrong = found != expected_count || false == std::equal(expected.begin(), expected.begin() + found, positions.begin());
+
+		// positions are ascending, walk them along the slice
+		for (size_t i = 0, kept = 0; i < count; ++i) {
+			bool is_kept = kept < found && positions[kept] == i;
+			wrong |= rimz::intersect_2d(boxes[offset + i], box) && !is_kept;
+			kept += is_kept ? 1 : 0;
+		}
+
+		result.total++;
+		result.unexplained += wrong ? 1 : 0;
+	}
+
+	return result;
+}
+
+static bool report(const char* name, const char* data_name, size_t count, const mismatches& result) {
+	printf("%-12s %-7s %10zu cases %8zu differ %8zu not on a boundary\n", name, data_name, count, result.total, result.unexplained);
+	return result.unexplained == 0;
+}
+
+static bool report_exact(const char* name, size_t count, const mismatches& result, size_t previous) {
+	printf("%-12s grid    %10zu cases %8zu wrong    %8zu wrong before\n", name, count, result.unexplained, previous);
+	return result.unexplained == 0;
+}
+
+// nanoseconds per call, best of a few rounds
+template <typename F>
+static double time_calls(size_t count, F call) {
+	double best = 0.0;
+	size_t hits = 0;
+
+	for (int round = 0; round < 5; ++round) {
+		std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+		for (size_t i = 0; i < count; ++i) {
+			hits += call(i) ? 1 : 0;
+		}
+
+		double elapsed = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count() / count;
+		best = (round == 0 || elapsed < best) ? elapsed : best;
+	}
+
+	// keeps the calls from being optimized away
+	if (hits == (size_t)-1) {
+		printf("\n");
+	}
+
+	return best;
+}
+
+static void bench(const char* name, double old_ns, double new_ns) {
+	printf("%-12s %8.2f ns -> %8.2f ns  %5.2fx\n", name, old_ns, new_ns, old_ns / new_ns);
+}
+
+int main(int argc, char** argv) {
+	size_t count = argc > 1 ? (size_t)atol(argv[1]) : 1000000;
+
+	dataset random = make_random(count, 1);
+	dataset grid = make_grid(count, 2);
+
+	bool ok = true;
+
+	printf("differential check, closed kernels against the previous ones\n");
+	ok &= report("tri/aabb", "random", count, compare(random.boxes, random.tris, 1e-9));
+	ok &= report("line/aabb", "random", count, compare(random.boxes, random.lines, 1e-9));
+	ok &= report("point/tri", "random", count, compare_points(random.tris, random.points, 1e-9));
+	ok &= report("aabb/aabb", "random", count, compare(random.boxes, random.other_boxes, 1e-9));
+	ok &= report("point/aabb", "random", count, compare(random.boxes, random.points, 1e-9));
+
+	printf("\nexact check, closed kernels against the integer oracle\n");
+	size_t previous[5] = { 0, 0, 0, 0, 0 };
+	mismatches tri_result = compare_exact(grid.boxes, grid.tris, previous[0]);
+	mismatches line_result = compare_exact(grid.boxes, grid.lines, previous[1]);
+	mismatches point_result = compare_points_exact(grid.tris, grid.points, previous[2]);
+	mismatches box_result = compare_exact(grid.boxes, grid.other_boxes, previous[3]);
+	mismatches box_point_result = compare_exact(grid.boxes, grid.points, previous[4]);
+
+	ok &= report_exact("tri/aabb", count, tri_result, previous[0]);
+	ok &= report_exact("line/aabb", count, line_result, previous[1]);
+	ok &= report_exact("point/tri", count, point_result, previous[2]);
+	ok &= report_exact("aabb/aabb", count, box_result, previous[3]);
+	ok &= report_exact("point/aabb", count, box_point_result, previous[4]);
+
+	mismatches crossing_result = compare_crossings_exact(grid.lines, grid.other_lines);
+	printf("%-12s grid    %10zu cases %8zu wrong\n", "line/line", crossing_result.total, crossing_result.unexplained);
+	ok &= crossing_result.unexplained == 0;
+
+	std::vector<filter_kernel> kernels = filter_kernels();
+
+	printf("\nbounds filter check, kernels against the scalar one and the double boxes\n");
+	for (size_t k = 0; k < kernels.size(); ++k) {
+		mismatches random_result = compare_filter(kernels[k], random.boxes, random.other_boxes);
+		mismatches grid_result = compare_filter(kernels[k], grid.boxes, grid.other_boxes);
+
+		printf("%-12s random  %10zu slices %8zu wrong\n", kernels[k].name, random_result.total, random_result.unexplained);
+		printf("%-12s grid    %10zu slices %8zu wrong\n", kernels[k].name, grid_result.total, grid_result.unexplained);
+		ok &= random_result.unexplained == 0 && grid_result.unexplained == 0;
+	}
+
+	const dataset& data = random;
+
+	printf("\nmicrobenchmark, random data\n");
+	bench("tri/aabb",
+		time_calls(count, [&](size_t i) { return reference::intersect_2d(data.boxes[i], data.tris[i]); }),
+		time_calls(count, [&](size_t i) { return rimz::intersect_2d(data.boxes[i], data.tris[i]); }));
+	bench("line/aabb",
+		time_calls(count, [&](size_t i) { return reference::intersect_2d(data.boxes[i], data.lines[i]); }),
+		time_calls(count, [&](size_t i) { return rimz::intersect_2d(data.boxes[i], data.lines[i]); }));
+	bench("point/tri",
+		time_calls(count, [&](size_t i) { return reference::intersect_2d(data.tris[i], data.points[i]); }),
+		time_calls(count, [&](size_t i) { return rimz::intersect_2d(data.tris[i], data.points[i]); }));
+	bench("aabb/aabb",
+		time_calls(count, [&](size_t i) { return reference::intersect_2d(data.boxes[i], data.other_boxes[i]); }),
+		time_calls(count, [&](size_t i) { return rimz::intersect_2d(data.boxes[i], data.other_boxes[i]); }));
+	bench("point/aabb",
+		time_calls(count, [&](size_t i) { return reference::intersect_2d(data.boxes[i], data.points[i]); }),
+		time_calls(count, [&](size_t i) { return rimz::intersect_2d(data.boxes[i], data.points[i]); }));
+
+	// leaf sized slices of the random boxes, each against its own query
+	const size_t leaf = 64;
+	bounds_soa bounds = make_bounds(data.boxes);
+	std::vector<uint32_t> positions(leaf);
+	double scalar_ns = 0.0;
+
+	printf("\nbounds filter microbenchmark, random data, %zu bounds per call\n", leaf);
+	for (size_t k = 0; k < kernels.size() && count >= leaf; ++k) {
+		rz_bounds_filter_fn filter = kernels[k].filter;
+		double ns = time_calls(count / leaf, [&](size_t i) {
+			const aabb2d& box = data.other_boxes[i];
+			rz_bounds_query query(box.min.x, box.min.y, box.max.x, box.max.y);
+			size_t offset = i * leaf;
+			return filter(&bounds.min_x[offset], &bounds.min_y[offset], &bounds.max_x[offset], &bounds.max_y[offset], leaf, query, positions.data()) > 0;
+		}) / leaf;
+
+		scalar_ns = (k == 0) ? ns : scalar_ns;
+		printf("%-12s %8.2f ns per bounds  %5.2fx\n", kernels[k].name, ns, scalar_ns / ns);
+	}
+
+	return ok ? 0 : 1;
+}
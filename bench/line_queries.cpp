@@ -0,0 +1,102 @@
+/** @file line_queries.cpp */
+// description: check of the segment queries against a segment test of every
+// object. results must hold the same objects, ordered along the segment.
+// exits with 1 on any failed check.
+// usage: line_queries [objects]
+// last updated: aug.28.2011
+
+// Copyright (C) 2011 Rim Zaidullin <tinybit@yandex.ru>
+
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+
+#include <cstdlib>
+
+#include "check_common.hpp"
+
+// objects hit by the segment with the parameter of their first contact
+static std::vector<std::pair<tree_type::index_type, double> > scan_hits(const tree_type& tree, const line2d& line) {
+	std::vector<std::pair<tree_type::index_type, double> > hits;
+
+	for (size_t i = 0; i < tree.size(); ++i) {
+		tree_type::index_type index = (tree_type::index_type)i;
+		double t;
+
+		if (tree.contains(index) && intersect_2d(line, tree.object(index), t)) {
+			hits.push_back(std::make_pair(index, t));
+		}
+	}
+
+	return hits;
+}
+
+// line queries against a segment test of every object. objects hit at the
+// same t may come in either order, so the sets are compared and the t of
+// the reported objects must not decrease, within the EPS the traversal
+// allows at cell borders. the first object found must be one hit first
+static size_t run_line_scan(const tree_type& tree, const query_set& queries) {
+	const size_t checked = std::min(queries.lines.size(), (size_t)200);
+	size_t wrong = 0;
+
+	for (size_t i = 0; i < checked; ++i) {
+		const line2d& line = queries.lines[i];
+		std::vector<std::pair<tree_type::index_type, double> > hits = scan_hits(tree, line);
+
+		index_vector expected;
+		double first_t = 1.0;
+
+		for (size_t n = 0; n < hits.size(); ++n) {
+			expected.push_back(hits[n].first);
+			first_t = std::min(first_t, hits[n].second);
+		}
+
+		index_vector indices = line_result(tree, line);
+		bool ordered = true;
+		double last_t = 0.0;
+
+		for (size_t n = 0; n < indices.size(); ++n) {
+			double t = 0.0;
+			intersect_2d(line, tree.object(indices[n]), t);
+			ordered = ordered && t >= last_t - EPS;
+			last_t = t;
+		}
+
+		tree_type::index_type first;
+		bool found = tree.find_object_from_line(line, first);
+		double t = 0.0;
+		bool first_right = hits.empty() ? !found : found && intersect_2d(line, tree.object(first), t) && fabs(t - first_t) <= EPS;
+
+		wrong += (sorted(indices) != expected || !ordered || !first_right) ? 1 : 0;
+	}
+
+	return wrong;
+}
+
+int main(int argc, char** argv) {
+	size_t objects_count = argc > 1 ? (size_t)atol(argv[1]) : 50000;
+
+	std::mt19937 rng(1);
+	std::vector<tri2d> tris = make_tris(objects_count, rng);
+	query_set queries = make_queries(2000, rng);
+
+	rz_quadtree_options options;
+	options.objects_threshold = 16;
+	options.depth_threshold = 16;
+	tree_type tree(tris, options);
+
+	printf("%zu objects\n", objects_count);
+	bool ok = report("lines, scan", run_line_scan(tree, queries));
+
+	return ok ? 0 : 1;
+}
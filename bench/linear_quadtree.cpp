@@ -0,0 +1,107 @@
+/** @file linear_quadtree.cpp */
+// description: check of rz_linear_quadtree. its queries return whole
+// leaves, so every object a scan finds must be among them, and the ones
+// passing the exact test must be the scan. points include the object
+// vertices, which lie on cell edges. a set of objects with the same bounds
+// gets a unit root cell and must be found by point and aabb queries.
+// exits with 1 on any failed check.
+// usage: linear_quadtree [objects]
+// last updated: aug.28.2011
+
+// Copyright (C) 2011 Rim Zaidullin <tinybit@yandex.ru>
+
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+
+#include <cstdlib>
+
+#include "check_common.hpp"
+#include "rz_linear_quadtree.hpp"
+
+typedef rz_linear_quadtree<tri2d> linear_type;
+
+// 1 unless the leaf contents hold every scanned object and their exact
+// hits are the scan
+template <typename Test>
+static size_t compare(const linear_type& tree, const index_vector& leaves, const index_vector& expected, Test test) {
+	index_vector found = sorted(leaves);
+	found.erase(std::unique(found.begin(), found.end()), found.end());
+
+	if (!std::includes(found.begin(), found.end(), expected.begin(), expected.end())) {
+		return 1;
+	}
+
+	index_vector exact;
+	for (size_t i = 0; i < found.size(); ++i) {
+		if (test(tree.object(found[i]))) {
+			exact.push_back(found[i]);
+		}
+	}
+
+	return exact != expected ? 1 : 0;
+}
+
+static size_t run_queries(const linear_type& tree, const std::vector<tri2d>& tris, const query_set& queries) {
+	size_t wrong = 0;
+	index_vector indices;
+
+	for (size_t i = 0; i < queries.boxes.size(); ++i) {
+		const aabb2d& box = queries.boxes[i];
+		tree.get_indices_from_aabb(box, indices);
+		wrong += compare(tree, indices, scan_box(tris, box), [&box](const tri2d& tri) { return intersect_2d(box, tri); });
+	}
+
+	for (size_t i = 0; i < queries.points.size(); ++i) {
+		const point2d& pt = queries.points[i];
+		tree.get_indices_from_point(pt, indices);
+		wrong += compare(tree, indices, scan_point(tris, pt), [&pt](const tri2d& tri) { return intersect_2d(tri, pt); });
+	}
+
+	return wrong;
+}
+
+int main(int argc, char** argv) {
+	size_t objects_count = argc > 1 ? (size_t)atol(argv[1]) : 20000;
+
+	std::mt19937 rng(1);
+	std::vector<tri2d> tris = make_tris(objects_count, rng);
+	query_set queries = make_queries(2000, rng);
+
+	// vertices of the first objects, on the edges of their cells
+	for (size_t i = 0; i < 2000 && i < tris.size(); ++i) {
+		queries.points.push_back(tris[i].point[i % 3]);
+	}
+
+	linear_type tree(tris, 16, 16);
+
+	// every object a point, and the same one
+	point2d at(domain_size / 2.0, domain_size / 3.0);
+	std::vector<tri2d> same(40, tri2d(at, at, at));
+	linear_type same_tree(same, 16, 16);
+
+	query_set same_queries;
+	same_queries.boxes.push_back(aabb2d(at, at));
+	same_queries.boxes.push_back(aabb2d(at - point2d(1.0, 1.0), at + point2d(1.0, 1.0)));
+	same_queries.boxes.push_back(aabb2d(at + point2d(1.0, 1.0), at + point2d(2.0, 2.0)));
+	same_queries.points.push_back(at);
+	same_queries.points.push_back(at + point2d(0.5, 0.0));
+
+	bool ok = true;
+
+	printf("%zu objects, %zu leaves\n", tree.size(), tree.leaf_count());
+	ok &= report("queries", run_queries(tree, tris, queries));
+	ok &= report("same bounds", run_queries(same_tree, same, same_queries) + (same_tree.leaf_count() != 1 ? 1 : 0));
+
+	return ok ? 0 : 1;
+}
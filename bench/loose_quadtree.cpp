@@ -0,0 +1,109 @@
+/** @file loose_quadtree.cpp */
+// description: check of rz_loose_quadtree. small triangles and long
+// segments, the objects strict trees copy into many leaves, are queried
+// by aabbs and points with and without the exact test. results must match
+// a scan of every object, each object reported once, and replication()
+// must be 1.
+// exits with 1 on any failed check.
+// usage: loose_quadtree [objects]
+// last updated: aug.28.2011
+
+// Copyright (C) 2011 Rim Zaidullin <tinybit@yandex.ru>
+
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+
+#include <cstdlib>
+
+#include "check_common.hpp"
+#include "rz_loose_quadtree.hpp"
+
+// segments up to a fifth of the domain long
+static std::vector<line2d> make_lines(size_t count, std::mt19937& rng) {
+	std::uniform_real_distribution<double> position(0.0, domain_size);
+	std::uniform_real_distribution<double> extent(-domain_size / 10.0, domain_size / 10.0);
+
+	std::vector<line2d> lines;
+
+	for (size_t i = 0; i < count; ++i) {
+		point2d at(position(rng), position(rng));
+		lines.push_back(line2d(at, point2d(at.x + extent(rng), at.y + extent(rng))));
+	}
+
+	return lines;
+}
+
+template <typename O, typename F>
+static index_vector scan_objects(const std::vector<O>& objects, F test) {
+	index_vector indices;
+
+	for (size_t i = 0; i < objects.size(); ++i) {
+		if (test(objects[i], aabb2d(min_2d(objects[i]), max_2d(objects[i])))) {
+			indices.push_back((tree_type::index_type)i);
+		}
+	}
+
+	return indices;
+}
+
+// bounds only and exact queries against a scan, then the replication
+template <typename O>
+static size_t run_loose(const std::vector<O>& objects, const query_set& queries) {
+	rz_loose_quadtree<O> tree(objects, 2.0, 16, 16);
+	index_vector indices;
+	size_t wrong = tree.replication() != 1.0 ? 1 : 0;
+
+	for (size_t i = 0; i < queries.boxes.size(); ++i) {
+		const aabb2d& box = queries.boxes[i];
+		const point2d& pt = queries.points[i];
+
+		tree.get_indices_from_aabb(box, indices);
+		wrong += sorted(indices) != scan_objects(objects, [&box](const O&, const aabb2d& bounds) { return intersect_2d(box, bounds); }) ? 1 : 0;
+
+		tree.get_indices_from_aabb(box, indices, RZ_QUERY_EXACT);
+		wrong += sorted(indices) != scan_objects(objects, [&box](const O& object, const aabb2d&) { return intersect_2d(box, object); }) ? 1 : 0;
+
+		tree.get_indices_from_point(pt, indices);
+		wrong += sorted(indices) != scan_objects(objects, [&pt](const O&, const aabb2d& bounds) { return intersect_2d(bounds, pt); }) ? 1 : 0;
+
+		tree.get_indices_from_point(pt, indices, RZ_QUERY_EXACT);
+		wrong += sorted(indices) != scan_objects(objects, [&pt](const O& object, const aabb2d& bounds) {
+			return intersect_2d(bounds, pt) && intersect_2d(object, pt);
+		}) ? 1 : 0;
+	}
+
+	return wrong;
+}
+
+int main(int argc, char** argv) {
+	size_t objects_count = argc > 1 ? (size_t)atol(argv[1]) : 20000;
+
+	std::mt19937 rng(1);
+	std::vector<tri2d> tris = make_tris(objects_count, rng);
+	std::vector<line2d> lines = make_lines(objects_count, rng);
+	query_set queries = make_queries(2000, rng);
+
+	// points on the objects too, a random point hardly ever touches a segment
+	for (size_t i = 0; i < 2000 && i < lines.size(); ++i) {
+		queries.points[i] = i % 2 ? lines[i].begin : tris[i].point[0];
+	}
+
+	bool ok = true;
+
+	printf("%zu objects of each kind, %zu queries of each kind\n", objects_count, queries.boxes.size());
+	ok &= report("triangles", run_loose(tris, queries));
+	ok &= report("segments", run_loose(lines, queries));
+
+	return ok ? 0 : 1;
+}
@@ -0,0 +1,183 @@
+/** @file mapped_quadtree.cpp */
+// description: check of the binary image round trip. a tree with removed
+// and inserted objects is saved and opened by rz_mapped_quadtree, its
+// objects and query results must match the saved tree. a truncated file
+// must be rejected on open, files with a broken node link or object index
+// must open but fail validate() and queries reaching the broken part.
+// exits with 1 on any failed check.
+// usage: mapped_quadtree [objects] [path]
+// last updated: aug.28.2011
+
+// Copyright (C) 2011 Rim Zaidullin <tinybit@yandex.ru>
+
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+
+#include <cstdlib>
+#include <fstream>
+#include <iterator>
+#include <string>
+
+#include "check_common.hpp"
+#include "rz_mapped_quadtree.hpp"
+
+typedef rz_mapped_quadtree<tri2d> mapped_type;
+
+static std::vector<char> read_file(const std::string& path) {
+	std::ifstream file(path.c_str(), std::ios::in | std::ios::binary);
+	return std::vector<char>(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+}
+
+static void write_file(const std::string& path, const std::vector<char>& bytes, size_t size) {
+	std::ofstream file(path.c_str(), std::ios::out | std::ios::binary | std::ios::trunc);
+	file.write(bytes.data(), size);
+}
+
+// objects, aabb and point queries with and without the exact test
+static size_t run_round_trip(const tree_type& tree, const mapped_type& mapped, const query_set& queries) {
+	size_t wrong = mapped.size() != tree.size() ? 1 : 0;
+
+	for (size_t i = 0; i < tree.size() && i < mapped.size(); ++i) {
+		tree_type::index_type index = (tree_type::index_type)i;
+		wrong += tree.contains(index) && !(mapped.object(index) == tree.object(index)) ? 1 : 0;
+	}
+
+	const unsigned int flags[2] = { RZ_QUERY_UNIQUE, aabb_flags };
+	index_vector expected;
+	index_vector indices;
+
+	for (size_t i = 0; i < queries.boxes.size(); ++i) {
+		for (size_t f = 0; f < 2; ++f) {
+			tree.get_indices_from_aabb(queries.boxes[i], expected, flags[f]);
+			mapped.get_indices_from_aabb(queries.boxes[i], indices, flags[f]);
+			wrong += sorted(indices) != sorted(expected) ? 1 : 0;
+
+			tree.get_indices_from_point(queries.points[i], expected, flags[f] & RZ_QUERY_EXACT);
+			mapped.get_indices_from_point(queries.points[i], indices, flags[f] & RZ_QUERY_EXACT);
+			wrong += sorted(indices) != sorted(expected) ? 1 : 0;
+		}
+	}
+
+	return wrong;
+}
+
+// 1 unless opening the file throws
+static size_t opens(const std::string& path) {
+	try {
+		mapped_type mapped(path);
+	}
+	catch (const std::runtime_error&) {
+		return 0;
+	}
+
+	return 1;
+}
+
+// 1 unless the file opens and validate() and a query over the whole tree throw
+static size_t fails_validation(const std::string& path) {
+	try {
+		mapped_type mapped(path);
+
+		try {
+			mapped.validate();
+			return 1;
+		}
+		catch (const std::runtime_error&) {
+		}
+
+		try {
+			index_vector indices;
+			mapped.get_indices_from_aabb(aabb2d(point2d(0.0, 0.0), point2d(domain_size, domain_size)), indices, RZ_QUERY_UNIQUE);
+			return 1;
+		}
+		catch (const std::runtime_error&) {
+		}
+	}
+	catch (const std::runtime_error&) {
+		return 1;
+	}
+
+	return 0;
+}
+
+// truncated file, root linking to itself, a leaf index past the objects
+static size_t run_corrupted(const std::string& path) {
+	std::vector<char> bytes = read_file(path);
+	rz_quadtree_file_header header;
+	memcpy(&header, bytes.data(), sizeof(header));
+
+	std::string broken = path + ".broken";
+	size_t wrong = 0;
+
+	write_file(broken, bytes, bytes.size() / 2);
+	wrong += opens(broken);
+
+	write_file(broken, bytes, sizeof(header) - 1);
+	wrong += opens(broken);
+
+	std::vector<char> linked = bytes;
+	rz_quadtree_file_node root;
+	memcpy(&root, linked.data() + header.nodes_offset, sizeof(root));
+	root.first = 0;
+	memcpy(linked.data() + header.nodes_offset, &root, sizeof(root));
+	write_file(broken, linked, linked.size());
+	wrong += fails_validation(broken);
+
+	std::vector<char> indexed = bytes;
+	uint32_t index = (uint32_t)header.objects_count;
+	memcpy(indexed.data() + header.indices_offset, &index, sizeof(index));
+	write_file(broken, indexed, indexed.size());
+	wrong += fails_validation(broken);
+
+	remove(broken.c_str());
+	return wrong;
+}
+
+int main(int argc, char** argv) {
+	size_t objects_count = argc > 1 ? (size_t)atol(argv[1]) : 50000;
+	std::string path = argc > 2 ? argv[2] : "mapped_quadtree_check.rzq";
+
+	std::mt19937 rng(1);
+	std::vector<tri2d> tris = make_tris(objects_count, rng);
+	query_set queries = make_queries(2000, rng);
+
+	rz_quadtree_options options;
+	options.objects_threshold = 16;
+	options.depth_threshold = 16;
+	tree_type tree(tris, options);
+
+	// removed slots are saved too, the mapped tree never reports them
+	std::vector<tri2d> inserted = make_tris(objects_count / 10, rng);
+	for (size_t i = 0; i < inserted.size(); ++i) {
+		tree.remove((tree_type::index_type)(i * 7 % tris.size()));
+		tree.insert(inserted[i]);
+		tree.remove((tree_type::index_type)(i * 13 % tris.size()));
+	}
+
+	tree.save(path);
+
+	bool ok = true;
+
+	printf("%zu objects, %zu queries of each kind\n", tree.count(), queries.boxes.size());
+	{
+		mapped_type mapped(path);
+		mapped.validate();
+		ok &= report("round trip", run_round_trip(tree, mapped, queries));
+	}
+
+	ok &= report("corrupted files", run_corrupted(path));
+
+	remove(path.c_str());
+	return ok ? 0 : 1;
+}
@@ -0,0 +1,100 @@
+/** @file nearest_queries.cpp */
+// description: check of the k nearest neighbour queries against a linear
+// scan of the objects.
+// exits with 1 on any failed check.
+// usage: nearest_queries [objects]
+// last updated: aug.28.2011
+
+// Copyright (C) 2011 Rim Zaidullin <tinybit@yandex.ru>
+
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+
+#include <cstdlib>
+
+#include "check_common.hpp"
+
+// the k smallest distances of the live objects, closest first
+static std::vector<double> scan_nearest(const tree_type& tree, const point2d& pt, size_t k) {
+	std::vector<double> distances;
+
+	for (size_t i = 0; i < tree.size(); ++i) {
+		tree_type::index_type index = (tree_type::index_type)i;
+
+		if (tree.contains(index)) {
+			distances.push_back(distance_2d(tree.object(index), pt));
+		}
+	}
+
+	k = std::min(k, distances.size());
+	std::partial_sort(distances.begin(), distances.begin() + k, distances.end());
+	distances.resize(k);
+
+	return distances;
+}
+
+// nearest queries against a linear scan. ties may be broken either way,
+// so the distances are compared, and every object reported must be at the
+// distance it's reported with
+static size_t run_nearest_scan(const tree_type& tree, const query_set& queries) {
+	const size_t checked = std::min(queries.points.size(), (size_t)200);
+	size_t wrong = 0;
+
+	for (size_t i = 0; i < checked; ++i) {
+		const point2d& pt = queries.points[i];
+		std::vector<double> expected = scan_nearest(tree, pt, 4);
+
+		tree_type::neighbour_vector neighbours;
+		tree.nearest(pt, 4, neighbours);
+
+		std::vector<double> distances;
+		index_vector indices;
+		bool at_distance = true;
+
+		for (size_t n = 0; n < neighbours.size(); ++n) {
+			distances.push_back(neighbours[n].second);
+			indices.push_back(neighbours[n].first);
+			at_distance = at_distance && distance_2d(tree.object(neighbours[n].first), pt) == neighbours[n].second;
+		}
+
+		indices = sorted(indices);
+		bool unique = std::adjacent_find(indices.begin(), indices.end()) == indices.end();
+
+		tree_type::index_type closest;
+		bool found = tree.nearest(pt, closest);
+		bool closest_right = expected.empty() ? !found : found && distance_2d(tree.object(closest), pt) == expected[0];
+
+		wrong += (distances != expected || !at_distance || !unique || !closest_right) ? 1 : 0;
+	}
+
+	return wrong;
+}
+
+int main(int argc, char** argv) {
+	size_t objects_count = argc > 1 ? (size_t)atol(argv[1]) : 50000;
+
+	std::mt19937 rng(1);
+	std::vector<tri2d> tris = make_tris(objects_count, rng);
+	query_set queries = make_queries(2000, rng);
+
+	rz_quadtree_options options;
+	options.objects_threshold = 16;
+	options.depth_threshold = 16;
+	tree_type tree(tris, options);
+
+	printf("%zu objects\n", objects_count);
+	bool ok = report("nearest, scan", run_nearest_scan(tree, queries));
+
+	return ok ? 0 : 1;
+}
@@ -0,0 +1,107 @@
+/** @file query_instrumentation.cpp */
+// description: check of the query instrumentation. an instrumented tree is
+// queried by several threads while its profiles are taken and reset, the
+// profiles must add up to the queries run.
+// exits with 1 on any failed check.
+// usage: query_instrumentation [objects] [threads]
+// last updated: aug.28.2011
+
+// Copyright (C) 2011 Rim Zaidullin <tinybit@yandex.ru>
+
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+
+#include <atomic>
+#include <cstdlib>
+#include <thread>
+
+#include "check_common.hpp"
+
+typedef rz_quadtree<tri2d, std::allocator<tri2d>, rz_query_instrumentation> instrumented_tree;
+
+// one thread takes snapshots, the calling thread snapshots and resets
+// until the querying threads are done. a snapshot above the queries run
+// means it subtracted a baseline newer than its totals
+static size_t run_instrumented(const std::vector<tri2d>& tris, const rz_quadtree_options& options, const query_set& queries, size_t threads_count) {
+	instrumented_tree tree(tris, options);
+	uint64_t total = (uint64_t)threads_count * queries.boxes.size();
+
+	std::atomic<size_t> running(threads_count);
+	std::atomic<size_t> wrong(0);
+	std::vector<std::thread> threads;
+
+	for (size_t t = 0; t < threads_count; ++t) {
+		threads.push_back(std::thread([&]() {
+			index_vector indices;
+
+			for (size_t i = 0; i < queries.boxes.size(); ++i) {
+				tree.get_indices_from_aabb(queries.boxes[i], indices, aabb_flags);
+			}
+
+			--running;
+		}));
+	}
+
+	auto check = [&](const rz_query_profile& profile) {
+		bool above = profile.queries > total;
+
+		for (size_t i = 0; i < profile.latency.size(); ++i) {
+			above = above || profile.latency[i] > total;
+		}
+
+		wrong += above ? 1 : 0;
+	};
+
+	std::thread observer([&]() {
+		while (running > 0) {
+			check(tree.instrumentation().snapshot().kinds[RZ_AABB_QUERY]);
+		}
+	});
+
+	uint64_t counted = 0;
+
+	for (bool done = false; !done;) {
+		done = running == 0;
+
+		rz_query_profile profile = tree.instrumentation().snapshot_and_reset().kinds[RZ_AABB_QUERY];
+		check(profile);
+		counted += profile.queries;
+	}
+
+	for (size_t t = 0; t < threads.size(); ++t) {
+		threads[t].join();
+	}
+
+	observer.join();
+
+	return wrong + (counted != total ? 1 : 0);
+}
+
+int main(int argc, char** argv) {
+	size_t objects_count = argc > 1 ? (size_t)atol(argv[1]) : 50000;
+	size_t threads_count = argc > 2 ? (size_t)atol(argv[2]) : 4;
+
+	std::mt19937 rng(1);
+	std::vector<tri2d> tris = make_tris(objects_count, rng);
+	query_set queries = make_queries(2000, rng);
+
+	rz_quadtree_options options;
+	options.objects_threshold = 16;
+	options.depth_threshold = 16;
+
+	printf("%zu objects, %zu queries, %zu threads\n", objects_count, queries.boxes.size(), threads_count);
+	bool ok = report("instrumentation", run_instrumented(tris, options, queries, threads_count));
+
+	return ok ? 0 : 1;
+}
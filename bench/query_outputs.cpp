@@ -0,0 +1,85 @@
+/** @file query_outputs.cpp */
+// description: check of the output contract of the queries. every query
+// filling a vector must replace its contents, the results must not depend
+// on what the vector held before.
+// exits with 1 on any failed check.
+// usage: query_outputs [objects]
+// last updated: aug.28.2011
+
+// Copyright (C) 2011 Rim Zaidullin <tinybit@yandex.ru>
+
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+
+#include <cstdlib>
+
+#include "check_common.hpp"
+
+// every query filling a vector replaces its contents, the output vectors
+// start out holding a stale entry
+static size_t run_cleared_outputs(const tree_type& tree, const query_set& queries) {
+	const index_vector stale(1, (tree_type::index_type)tree.size());
+	size_t wrong = 0;
+
+	for (size_t i = 0; i < queries.boxes.size(); ++i) {
+		index_vector boxes = box_result(tree, queries.boxes[i]);
+		index_vector points = point_result(tree, queries.points[i]);
+		index_vector lines = line_result(tree, queries.lines[i]);
+
+		index_vector indices = stale;
+		tree.get_indices_from_aabb(queries.boxes[i], indices, aabb_flags);
+		wrong += sorted(indices) != boxes ? 1 : 0;
+
+		rz_query_scope scope;
+		indices = stale;
+		tree.get_indices_from_aabb(queries.boxes[i], indices, aabb_flags, scope.context());
+		wrong += sorted(indices) != boxes ? 1 : 0;
+
+		tree_type::o_vector objects(1, tree.object(0));
+		tree.get_objects_from_aabb(queries.boxes[i], objects, aabb_flags);
+		wrong += objects.size() != boxes.size() ? 1 : 0;
+
+		indices = stale;
+		tree.get_indices_from_point(queries.points[i], indices, RZ_QUERY_EXACT);
+		wrong += sorted(indices) != points ? 1 : 0;
+
+		objects.assign(1, tree.object(0));
+		tree.get_objects_from_point(queries.points[i], objects, RZ_QUERY_EXACT);
+		wrong += objects.size() != points.size() ? 1 : 0;
+
+		indices = stale;
+		tree.get_indices_from_line(queries.lines[i], indices);
+		wrong += indices != lines ? 1 : 0;
+	}
+
+	return wrong;
+}
+
+int main(int argc, char** argv) {
+	size_t objects_count = argc > 1 ? (size_t)atol(argv[1]) : 50000;
+
+	std::mt19937 rng(1);
+	std::vector<tri2d> tris = make_tris(objects_count, rng);
+	query_set queries = make_queries(2000, rng);
+
+	rz_quadtree_options options;
+	options.objects_threshold = 16;
+	options.depth_threshold = 16;
+	tree_type tree(tris, options);
+
+	printf("%zu objects, %zu queries of each kind\n", objects_count, queries.boxes.size());
+	bool ok = report("cleared outputs", run_cleared_outputs(tree, queries));
+
+	return ok ? 0 : 1;
+}
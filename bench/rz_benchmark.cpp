@@ -0,0 +1,831 @@
+/** @file rz_benchmark.cpp */
+// description: rz_quadtree benchmark. builds the tree over synthetic and
+// realistic datasets for every objects_threshold / depth_threshold pair of
+// the sweep, and measures build time, peak heap usage during the build,
+// heap kept by the tree, tree shape, point and aabb query latency (mean,
+// p50, p99) and throughput. the sweep is run for every split policy,
+// midpoint splits with a square root cell, median and sah splits with the
+// data box as the root cell. every dataset is also built with the split
+// cost model calibrated on its box queries, once per split policy and
+// depth threshold. results are written as json, one record per dataset,
+// split policy and thresholds pair ("split": "fixed") or cost model build
+// ("split": "cost"), progress goes to stderr. with --join every tree is
+// also joined with itself, timed against one exact box query per object.
+// every dataset is built once more for each thread count of --threads,
+// with default options, 1 being the sequential build. the best of three
+// builds and its speedup over the first thread count are written to
+// "build_scaling".
+// datasets:
+//   uniform   - small random triangles over the whole domain
+//   clustered - small triangles in a few dense gaussian clusters
+//   lines     - long thin lines in random directions
+//   tin       - triangulated irregular network over a jittered grid
+//   corridor  - small triangles along a long, thin winding band
+// queries are placed next to random objects, so they follow the data.
+// usage: rz_benchmark [--objects=N] [--queries=N] [--seed=N]
+//                     [--thresholds=a,b,..] [--depths=a,b,..]
+//                     [--datasets=a,b,..] [--splits=a,b,..]
+//                     [--threads=a,b,..] [--output=file.json]
+//                     [--no-cost-model] [--join]
+// last updated: aug.28.2011
+
+// Copyright (C) 2011 Rim Zaidullin <tinybit@yandex.ru>
+
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <new>
+#include <random>
+#include <string>
+#include <vector>
+
+#include <sys/resource.h>
+
+#include "rz_quadtree.hpp"
+
+#ifndef RZ_BENCHMARK_VERSION
+#define RZ_BENCHMARK_VERSION "unknown"
+#endif
+
+// heap accounting, every allocation carries its size in front of the block
+namespace {
+
+std::atomic<size_t> heap_live(0);
+std::atomic<size_t> heap_peak(0);
+
+const size_t heap_header = 16;
+
+void* heap_allocate(size_t size) {
+	char* block = (char*)malloc(size + heap_header);
+
+	if (!block) {
+		throw std::bad_alloc();
+	}
+
+	*(size_t*)block = size;
+
+	size_t live = heap_live.fetch_add(size) + size;
+	size_t peak = heap_peak.load();
+
+	while (live > peak && !heap_peak.compare_exchange_weak(peak, live)) {
+	}
+
+	return block + heap_header;
+}
+
+void heap_release(void* pointer) {
+	if (!pointer) {
+		return;
+	}
+
+	char* block = (char*)pointer - heap_header;
+	heap_live.fetch_sub(*(size_t*)block);
+	free(block);
+}
+
+} // namespace
+
+void* operator new(size_t size) {
+	return heap_allocate(size);
+}
+
+void* operator new[](size_t size) {
+	return heap_allocate(size);
+}
+
+void operator delete(void* pointer) noexcept {
+	heap_release(pointer);
+}
+
+void operator delete[](void* pointer) noexcept {
+	heap_release(pointer);
+}
+
+void operator delete(void* pointer, size_t) noexcept {
+	heap_release(pointer);
+}
+
+void operator delete[](void* pointer, size_t) noexcept {
+	heap_release(pointer);
+}
+
+using namespace rimz;
+
+typedef rz_point_2d<double> point2d;
+typedef rz_aabb<point2d> aabb2d;
+typedef rz_line<point2d> line2d;
+typedef rz_tri<point2d> tri2d;
+
+typedef std::chrono::steady_clock bench_clock;
+
+static const double domain_size = 1000.0;
+
+struct bench_options {
+	bench_options() : objects(200000), queries(20000), seed(1), cost_model(true), join(false) {
+		size_t default_thresholds[] = { 8, 16, 32, 64, 128 };
+		size_t default_depths[] = { 8, 12, 16 };
+		const char* default_datasets[] = { "uniform", "clustered", "lines", "tin", "corridor" };
+		const char* default_splits[] = { "midpoint", "median", "sah" };
+		size_t default_threads[] = { 1, 2, 4, 8 };
+
+		thresholds.assign(default_thresholds, default_thresholds + 5);
+		depths.assign(default_depths, default_depths + 3);
+		datasets.assign(default_datasets, default_datasets + 5);
+		splits.assign(default_splits, default_splits + 3);
+		threads.assign(default_threads, default_threads + 4);
+	}
+
+	size_t objects;
+	size_t queries;
+	unsigned int seed;
+	std::vector<size_t> thresholds;
+	std::vector<size_t> depths;
+	std::vector<std::string> datasets;
+	std::vector<std::string> splits;
+	std::vector<size_t> threads;
+	std::string output;
+	bool cost_model;
+	bool join;
+};
+
+struct latency_stats {
+	latency_stats() : mean_ns(0.0), p50_ns(0.0), p99_ns(0.0), queries_per_second(0.0), hits(0) {}
+
+	double mean_ns;
+	double p50_ns;
+	double p99_ns;
+	double queries_per_second;
+	size_t hits;
+};
+
+struct join_stats {
+	join_stats() : pairs(0), seconds(0.0), query_loop_seconds(0.0) {}
+
+	size_t pairs;			// intersecting pairs, each once
+	double seconds;			// rz_quadtree::join of the tree with itself
+	double query_loop_seconds;	// the same pairs by a box query per object
+};
+
+struct bench_result {
+	std::string dataset;
+	std::string split;	// "fixed" thresholds or "cost" model
+	std::string split_policy;
+	bool rectangular_root;
+	size_t objects;
+	size_t objects_threshold;
+	size_t depth_threshold;
+	double build_seconds;
+	size_t build_peak_bytes;
+	size_t tree_bytes;
+	double replication;
+	size_t nodes;
+	size_t leaves;
+	size_t max_depth;
+	size_t overfull_leaves;
+	latency_stats point;
+	latency_stats aabb;
+	bool joined;
+	join_stats join;
+};
+
+struct scaling_result {
+	std::string dataset;
+	size_t threads;
+	double build_seconds;	// best of the runs
+	double speedup;		// over the first thread count of the sweep
+};
+
+static double seconds_since(const bench_clock::time_point& start) {
+	return std::chrono::duration<double>(bench_clock::now() - start).count();
+}
+
+static point2d clamp_to_domain(const point2d& pt) {
+	return point2d(std::min(std::max(pt.x, 0.0), domain_size), std::min(std::max(pt.y, 0.0), domain_size));
+}
+
+static tri2d small_tri(const point2d& at, double size, std::mt19937& rng) {
+	std::uniform_real_distribution<double> extent(0.2 * size, 2.0 * size);
+	return tri2d(at, point2d(at.x + extent(rng), at.y), point2d(at.x, at.y + extent(rng)));
+}
+
+static std::vector<tri2d> make_uniform(size_t count, std::mt19937& rng) {
+	std::uniform_real_distribution<double> position(0.0, domain_size);
+	std::vector<tri2d> tris;
+	tris.reserve(count);
+
+	for (size_t i = 0; i < count; ++i) {
+		tris.push_back(small_tri(point2d(position(rng), position(rng)), 1.0, rng));
+	}
+
+	return tris;
+}
+
+// a few dense clusters, most of the domain stays empty. objects are
+// smaller in denser clusters, like buildings in a city centre
+static std::vector<tri2d> make_clustered(size_t count, std::mt19937& rng) {
+	const size_t clusters = 16;
+
+	std::uniform_real_distribution<double> position(0.0, domain_size);
+	std::uniform_real_distribution<double> spread(5.0, 50.0);
+	std::uniform_int_distribution<size_t> pick(0, clusters - 1);
+
+	point2d centers[clusters];
+	double sigmas[clusters];
+
+	for (size_t i = 0; i < clusters; ++i) {
+		centers[i] = point2d(position(rng), position(rng));
+		sigmas[i] = spread(rng);
+	}
+
+	std::vector<tri2d> tris;
+	tris.reserve(count);
+
+	for (size_t i = 0; i < count; ++i) {
+		size_t cluster = pick(rng);
+		std::normal_distribution<double> offset(0.0, sigmas[cluster]);
+		point2d at(centers[cluster].x + offset(rng), centers[cluster].y + offset(rng));
+		tris.push_back(small_tri(clamp_to_domain(at), sigmas[cluster] / 100.0, rng));
+	}
+
+	return tris;
+}
+
+// lines much longer than leaf cells, stored in many leaves
+static std::vector<line2d> make_lines(size_t count, std::mt19937& rng) {
+	std::uniform_real_distribution<double> position(0.0, domain_size);
+	std::uniform_real_distribution<double> angle(0.0, 2.0 * M_PI);
+	std::uniform_real_distribution<double> length(domain_size / 100.0, domain_size / 20.0);
+
+	std::vector<line2d> lines;
+	lines.reserve(count);
+
+	for (size_t i = 0; i < count; ++i) {
+		point2d begin(position(rng), position(rng));
+		double a = angle(rng);
+		double l = length(rng);
+		lines.push_back(line2d(begin, clamp_to_domain(point2d(begin.x + l * cos(a), begin.y + l * sin(a)))));
+	}
+
+	return lines;
+}
+
+// terrain like mesh, every grid cell split into two triangles along a
+// random diagonal, vertices jittered inside their cells
+static std::vector<tri2d> make_tin(size_t count, std::mt19937& rng) {
+	size_t side = std::max((size_t)2, (size_t)sqrt(count / 2.0) + 1);
+	double step = domain_size / (side - 1);
+
+	std::uniform_real_distribution<double> jitter(-0.35 * step, 0.35 * step);
+	std::uniform_int_distribution<int> diagonal(0, 1);
+
+	std::vector<point2d> vertices(side * side);
+
+	for (size_t y = 0; y < side; ++y) {
+		for (size_t x = 0; x < side; ++x) {
+			bool border = x == 0 || y == 0 || x == side - 1 || y == side - 1;
+			point2d at(x * step, y * step);
+			vertices[y * side + x] = border ? at : point2d(at.x + jitter(rng), at.y + jitter(rng));
+		}
+	}
+
+	std::vector<tri2d> tris;
+	tris.reserve(2 * (side - 1) * (side - 1));
+
+	for (size_t y = 0; y + 1 < side; ++y) {
+		for (size_t x = 0; x + 1 < side; ++x) {
+			const point2d& a = vertices[y * side + x];
+			const point2d& b = vertices[y * side + x + 1];
+			const point2d& c = vertices[(y + 1) * side + x];
+			const point2d& d = vertices[(y + 1) * side + x + 1];
+
+			if (diagonal(rng)) {
+				tris.push_back(tri2d(a, b, d));
+				tris.push_back(tri2d(a, d, c));
+			}
+			else {
+				tris.push_back(tri2d(a, b, c));
+				tris.push_back(tri2d(b, d, c));
+			}
+		}
+	}
+
+	return tris;
+}
+
+// a winding road across the domain, a few percent of it wide. with a
+// square root cell most of the cells are empty
+static std::vector<tri2d> make_corridor(size_t count, std::mt19937& rng) {
+	std::uniform_real_distribution<double> position(0.0, domain_size);
+	std::normal_distribution<double> offset(0.0, domain_size / 400.0);
+
+	std::vector<tri2d> tris;
+	tris.reserve(count);
+
+	for (size_t i = 0; i < count; ++i) {
+		double x = position(rng);
+		double y = domain_size / 2.0 + domain_size / 100.0 * sin(6.0 * M_PI * x / domain_size) + offset(rng);
+		tris.push_back(small_tri(point2d(x, y), 0.2, rng));
+	}
+
+	return tris;
+}
+
+// query points on random objects. query boxes around them are about four
+// times the object size, but not bigger than a box covering 16 objects of
+// a uniform dataset
+template <typename T>
+static void make_queries(const std::vector<T>& objects, size_t count, std::mt19937& rng, std::vector<point2d>& points, std::vector<aabb2d>& boxes) {
+	std::uniform_int_distribution<size_t> pick(0, objects.size() - 1);
+	std::uniform_real_distribution<double> unit(0.0, 1.0);
+
+	double max_box_size = domain_size * sqrt(16.0 / objects.size());
+
+	points.clear();
+	boxes.clear();
+
+	for (size_t i = 0; i < count; ++i) {
+		const T& object = objects[pick(rng)];
+		point2d min = min_2d(object);
+		point2d max = max_2d(object);
+		point2d pt(min.x + unit(rng) * (max.x - min.x), min.y + unit(rng) * (max.y - min.y));
+
+		points.push_back(pt);
+
+		double box_size = std::min(4.0 * sqrt((max.x - min.x) * (max.x - min.x) + (max.y - min.y) * (max.y - min.y)), max_box_size);
+		double half = box_size * (0.5 + unit(rng)) / 2.0;
+		boxes.push_back(aabb2d(point2d(pt.x - half, pt.y - half), point2d(pt.x + half, pt.y + half)));
+	}
+}
+
+static void summarize(std::vector<double>& latencies, double loop_seconds, size_t hits, latency_stats& stats) {
+	std::sort(latencies.begin(), latencies.end());
+
+	double total = 0.0;
+	for (size_t i = 0; i < latencies.size(); ++i) {
+		total += latencies[i];
+	}
+
+	stats.mean_ns = latencies.empty() ? 0.0 : total / latencies.size();
+	stats.p50_ns = latencies.empty() ? 0.0 : latencies[latencies.size() / 2];
+	stats.p99_ns = latencies.empty() ? 0.0 : latencies[std::min(latencies.size() - 1, latencies.size() * 99 / 100)];
+	stats.queries_per_second = loop_seconds > 0.0 ? latencies.size() / loop_seconds : 0.0;
+	stats.hits = hits;
+}
+
+// latency is timed query by query, throughput over an untimed loop, so
+// the clock reads don't count against it
+template <typename Tree, typename Query, typename Run>
+static void measure(const Tree& tree, const std::vector<Query>& queries, Run run, latency_stats& stats) {
+	std::vector<double> latencies(queries.size());
+	size_t hits = 0;
+
+	for (size_t i = 0; i < queries.size(); ++i) {
+		bench_clock::time_point start = bench_clock::now();
+		hits += run(tree, queries[i]);
+		latencies[i] = std::chrono::duration<double, std::nano>(bench_clock::now() - start).count();
+	}
+
+	size_t loop_hits = 0;
+	bench_clock::time_point start = bench_clock::now();
+
+	for (size_t i = 0; i < queries.size(); ++i) {
+		loop_hits += run(tree, queries[i]);
+	}
+
+	double loop_seconds = seconds_since(start);
+
+	if (loop_hits != hits) {
+		fprintf(stderr, "rz_benchmark: query results differ between runs\n");
+		exit(1);
+	}
+
+	summarize(latencies, loop_seconds, hits, stats);
+}
+
+template <typename T>
+static size_t run_point(const rz_quadtree<T>& tree, const point2d& pt) {
+	size_t hits = 0;
+	tree.query_point(pt, [&hits](const T&) { ++hits; return true; }, RZ_QUERY_EXACT);
+	return hits;
+}
+
+template <typename T>
+static size_t run_aabb(const rz_quadtree<T>& tree, const aabb2d& aabb) {
+	size_t hits = 0;
+	tree.query_aabb(aabb, [&hits](const T&) { ++hits; return true; }, RZ_QUERY_EXACT | RZ_QUERY_UNIQUE);
+	return hits;
+}
+
+// pairs of objects i < j found by querying the bounds of every object
+template <typename T>
+static size_t run_query_join(const rz_quadtree<T>& tree) {
+	size_t pairs = 0;
+
+	for (uint32_t i = 0; i < tree.size(); ++i) {
+		const T& object = tree.object(i);
+		aabb2d bounds(min_2d(object), max_2d(object));
+
+		tree.query_aabb(bounds, [&](const T& other) {
+			pairs += (size_t)(&other - &tree.object(0)) > i && intersect_2d(object, other) ? 1 : 0;
+			return true;
+		}, RZ_QUERY_UNIQUE);
+	}
+
+	return pairs;
+}
+
+template <typename T>
+static void measure_join(const rz_quadtree<T>& tree, join_stats& stats) {
+	bench_clock::time_point start = bench_clock::now();
+	join(tree, tree, [&stats](uint32_t, uint32_t) { ++stats.pairs; return true; });
+	stats.seconds = seconds_since(start);
+
+	start = bench_clock::now();
+	size_t query_pairs = run_query_join(tree);
+	stats.query_loop_seconds = seconds_since(start);
+
+	if (query_pairs != stats.pairs) {
+		fprintf(stderr, "rz_benchmark: join and queries found different pairs\n");
+		exit(1);
+	}
+}
+
+static const char* split_policy_name(rz_split_policy policy) {
+	return policy == RZ_SPLIT_MEDIAN ? "median" : (policy == RZ_SPLIT_SAH ? "sah" : "midpoint");
+}
+
+static rz_split_policy split_policy_value(const std::string& name) {
+	return name == "median" ? RZ_SPLIT_MEDIAN : (name == "sah" ? RZ_SPLIT_SAH : RZ_SPLIT_MIDPOINT);
+}
+
+template <typename T>
+static void run_tree(const std::string& name, const std::vector<T>& objects, const rz_quadtree_options& tree_options,
+	const std::vector<point2d>& points, const std::vector<aabb2d>& boxes, bool join, std::vector<bench_result>& results) {
+	bench_result result;
+	result.dataset = name;
+	result.split = tree_options.split_cost.enabled ? "cost" : "fixed";
+	result.split_policy = split_policy_name(tree_options.split_policy);
+	result.rectangular_root = tree_options.rectangular_root;
+	result.objects = objects.size();
+	result.objects_threshold = tree_options.objects_threshold;
+	result.depth_threshold = tree_options.depth_threshold;
+
+	size_t live_before = heap_live.load();
+	heap_peak.store(live_before);
+
+	bench_clock::time_point start = bench_clock::now();
+	rz_quadtree<T> tree(objects, tree_options);
+	result.build_seconds = seconds_since(start);
+
+	result.build_peak_bytes = heap_peak.load() - live_before;
+	result.tree_bytes = heap_live.load() - live_before;
+
+	rz_quadtree_stats stats = tree.stats();
+	result.replication = stats.replication;
+	result.nodes = stats.nodes;
+	result.leaves = stats.leaves;
+	result.max_depth = stats.max_depth;
+	result.overfull_leaves = stats.overfull_leaves;
+
+	measure(tree, points, run_point<T>, result.point);
+	measure(tree, boxes, run_aabb<T>, result.aabb);
+
+	result.joined = join;
+	if (join) {
+		measure_join(tree, result.join);
+	}
+
+	fprintf(stderr, "%-9s %-8s %-5s threshold %4zu depth %3zu: build %8.3f s, nodes %8zu, point p50 %8.0f ns, aabb p50 %8.0f ns\n",
+		name.c_str(), result.split_policy.c_str(), result.split.c_str(), result.objects_threshold, result.depth_threshold, result.build_seconds,
+		result.nodes, result.point.p50_ns, result.aabb.p50_ns);
+
+	results.push_back(result);
+}
+
+template <typename T>
+static void run_dataset(const std::string& name, const std::vector<T>& objects, const bench_options& options, std::mt19937& rng, std::vector<bench_result>& results,
+	std::vector<scaling_result>& scaling) {
+	std::vector<point2d> points;
+	std::vector<aabb2d> boxes;
+	make_queries(objects, options.queries, rng, points, boxes);
+
+	for (size_t s = 0; s < options.splits.size(); ++s) {
+		rz_quadtree_options split_options;
+		split_options.split_policy = split_policy_value(options.splits[s]);
+		split_options.rectangular_root = split_options.split_policy != RZ_SPLIT_MIDPOINT;
+
+		for (size_t t = 0; t < options.thresholds.size(); ++t) {
+			for (size_t d = 0; d < options.depths.size(); ++d) {
+				rz_quadtree_options tree_options = split_options;
+				tree_options.objects_threshold = options.thresholds[t];
+				tree_options.depth_threshold = options.depths[d];
+				run_tree(name, objects, tree_options, points, boxes, options.join, results);
+			}
+		}
+	}
+
+	// cost model calibrated on the box queries, the smallest threshold of
+	// the sweep as the minimum leaf size
+	if (options.cost_model && !options.thresholds.empty()) {
+		rz_split_cost split_cost = rz_quadtree<T>::calibrate_split_cost(objects, boxes);
+		fprintf(stderr, "%-9s cost model: node %.1f ns, test %.1f ns, query size %.3f\n",
+			name.c_str(), split_cost.node_cost, split_cost.test_cost, split_cost.query_size);
+
+		for (size_t s = 0; s < options.splits.size(); ++s) {
+			for (size_t d = 0; d < options.depths.size(); ++d) {
+				rz_quadtree_options tree_options;
+				tree_options.objects_threshold = *std::min_element(options.thresholds.begin(), options.thresholds.end());
+				tree_options.depth_threshold = options.depths[d];
+				tree_options.split_cost = split_cost;
+				tree_options.split_policy = split_policy_value(options.splits[s]);
+				tree_options.rectangular_root = tree_options.split_policy != RZ_SPLIT_MIDPOINT;
+				run_tree(name, objects, tree_options, points, boxes, options.join, results);
+			}
+		}
+	}
+
+	run_build_scaling(name, objects, options, scaling);
+}
+
+// parallel build time against the number of threads, the calling thread
+// takes part in the build, so the pool gets one thread less
+template <typename T>
+static void run_build_scaling(const std::string& name, const std::vector<T>& objects, const bench_options& options, std::vector<scaling_result>& results) {
+	const size_t runs = 3;
+	double first_seconds = 0.0;
+
+	for (size_t t = 0; t < options.threads.size(); ++t) {
+		size_t threads = options.threads[t] > 0 ? options.threads[t] : 1;
+		std::unique_ptr<rz_thread_pool> pool(threads > 1 ? new rz_thread_pool(threads - 1) : NULL);
+
+		rz_quadtree_options tree_options;
+		tree_options.thread_pool = pool.get();
+
+		double best = 0.0;
+		for (size_t run = 0; run < runs; ++run) {
+			bench_clock::time_point start = bench_clock::now();
+			rz_quadtree<T> tree(objects, tree_options);
+			double seconds = seconds_since(start);
+
+			best = run == 0 ? seconds : std::min(best, seconds);
+		}
+
+		if (t == 0) {
+			first_seconds = best;
+		}
+
+		scaling_result result;
+		result.dataset = name;
+		result.threads = threads;
+		result.build_seconds = best;
+		result.speedup = best > 0.0 ? first_seconds / best : 0.0;
+
+		fprintf(stderr, "%-9s build with %3zu threads: %8.3f s, speedup %5.2f\n", name.c_str(), threads, best, result.speedup);
+
+		results.push_back(result);
+	}
+}
+
+static void write_latency(FILE* out, const char* name, const latency_stats& stats, bool last) {
+	fprintf(out, "      \"%s\": { \"mean_ns\": %.1f, \"p50_ns\": %.1f, \"p99_ns\": %.1f, \"queries_per_second\": %.1f, \"hits\": %zu }%s\n",
+		name, stats.mean_ns, stats.p50_ns, stats.p99_ns, stats.queries_per_second, stats.hits, last ? "" : ",");
+}
+
+static void write_json(FILE* out, const bench_options& options, const std::vector<bench_result>& results, const std::vector<scaling_result>& scaling) {
+	struct rusage usage;
+	getrusage(RUSAGE_SELF, &usage);
+
+	fprintf(out, "{\n");
+	fprintf(out, "  \"benchmark\": \"rz_quadtree\",\n");
+	fprintf(out, "  \"version\": \"%s\",\n", RZ_BENCHMARK_VERSION);
+	fprintf(out, "  \"compiler\": \"%s\",\n", __VERSION__);
+	fprintf(out, "  \"objects\": %zu,\n", options.objects);
+	fprintf(out, "  \"queries\": %zu,\n", options.queries);
+	fprintf(out, "  \"seed\": %u,\n", options.seed);
+	fprintf(out, "  \"max_rss_kb\": %ld,\n", usage.ru_maxrss);
+	fprintf(out, "  \"results\": [\n");
+
+	for (size_t i = 0; i < results.size(); ++i) {
+		const bench_result& result = results[i];
+
+		fprintf(out, "    {\n");
+		fprintf(out, "      \"dataset\": \"%s\",\n", result.dataset.c_str());
+		fprintf(out, "      \"split\": \"%s\",\n", result.split.c_str());
+		fprintf(out, "      \"split_policy\": \"%s\",\n", result.split_policy.c_str());
+		fprintf(out, "      \"root\": \"%s\",\n", result.rectangular_root ? "rectangular" : "square");
+		fprintf(out, "      \"objects\": %zu,\n", result.objects);
+		fprintf(out, "      \"objects_threshold\": %zu,\n", result.objects_threshold);
+		fprintf(out, "      \"depth_threshold\": %zu,\n", result.depth_threshold);
+		fprintf(out, "      \"build_seconds\": %.6f,\n", result.build_seconds);
+		fprintf(out, "      \"build_peak_bytes\": %zu,\n", result.build_peak_bytes);
+		fprintf(out, "      \"tree_bytes\": %zu,\n", result.tree_bytes);
+		fprintf(out, "      \"replication\": %.4f,\n", result.replication);
+		fprintf(out, "      \"nodes\": %zu,\n", result.nodes);
+		fprintf(out, "      \"leaves\": %zu,\n", result.leaves);
+		fprintf(out, "      \"max_depth\": %zu,\n", result.max_depth);
+		fprintf(out, "      \"overfull_leaves\": %zu,\n", result.overfull_leaves);
+		write_latency(out, "point", result.point, false);
+		write_latency(out, "aabb", result.aabb, !result.joined);
+
+		if (result.joined) {
+			fprintf(out, "      \"join\": { \"pairs\": %zu, \"seconds\": %.6f, \"query_loop_seconds\": %.6f }\n",
+				result.join.pairs, result.join.seconds, result.join.query_loop_seconds);
+		}
+
+		fprintf(out, "    }%s\n", i + 1 < results.size() ? "," : "");
+	}
+
+	fprintf(out, "  ],\n");
+	fprintf(out, "  \"build_scaling\": [\n");
+
+	for (size_t i = 0; i < scaling.size(); ++i) {
+		fprintf(out, "    { \"dataset\": \"%s\", \"threads\": %zu, \"build_seconds\": %.6f, \"speedup\": %.3f }%s\n",
+			scaling[i].dataset.c_str(), scaling[i].threads, scaling[i].build_seconds, scaling[i].speedup, i + 1 < scaling.size() ? "," : "");
+	}
+
+	fprintf(out, "  ]\n");
+	fprintf(out, "}\n");
+}
+
+static bool starts_with(const char* arg, const char* prefix, const char*& value) {
+	size_t length = strlen(prefix);
+
+	if (strncmp(arg, prefix, length) != 0) {
+		return false;
+	}
+
+	value = arg + length;
+	return true;
+}
+
+static std::vector<std::string> split_list(const char* list) {
+	std::vector<std::string> items;
+	std::string item;
+
+	for (const char* c = list; ; ++c) {
+		if (*c == ',' || *c == '\0') {
+			if (!item.empty()) {
+				items.push_back(item);
+			}
+
+			item.clear();
+
+			if (*c == '\0') {
+				break;
+			}
+		}
+		else {
+			item += *c;
+		}
+	}
+
+	return items;
+}
+
+static std::vector<size_t> split_numbers(const char* list) {
+	std::vector<std::string> items = split_list(list);
+	std::vector<size_t> numbers;
+
+	for (size_t i = 0; i < items.size(); ++i) {
+		numbers.push_back((size_t)strtoul(items[i].c_str(), NULL, 10));
+	}
+
+	return numbers;
+}
+
+static bool parse_options(int argc, char** argv, bench_options& options) {
+	for (int i = 1; i < argc; ++i) {
+		const char* value = NULL;
+
+		if (starts_with(argv[i], "--objects=", value)) {
+			options.objects = (size_t)strtoul(value, NULL, 10);
+		}
+		else if (starts_with(argv[i], "--queries=", value)) {
+			options.queries = (size_t)strtoul(value, NULL, 10);
+		}
+		else if (starts_with(argv[i], "--seed=", value)) {
+			options.seed = (unsigned int)strtoul(value, NULL, 10);
+		}
+		else if (starts_with(argv[i], "--thresholds=", value)) {
+			options.thresholds = split_numbers(value);
+		}
+		else if (starts_with(argv[i], "--depths=", value)) {
+			options.depths = split_numbers(value);
+		}
+		else if (starts_with(argv[i], "--datasets=", value)) {
+			options.datasets = split_list(value);
+		}
+		else if (starts_with(argv[i], "--splits=", value)) {
+			options.splits = split_list(value);
+
+			for (size_t s = 0; s < options.splits.size(); ++s) {
+				if (options.splits[s] != "midpoint" && options.splits[s] != "median" && options.splits[s] != "sah") {
+					fprintf(stderr, "rz_benchmark: unknown split policy %s\n", options.splits[s].c_str());
+					return false;
+				}
+			}
+		}
+		else if (starts_with(argv[i], "--threads=", value)) {
+			options.threads = split_numbers(value);
+		}
+		else if (starts_with(argv[i], "--output=", value)) {
+			options.output = value;
+		}
+		else if (strcmp(argv[i], "--no-cost-model") == 0) {
+			options.cost_model = false;
+		}
+		else if (strcmp(argv[i], "--join") == 0) {
+			options.join = true;
+		}
+		else {
+			fprintf(stderr, "rz_benchmark: unknown option %s\n", argv[i]);
+			return false;
+		}
+	}
+
+	if (options.objects == 0 || options.queries == 0) {
+		fprintf(stderr, "rz_benchmark: objects and queries must be positive\n");
+		return false;
+	}
+
+	return true;
+}
+
+int main(int argc, char** argv) {
+	bench_options options;
+
+	if (!parse_options(argc, argv, options)) {
+		fprintf(stderr, "usage: rz_benchmark [--objects=N] [--queries=N] [--seed=N] [--thresholds=a,b,..] [--depths=a,b,..] "
+			"[--datasets=uniform,clustered,lines,tin,corridor] [--splits=midpoint,median,sah] [--threads=a,b,..] [--output=file.json] [--no-cost-model] [--join]\n");
+		return 2;
+	}
+
+	std::vector<bench_result> results;
+	std::vector<scaling_result> scaling;
+
+	for (size_t i = 0; i < options.datasets.size(); ++i) {
+		const std::string& name = options.datasets[i];
+
+		// every dataset gets its own stream, so a subset of them gives the same data
+		unsigned int stream = 0;
+		for (size_t c = 0; c < name.size(); ++c) {
+			stream = stream * 31 + (unsigned char)name[c];
+		}
+
+		std::seed_seq seed = { options.seed, stream };
+		std::mt19937 rng(seed);
+
+		if (name == "uniform") {
+			run_dataset(name, make_uniform(options.objects, rng), options, rng, results, scaling);
+		}
+		else if (name == "clustered") {
+			run_dataset(name, make_clustered(options.objects, rng), options, rng, results, scaling);
+		}
+		else if (name == "lines") {
+			run_dataset(name, make_lines(options.objects, rng), options, rng, results, scaling);
+		}
+		else if (name == "tin") {
+			run_dataset(name, make_tin(options.objects, rng), options, rng, results, scaling);
+		}
+		else if (name == "corridor") {
+			run_dataset(name, make_corridor(options.objects, rng), options, rng, results, scaling);
+		}
+		else {
+			fprintf(stderr, "rz_benchmark: unknown dataset %s\n", name.c_str());
+			return 2;
+		}
+	}
+
+	FILE* out = options.output.empty() ? stdout : fopen(options.output.c_str(), "w");
+
+	if (!out) {
+		fprintf(stderr, "rz_benchmark: can't open %s\n", options.output.c_str());
+		return 1;
+	}
+
+	write_json(out, options, results, scaling);
+
+	if (out != stdout) {
+		fclose(out);
+	}
+
+	return 0;
+}
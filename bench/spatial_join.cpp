@@ -0,0 +1,96 @@
+/** @file spatial_join.cpp */
+// description: check of the spatial join against all pairs of objects
+// tested one by one. the objects are those in the lower left corner of the
+// domain, so the pairs stay few.
+// exits with 1 on any failed check.
+// usage: spatial_join [objects] [threads]
+// last updated: aug.28.2011
+
+// Copyright (C) 2011 Rim Zaidullin <tinybit@yandex.ru>
+
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+
+#include <cstdlib>
+
+#include "check_common.hpp"
+
+// every pair of objects tested on its own, index < other_index when the
+// tree is joined with itself
+static pair_vector scan_pairs(const std::vector<tri2d>& objects, const std::vector<tri2d>& others, bool self) {
+	pair_vector pairs;
+
+	for (size_t i = 0; i < objects.size(); ++i) {
+		for (size_t j = self ? i + 1 : 0; j < others.size(); ++j) {
+			if (intersect_2d(objects[i], others[j])) {
+				pairs.push_back(std::make_pair((tree_type::index_type)i, (tree_type::index_type)j));
+			}
+		}
+	}
+
+	return pairs;
+}
+
+// self join and a join of two trees, with and without a pool, against all
+// pairs. the objects are split between the two trees
+static size_t run_join_scan(const std::vector<tri2d>& objects, const rz_quadtree_options& options, rz_thread_pool& pool) {
+	std::vector<tri2d> firsts(objects.begin(), objects.begin() + objects.size() / 2);
+	std::vector<tri2d> seconds(objects.begin() + objects.size() / 2, objects.end());
+
+	tree_type tree(objects, options);
+	tree_type first_tree(firsts, options);
+	tree_type second_tree(seconds, options);
+
+	pair_vector expected = scan_pairs(objects, objects, true);
+	pair_vector expected_two = scan_pairs(firsts, seconds, false);
+
+	auto pairs_of = [](const tree_type& a, const tree_type& b, rz_thread_pool* pool) {
+		pair_vector pairs;
+
+		join(a, b, [&pairs](tree_type::index_type index, tree_type::index_type other_index) {
+			pairs.push_back(std::make_pair(index, other_index));
+			return true;
+		}, pool);
+
+		std::sort(pairs.begin(), pairs.end());
+		return pairs;
+	};
+
+	size_t wrong = 0;
+	wrong += pairs_of(tree, tree, NULL) != expected ? 1 : 0;
+	wrong += pairs_of(tree, tree, &pool) != expected ? 1 : 0;
+	wrong += pairs_of(first_tree, second_tree, NULL) != expected_two ? 1 : 0;
+	wrong += pairs_of(first_tree, second_tree, &pool) != expected_two ? 1 : 0;
+
+	return wrong;
+}
+
+int main(int argc, char** argv) {
+	size_t objects_count = argc > 1 ? (size_t)atol(argv[1]) : 50000;
+	size_t threads_count = argc > 2 ? (size_t)atol(argv[2]) : 4;
+
+	std::mt19937 rng(1);
+	std::vector<tri2d> tris = make_tris(objects_count, rng);
+
+	rz_quadtree_options options;
+	options.objects_threshold = 16;
+	options.depth_threshold = 16;
+	std::vector<tri2d> objects = corner_objects(tris);
+	rz_thread_pool pool(threads_count);
+
+	printf("%zu objects, %zu threads\n", objects.size(), threads_count);
+	bool ok = report("join, all pairs", run_join_scan(objects, options, pool));
+
+	return ok ? 0 : 1;
+}
@@ -0,0 +1,102 @@
+/** @file split_cost.cpp */
+// description: check of the split cost model with costs measured by
+// rz_quadtree::calibrate_split_cost. the costs must be positive and the
+// query size the mean side of the sample queries. trees built with them
+// under every split policy must answer aabb, point and line queries as a
+// scan does.
+// exits with 1 on any failed check.
+// usage: split_cost [objects]
+// last updated: aug.28.2011
+
+// Copyright (C) 2011 Rim Zaidullin <tinybit@yandex.ru>
+
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+
+#include <cmath>
+#include <cstdlib>
+
+#include "check_common.hpp"
+
+static size_t check_cost(const rz_split_cost& cost, const std::vector<aabb2d>& boxes) {
+	double query_size = 0.0;
+	for (size_t i = 0; i < boxes.size(); ++i) {
+		query_size += (boxes[i].width() + boxes[i].height()) / 2.0;
+	}
+
+	query_size = boxes.empty() ? 0.0 : query_size / boxes.size();
+
+	size_t wrong = cost.enabled ? 0 : 1;
+	wrong += cost.node_cost > 0.0 && cost.test_cost > 0.0 ? 0 : 1;
+	wrong += fabs(cost.query_size - query_size) > 1e-9 * (1.0 + query_size) ? 1 : 0;
+	return wrong;
+}
+
+static size_t run_calibrated(const std::vector<tri2d>& tris, const rz_split_cost& cost, const query_set& queries) {
+	const rz_split_policy policies[3] = { RZ_SPLIT_MIDPOINT, RZ_SPLIT_MEDIAN, RZ_SPLIT_SAH };
+	size_t wrong = 0;
+
+	for (size_t p = 0; p < 3; ++p) {
+		rz_quadtree_options options;
+		options.objects_threshold = 16;
+		options.depth_threshold = 16;
+		options.split_cost = cost;
+		options.split_policy = policies[p];
+		options.rectangular_root = policies[p] != RZ_SPLIT_MIDPOINT;
+
+		tree_type tree(tris, options);
+
+		for (size_t i = 0; i < queries.boxes.size(); ++i) {
+			wrong += box_result(tree, queries.boxes[i]) != scan_box(tris, queries.boxes[i]) ? 1 : 0;
+			wrong += point_result(tree, queries.points[i]) != scan_point(tris, queries.points[i]) ? 1 : 0;
+			wrong += sorted(line_result(tree, queries.lines[i])) != scan_line(tris, queries.lines[i]) ? 1 : 0;
+		}
+	}
+
+	return wrong;
+}
+
+int main(int argc, char** argv) {
+	size_t objects_count = argc > 1 ? (size_t)atol(argv[1]) : 50000;
+
+	// the corner keeps the density of the whole set, and the scans short
+	std::mt19937 rng(1);
+	std::vector<tri2d> tris = corner_objects(make_tris(objects_count, rng));
+	query_set queries = corner_queries(make_queries(500, rng));
+
+	// calibrated for box queries, and for point queries with empty boxes
+	std::vector<aabb2d> point_boxes;
+	for (size_t i = 0; i < queries.points.size(); ++i) {
+		point_boxes.push_back(aabb2d(queries.points[i], queries.points[i]));
+	}
+
+	rz_split_cost box_cost = tree_type::calibrate_split_cost(tris, queries.boxes);
+	rz_split_cost point_cost = tree_type::calibrate_split_cost(tris, point_boxes);
+
+	// nothing to measure, the defaults come back enabled
+	rz_split_cost empty_cost = tree_type::calibrate_split_cost(std::vector<tri2d>(), queries.boxes);
+	rz_split_cost defaults;
+
+	size_t cost_wrong = check_cost(box_cost, queries.boxes) + check_cost(point_cost, point_boxes);
+	cost_wrong += empty_cost.enabled && empty_cost.node_cost == defaults.node_cost && empty_cost.test_cost == defaults.test_cost ? 0 : 1;
+
+	bool ok = true;
+
+	printf("%zu objects, box queries: node %.1f ns, test %.1f ns\n", tris.size(), box_cost.node_cost, box_cost.test_cost);
+	ok &= report("calibrated costs", cost_wrong);
+	ok &= report("box query costs", run_calibrated(tris, box_cost, queries));
+	ok &= report("point query costs", run_calibrated(tris, point_cost, queries));
+
+	return ok ? 0 : 1;
+}
@@ -0,0 +1,141 @@
+/** @file tree_stats.cpp */
+// description: check of stats() and save_leaves() on small trees worked
+// out by hand. a root cell of 0..8 holds six objects, one triangle
+// crosses the middle and is stored twice. node, leaf, depth and reference
+// counts must match before and after removals, and so must the leaves
+// written as csv.
+// exits with 1 on any failed check.
+// usage: tree_stats [path]
+// last updated: aug.28.2011
+
+// Copyright (C) 2011 Rim Zaidullin <tinybit@yandex.ru>
+
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+
+#include <fstream>
+#include <string>
+
+#include "check_common.hpp"
+
+static tri2d point_object(double x, double y) {
+	return tri2d(point2d(x, y), point2d(x, y), point2d(x, y));
+}
+
+// pins at the root corners, one point in every quadrant of the root but
+// two in C, and a triangle across the border of A and B
+static std::vector<tri2d> make_known() {
+	std::vector<tri2d> tris;
+	tris.push_back(point_object(0.0, 0.0));
+	tris.push_back(point_object(8.0, 8.0));
+	tris.push_back(point_object(5.0, 1.0));
+	tris.push_back(point_object(1.0, 5.0));
+	tris.push_back(point_object(3.0, 1.0));
+	tris.push_back(tri2d(point2d(3.5, 5.0), point2d(4.5, 5.0), point2d(4.0, 5.5)));
+	return tris;
+}
+
+static size_t compare_stats(const rz_quadtree_stats& stats, size_t nodes, size_t leaves, size_t empty_leaves, size_t overfull_leaves,
+	size_t max_depth, size_t objects, size_t references) {
+	size_t wrong = 0;
+	wrong += stats.nodes != nodes ? 1 : 0;
+	wrong += stats.leaves != leaves ? 1 : 0;
+	wrong += stats.empty_leaves != empty_leaves ? 1 : 0;
+	wrong += stats.overfull_leaves != overfull_leaves ? 1 : 0;
+	wrong += stats.max_depth != max_depth ? 1 : 0;
+	wrong += stats.objects != objects ? 1 : 0;
+	wrong += stats.references != references ? 1 : 0;
+	wrong += stats.replication != (objects == 0 ? 0.0 : (double)references / (double)objects) ? 1 : 0;
+	wrong += stats.depth_histogram.size() != max_depth + 1 || stats.depth_histogram.back() == 0 ? 1 : 0;
+
+	size_t histogram_leaves = 0;
+	for (size_t i = 0; i < stats.occupancy_histogram.size(); ++i) {
+		histogram_leaves += stats.occupancy_histogram[i];
+	}
+
+	wrong += histogram_leaves != leaves ? 1 : 0;
+	wrong += stats.occupancy_histogram.empty() || stats.occupancy_histogram[0] != empty_leaves ? 1 : 0;
+	return wrong;
+}
+
+static size_t compare_leaves(const tree_type& tree, const std::string& path, const std::vector<std::string>& expected) {
+	tree.save_leaves(path, RZ_LEAVES_CSV);
+
+	std::ifstream file(path.c_str());
+	std::vector<std::string> lines;
+	std::string line;
+
+	while (std::getline(file, line)) {
+		lines.push_back(line);
+	}
+
+	remove(path.c_str());
+	return lines != expected ? 1 : 0;
+}
+
+int main(int argc, char** argv) {
+	std::string path = argc > 1 ? argv[1] : "tree_stats_check.csv";
+	std::vector<tri2d> tris = make_known();
+
+	rz_quadtree_options options;
+	options.objects_threshold = 1;
+	options.depth_threshold = 16;
+
+	// A, B and C are split once, children only in non empty quadrants
+	tree_type split(tris, options);
+	size_t split_wrong = compare_stats(split.stats(), 11, 7, 0, 0, 2, 6, 7);
+	split_wrong += split.stats().depth_histogram != std::vector<size_t>({ 0, 1, 6 }) ? 1 : 0;
+
+	std::vector<std::string> split_leaves;
+	split_leaves.push_back("min_x,min_y,max_x,max_y,depth,count,overfull");
+	split_leaves.push_back("0,4,2,6,2,1,0");
+	split_leaves.push_back("2,4,4,6,2,1,0");
+	split_leaves.push_back("6,6,8,8,2,1,0");
+	split_leaves.push_back("4,4,6,6,2,1,0");
+	split_leaves.push_back("0,0,2,2,2,1,0");
+	split_leaves.push_back("2,0,4,2,2,1,0");
+	split_leaves.push_back("4,0,8,4,1,1,0");
+	split_wrong += compare_leaves(split, path, split_leaves);
+
+	// stopped at depth 1, A, B and C keep two objects each
+	options.depth_threshold = 1;
+	tree_type shallow(tris, options);
+	size_t shallow_wrong = compare_stats(shallow.stats(), 5, 4, 0, 3, 1, 6, 7);
+
+	// the only object of D removed, D goes with it
+	shallow.remove((tree_type::index_type)2);
+	shallow_wrong += compare_stats(shallow.stats(), 4, 3, 0, 3, 1, 5, 6);
+
+	std::vector<std::string> shallow_leaves;
+	shallow_leaves.push_back("min_x,min_y,max_x,max_y,depth,count,overfull");
+	shallow_leaves.push_back("0,4,4,8,1,2,1");
+	shallow_leaves.push_back("4,4,8,8,1,2,1");
+	shallow_leaves.push_back("0,0,4,4,1,2,1");
+	shallow_wrong += compare_leaves(shallow, path, shallow_leaves);
+
+	// a root leaf losing its only object is the one empty leaf
+	tree_type single(std::vector<tri2d>(1, tris[2]), options);
+	size_t single_wrong = compare_stats(single.stats(), 1, 1, 0, 0, 0, 1, 1);
+
+	single.remove((tree_type::index_type)0);
+	single_wrong += compare_stats(single.stats(), 1, 1, 1, 0, 0, 0, 0);
+
+	bool ok = true;
+
+	ok &= report("split tree", split_wrong);
+	ok &= report("shallow tree", shallow_wrong);
+	ok &= report("single leaf", single_wrong);
+
+	return ok ? 0 : 1;
+}
@@ -0,0 +1,65 @@
+/** @file update_stats.cpp */
+// description: check of the counters of batched updates. every update of a
+// batch must land in one bucket of the returned stats and of the totals.
+// exits with 1 on any failed check.
+// usage: update_stats [objects]
+// last updated: aug.28.2011
+
+// Copyright (C) 2011 Rim Zaidullin <tinybit@yandex.ru>
+
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+
+#include <cstdlib>
+
+#include "check_common.hpp"
+
+// every update of a batch lands in one bucket of the returned stats. an
+// object moved across the domain and then again in the same batch is
+// reinserted once, its second update counts as repeated
+static size_t run_update_stats(const std::vector<tri2d>& tris, const rz_quadtree_options& options) {
+	tree_type tree(tris, options);
+	double half = domain_size / 2.0;
+
+	tree_type::update_vector updates;
+	updates.push_back(std::make_pair(0u, moved(tris[0], tris[0].point[0].x < half ? half : -half, 0.0)));
+	updates.push_back(std::make_pair(0u, moved(updates.back().second, 0.0, tris[0].point[0].y < half ? half : -half)));
+	updates.push_back(std::make_pair(1u, tris[1]));
+	updates.push_back(std::make_pair((tree_type::index_type)tris.size() + 1, tris[2]));
+
+	rz_quadtree_update_stats stats = tree.apply_updates(updates);
+	const rz_quadtree_update_stats& totals = tree.update_stats();
+
+	size_t wrong = 0;
+	wrong += stats.relocated != 1 || stats.repeated != 1 || stats.in_place != 1 || stats.skipped != 1 ? 1 : 0;
+	wrong += totals.relocated != 1 || totals.repeated != 1 || totals.in_place != 1 || totals.skipped != 1 ? 1 : 0;
+
+	return wrong;
+}
+
+int main(int argc, char** argv) {
+	size_t objects_count = argc > 1 ? (size_t)atol(argv[1]) : 50000;
+
+	std::mt19937 rng(1);
+	std::vector<tri2d> tris = make_tris(objects_count, rng);
+
+	rz_quadtree_options options;
+	options.objects_threshold = 16;
+	options.depth_threshold = 16;
+
+	printf("%zu objects\n", objects_count);
+	bool ok = report("update stats", run_update_stats(tris, options));
+
+	return ok ? 0 : 1;
+}
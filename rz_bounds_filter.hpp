@@ -0,0 +1,177 @@
+/** @file rz_bounds_filter.hpp */
+// description: rejection of object bounds against a query box over
+// structure-of-arrays bounds (separate min x, min y, max x, max y arrays).
+// bounds are kept as floats rounded outwards, so the filter never drops
+// an object whose double bounds touch the box, it may only keep a few
+// more. the sse2 / avx2 kernel is picked at runtime, with a scalar one
+// for other cpus.
+// last updated: aug.28.2011
+
+// Copyright (C) 2011 Rim Zaidullin <tinybit@yandex.ru>
+
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+
+#ifndef _RZ_BOUNDS_FILTER_HPP_INCLUDED_
+#define _RZ_BOUNDS_FILTER_HPP_INCLUDED_
+
+#include <cmath>
+#include <stddef.h>
+#include <stdint.h>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define RZ_BOUNDS_FILTER_X86
+#include <immintrin.h>
+#endif
+
+namespace rimz {
+
+// closest float not above / not below the value
+inline float float_down_2d(double value) {
+	float result = (float)value;
+	return (double)result > value ? nextafterf(result, -INFINITY) : result;
+}
+
+inline float float_up_2d(double value) {
+	float result = (float)value;
+	return (double)result < value ? nextafterf(result, INFINITY) : result;
+}
+
+// query box as { min x, min y, max x, max y } floats rounded outwards
+struct rz_bounds_query {
+	rz_bounds_query(double min_x, double min_y, double max_x, double max_y) {
+		box[0] = float_down_2d(min_x);
+		box[1] = float_down_2d(min_y);
+		box[2] = float_up_2d(max_x);
+		box[3] = float_up_2d(max_y);
+	}
+
+	float box[4];
+};
+
+// writes positions of the bounds touching the query box, returns their count
+typedef size_t (*rz_bounds_filter_fn)(const float* min_x, const float* min_y, const float* max_x, const float* max_y,
+	size_t count, const rz_bounds_query& query, uint32_t* positions);
+
+inline size_t filter_bounds_2d_scalar(const float* min_x, const float* min_y, const float* max_x, const float* max_y,
+	size_t count, const rz_bounds_query& query, uint32_t* positions) {
+	size_t found = 0;
+
+	for (size_t i = 0; i < count; ++i) {
+		bool keep = max_x[i] >= query.box[0] && max_y[i] >= query.box[1] && min_x[i] <= query.box[2] && min_y[i] <= query.box[3];
+		positions[found] = (uint32_t)i;
+		found += keep ? 1 : 0;
+	}
+
+	return found;
+}
+
+#ifdef RZ_BOUNDS_FILTER_X86
+
+__attribute__((target("sse2")))
+inline size_t filter_bounds_2d_sse2(const float* min_x, const float* min_y, const float* max_x, const float* max_y,
+	size_t count, const rz_bounds_query& query, uint32_t* positions) {
+	__m128 query_min_x = _mm_set1_ps(query.box[0]);
+	__m128 query_min_y = _mm_set1_ps(query.box[1]);
+	__m128 query_max_x = _mm_set1_ps(query.box[2]);
+	__m128 query_max_y = _mm_set1_ps(query.box[3]);
+
+	size_t found = 0;
+	size_t i = 0;
+
+	for (; i + 4 <= count; i += 4) {
+		__m128 keep = _mm_and_ps(
+			_mm_and_ps(_mm_cmpge_ps(_mm_loadu_ps(max_x + i), query_min_x), _mm_cmpge_ps(_mm_loadu_ps(max_y + i), query_min_y)),
+			_mm_and_ps(_mm_cmple_ps(_mm_loadu_ps(min_x + i), query_max_x), _mm_cmple_ps(_mm_loadu_ps(min_y + i), query_max_y)));
+
+		unsigned int mask = (unsigned int)_mm_movemask_ps(keep);
+
+		while (mask) {
+			positions[found++] = (uint32_t)(i + __builtin_ctz(mask));
+			mask &= mask - 1;
+		}
+	}
+
+	// tail
+	for (; i < count; ++i) {
+		bool keep = max_x[i] >= query.box[0] && max_y[i] >= query.box[1] && min_x[i] <= query.box[2] && min_y[i] <= query.box[3];
+		positions[found] = (uint32_t)i;
+		found += keep ? 1 : 0;
+	}
+
+	return found;
+}
+
+__attribute__((target("avx2")))
+inline size_t filter_bounds_2d_avx2(const float* min_x, const float* min_y, const float* max_x, const float* max_y,
+	size_t count, const rz_bounds_query& query, uint32_t* positions) {
+	__m256 query_min_x = _mm256_set1_ps(query.box[0]);
+	__m256 query_min_y = _mm256_set1_ps(query.box[1]);
+	__m256 query_max_x = _mm256_set1_ps(query.box[2]);
+	__m256 query_max_y = _mm256_set1_ps(query.box[3]);
+
+	size_t found = 0;
+	size_t i = 0;
+
+	for (; i + 8 <= count; i += 8) {
+		__m256 keep = _mm256_and_ps(
+			_mm256_and_ps(_mm256_cmp_ps(_mm256_loadu_ps(max_x + i), query_min_x, _CMP_GE_OQ), _mm256_cmp_ps(_mm256_loadu_ps(max_y + i), query_min_y, _CMP_GE_OQ)),
+			_mm256_and_ps(_mm256_cmp_ps(_mm256_loadu_ps(min_x + i), query_max_x, _CMP_LE_OQ), _mm256_cmp_ps(_mm256_loadu_ps(min_y + i), query_max_y, _CMP_LE_OQ)));
+
+		unsigned int mask = (unsigned int)_mm256_movemask_ps(keep);
+
+		while (mask) {
+			positions[found++] = (uint32_t)(i + __builtin_ctz(mask));
+			mask &= mask - 1;
+		}
+	}
+
+	// tail
+	for (; i < count; ++i) {
+		bool keep = max_x[i] >= query.box[0] && max_y[i] >= query.box[1] && min_x[i] <= query.box[2] && min_y[i] <= query.box[3];
+		positions[found] = (uint32_t)i;
+		found += keep ? 1 : 0;
+	}
+
+	return found;
+}
+
+#endif // RZ_BOUNDS_FILTER_X86
+
+inline rz_bounds_filter_fn select_bounds_filter_2d() {
+#ifdef RZ_BOUNDS_FILTER_X86
+	__builtin_cpu_init();
+
+	if (__builtin_cpu_supports("avx2")) {
+		return filter_bounds_2d_avx2;
+	}
+
+	if (__builtin_cpu_supports("sse2")) {
+		return filter_bounds_2d_sse2;
+	}
+#endif
+
+	return filter_bounds_2d_scalar;
+}
+
+// best kernel for the running cpu
+inline size_t filter_bounds_2d(const float* min_x, const float* min_y, const float* max_x, const float* max_y,
+	size_t count, const rz_bounds_query& query, uint32_t* positions) {
+	static const rz_bounds_filter_fn filter = select_bounds_filter_2d();
+	return filter(min_x, min_y, max_x, max_y, count, query, positions);
+}
+
+} // namespace rimz
+
+#endif // _RZ_BOUNDS_FILTER_HPP_INCLUDED_
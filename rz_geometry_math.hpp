@@ -22,25 +22,37 @@
 #ifndef _RZ_GEOMETRY_MATH_HPP_INCLUDED_
 #define _RZ_GEOMETRY_MATH_HPP_INCLUDED_
 
+#include <algorithm>
 #include <iostream>
 #include <math.h>
+#include <stdint.h>
 
 #include "rz_geometry_structs.hpp"
 
 namespace rimz {
 	
+// the lines of the segments cross at line_a.begin + mua * (line_a.end - line_a.begin)
+// = line_b.begin + mub * (line_b.end - line_b.begin), with mua = numera / denom
+// and mub = numerb / denom. denom is 0 for parallel lines, all three are 0
+// for coincident ones
 template <typename T>
-inline bool intersect_2d(const rz_line<T>& line_a, const rz_line<T>& line_b) {
-	double mua, mub;
-	
+inline void segment_terms_2d(const rz_line<T>& line_a, const rz_line<T>& line_b, double& denom, double& numera, double& numerb) {
 	T a1 = line_a.begin;
 	T a2 = line_a.end;
 	T b1 = line_b.begin;
 	T b2 = line_b.end;
 	
-	double denom  = (b2.y - b1.y) * (a2.x - a1.x) - (b2.x - b1.x) * (a2.y - a1.y);
-	double numera = (b2.x - b1.x) * (a1.y - b1.y) - (b2.y - b1.y) * (a1.x - b1.x);
-	double numerb = (a2.x - a1.x) * (a1.y - b1.y) - (a2.y - a1.y) * (a1.x - b1.x);
+	denom  = (b2.y - b1.y) * (a2.x - a1.x) - (b2.x - b1.x) * (a2.y - a1.y);
+	numera = (b2.x - b1.x) * (a1.y - b1.y) - (b2.y - b1.y) * (a1.x - b1.x);
+	numerb = (a2.x - a1.x) * (a1.y - b1.y) - (a2.y - a1.y) * (a1.x - b1.x);
+}
+
+template <typename T>
+inline bool intersect_2d(const rz_line<T>& line_a, const rz_line<T>& line_b) {
+	double mua, mub;
+	double denom, numera, numerb;
+	
+	segment_terms_2d(line_a, line_b, denom, numera, numerb);
 	
 	// Are the line coincident?
 	if (fabs(numera) < EPS && fabs(numerb) < EPS && fabs(denom) < EPS) {
@@ -62,196 +74,320 @@ inline bool intersect_2d(const rz_line<T>& line_a, const rz_line<T>& line_b) {
 	return true;
 }
 	
+// t is the parameter of the first point where line touches other (0 at
+// line.begin, 1 at line.end). coincident segments touch only where they overlap
 template <typename T>
-inline bool intersect_2d(const rz_line<T>& line_a, const rz_line<T>& line_b, T& isect_point) {
-	double mua, mub;
-	
-	T a1 = line_a.begin;
-	T a2 = line_a.end;
-	T b1 = line_a.begin;
-	T b2 = line_a.end;
+inline bool intersect_2d(const rz_line<T>& line, const rz_line<T>& other, double& t) {
+	double denom, numera, numerb;
 	
-	double denom  = (b2.y - b1.y) * (a2.x - a1.x) - (b2.x - b1.x) * (a2.y - a1.y);
-	double numera = (b2.x - b1.x) * (a1.y - b1.y) - (b2.y - b1.y) * (a1.x - b1.x);
-	double numerb = (a2.x - a1.x) * (a1.y - b1.y) - (a2.y - a1.y) * (a1.x - b1.x);
+	segment_terms_2d(line, other, denom, numera, numerb);
 	
-	// are the line coincident?
-	if (fabs(numera) < EPS && fabs(numerb) < EPS && fabs(denom) < EPS) {
-		isect_point.x = (a1.x + a2.x) / 2.0;
-		isect_point.y = (a1.y + a2.y) / 2.0;
+	if (fabs(denom) < EPS) {
+		// parallel, touching only if coincident and overlapping
+		if (fabs(numera) >= EPS || fabs(numerb) >= EPS) {
+			return false;
+		}
+		
+		T a1 = line.begin;
+		T dir = line.end - a1;
+		double len_sq = dot_product(dir, dir);
+		
+		if (len_sq < EPS * EPS) {
+			t = 0.0;
+			return intersect_2d(other, a1);
+		}
+		
+		double t_b1 = dot_product(other.begin - a1, dir) / len_sq;
+		double t_b2 = dot_product(other.end - a1, dir) / len_sq;
+		
+		if (fmax(t_b1, t_b2) < 0.0 || fmin(t_b1, t_b2) > 1.0) {
+			return false;
+		}
+		
+		t = fmax(fmin(t_b1, t_b2), 0.0);
 		return true;
 	}
 	
-	// are the line parallel
-	if (fabs(denom) < EPS) {
-		isect_point.x = 0;
-		isect_point.y = 0;
+	double mua = numera / denom;
+	double mub = numerb / denom;
+	if (mua < 0 || mua > 1 || mub < 0 || mub > 1) {
 		return false;
 	}
 	
-	// is the intersection along the the segments
-	mua = numera / denom;
-	mub = numerb / denom;
-	if (mua < 0 || mua > 1 || mub < 0 || mub > 1) {
+	t = mua;
+	return true;
+}
+	
+// isect_point is the first point of line_a on line_b, 0,0 when they miss.
+// crossing segments give the crossing point. coincident segments touch
+// only where they overlap and give the start of the overlap along line_a,
+// line_a.begin when it lies on line_b. it's no longer the midpoint of
+// line_a, which needn't be on line_b at all
+template <typename T>
+inline bool intersect_2d(const rz_line<T>& line_a, const rz_line<T>& line_b, T& isect_point) {
+	double t;
+	
+	if (false == intersect_2d(line_a, line_b, t)) {
 		isect_point.x = 0;
 		isect_point.y = 0;
 		return false;
 	}
 	
-	isect_point.x = a1.x + mua * (a2.x - a1.x);
-	isect_point.y = a1.y + mua * (a2.y - a1.y);
+	isect_point.x = line_a.begin.x + t * (line_a.end.x - line_a.begin.x);
+	isect_point.y = line_a.begin.y + t * (line_a.end.y - line_a.begin.y);
 	return true;
 }
 	
+// closed: points on the edges and vertices are inside. the point is on the
+// inner side of all three edges, a zero counts for either winding, so no
+// divide and no orientation test. a degenerate (zero area) triangle passes
+// the sign test for every point on its line, it contains its hull segment
 template <typename T>
 inline bool intersect_2d(const rz_tri<T>& tri, const T& pt) {
-	T v0 = tri.point[2] - tri.point[0];
-	T v1 = tri.point[1] - tri.point[0];
-	T v2 = pt - tri.point[0];
-	
-	double dot00 = dot_product(v0, v0);
-	double dot01 = dot_product(v0, v1);
-	double dot02 = dot_product(v0, v2);
-	double dot11 = dot_product(v1, v1);
-	double dot12 = dot_product(v1, v2);
-	
-	// compute barycentric coordinates
-	double invDenom = 1.0 / (dot00 * dot11 - dot01 * dot01);
-	double u = (dot11 * dot02 - dot01 * dot12) * invDenom;
-	double v = (dot00 * dot12 - dot01 * dot02) * invDenom;
-	
-	// check if point is in triangle
-	return (u > 0.0) && (v > 0.0) && (u + v < 1.0);
-}
-
-template <typename T>
-inline bool intersect_2d(const rz_aabb<T>& aabb, const rz_tri<T>& tri) {
-	if (intersect_2d(tri.aabb(), aabb) == false) {
+	const T& a = tri.point[0];
+	const T& b = tri.point[1];
+	const T& c = tri.point[2];
+	
+	double e0 = (b.x - a.x) * (pt.y - a.y) - (b.y - a.y) * (pt.x - a.x);
+	double e1 = (c.x - b.x) * (pt.y - b.y) - (c.y - b.y) * (pt.x - b.x);
+	double e2 = (a.x - c.x) * (pt.y - c.y) - (a.y - c.y) * (pt.x - c.x);
+	
+	// non short-circuit operators, the compiler emits flag arithmetic instead of branches
+	bool left = (e0 >= 0.0) & (e1 >= 0.0) & (e2 >= 0.0);
+	bool right = (e0 <= 0.0) & (e1 <= 0.0) & (e2 <= 0.0);
+	
+	if (false == (left | right)) {
 		return false;
 	}
 	
-	// check whether any of the tri vertex is inside aabb
-	for (int i = 0; i < 3; ++i) {
-		if (tri.point[i].x > aabb.min.x && tri.point[i].x < aabb.max.x &&
-			tri.point[i].y > aabb.min.y && tri.point[i].y < aabb.max.y) {
-			return true;
-		}
+	// the edge functions sum up to twice the area
+	if (e0 + e1 + e2 == 0.0) {
+		return pt.x >= std::min(a.x, std::min(b.x, c.x)) && pt.x <= std::max(a.x, std::max(b.x, c.x)) &&
+			pt.y >= std::min(a.y, std::min(b.y, c.y)) && pt.y <= std::max(a.y, std::max(b.y, c.y));
 	}
 	
-	// check whether any of the aabb vertex is inside tri
-	if (intersect_2d(tri, aabb.min)) {
-		return true;
-	}
+	return true;
+}
+
+template <typename T>
+inline bool intersect_2d(const rz_line<T>& line, const T& pt) {
+	T dir = line.end - line.begin;
+	T to_pt = pt - line.begin;
 	
-	if (intersect_2d(tri, aabb.max)) {
-		return true;
+	double len = dir.length();
+	if (len < EPS) {
+		return (pt == line.begin);
 	}
 	
-	if (intersect_2d(tri, T(aabb.min.x, aabb.max.y))) {
-		return true;
+	// distance from the point to the line
+	double cross = dir.x * to_pt.y - dir.y * to_pt.x;
+	if (fabs(cross) / len > EPS) {
+		return false;
 	}
 	
-	if (intersect_2d(tri, T(aabb.max.x, aabb.min.y))) {
-		return true;
-	}
+	// projection falls within the segment
+	double t = dot_product(dir, to_pt) / (len * len);
+	return (t > -EPS && t < 1.0 + EPS);
+}
+
+// closed: a triangle touching the aabb by a vertex or an edge intersects it.
+// separating axis test, the candidate axes are x, y and the three edge
+// normals. on an edge normal the triangle projects between the edge and the
+// opposite vertex, the aabb between its lowest and highest corner
+template <typename T>
+inline bool intersect_2d(const rz_aabb<T>& aabb, const rz_tri<T>& tri) {
+	const T* p = tri.point;
 	
-	// intersect tri edges against aabb edges
-	T aabb_edges[4];
-	aabb_edges[0] = aabb.min;
-	aabb_edges[1] = T(aabb.min.x, aabb.max.y);
-	aabb_edges[2] = aabb.max;
-	aabb_edges[3] = T(aabb.max.x, aabb.min.y);
+	bool apart = (std::max(p[0].x, std::max(p[1].x, p[2].x)) < aabb.min.x) | (std::min(p[0].x, std::min(p[1].x, p[2].x)) > aabb.max.x) |
+		(std::max(p[0].y, std::max(p[1].y, p[2].y)) < aabb.min.y) | (std::min(p[0].y, std::min(p[1].y, p[2].y)) > aabb.max.y);
 	
-	for (int i = 0; i < 4; ++i) {
-		T pt1 = aabb_edges[i];
-		T pt2;
+	for (int i = 0; i < 3; ++i) {
+		const T& a = p[i];
+		const T& b = p[i == 2 ? 0 : i + 1];
+		const T& c = p[i == 0 ? 2 : i - 1];
 		
-		if (i == 3) {
-			pt2 = aabb_edges[0];
-		}
-		else {
-			pt2 = aabb_edges[i + 1];			
-		}
+		double nx = a.y - b.y;
+		double ny = b.x - a.x;
+		
+		double edge = nx * a.x + ny * a.y;
+		double apex = nx * c.x + ny * c.y;
+		
+		double box_lo = std::min(nx * aabb.min.x, nx * aabb.max.x) + std::min(ny * aabb.min.y, ny * aabb.max.y);
+		double box_hi = std::max(nx * aabb.min.x, nx * aabb.max.x) + std::max(ny * aabb.min.y, ny * aabb.max.y);
+		
+		apart |= (box_lo > std::max(edge, apex)) | (box_hi < std::min(edge, apex));
+	}
+	
+	return !apart;
+}
+
+template <typename T>
+inline bool intersect_2d(const rz_tri<T>& tri, const rz_aabb<T>& aabb) {
+	return intersect_2d(aabb, tri);
+}
+
+// closed: triangles touching by a vertex or an edge intersect. separating
+// axis test over x, y and the edge normals of both triangles. the x and
+// y axes separate collinear degenerate triangles, whose normals can't
+template <typename T>
+inline bool intersect_2d(const rz_tri<T>& tri, const rz_tri<T>& tri_b) {
+	const T* p = tri.point;
+	const T* q = tri_b.point;
+	
+	bool apart = (std::max(p[0].x, std::max(p[1].x, p[2].x)) < std::min(q[0].x, std::min(q[1].x, q[2].x))) |
+		(std::min(p[0].x, std::min(p[1].x, p[2].x)) > std::max(q[0].x, std::max(q[1].x, q[2].x))) |
+		(std::max(p[0].y, std::max(p[1].y, p[2].y)) < std::min(q[0].y, std::min(q[1].y, q[2].y))) |
+		(std::min(p[0].y, std::min(p[1].y, p[2].y)) > std::max(q[0].y, std::max(q[1].y, q[2].y)));
+	
+	for (int t = 0; t < 2; ++t) {
+		const T* own = t == 0 ? p : q;
+		const T* other = t == 0 ? q : p;
 		
-		for (int j = 0; j < 3; ++j) {
-			T pt3 = tri.point[j];
-			T pt4;
+		for (int i = 0; i < 3; ++i) {
+			const T& a = own[i];
+			const T& b = own[i == 2 ? 0 : i + 1];
+			const T& c = own[i == 0 ? 2 : i - 1];
 			
-			if (j == 2) {
-				pt4 = tri.point[0];
-			}
-			else {
-				pt4 = tri.point[j + 1];
-			}
+			double nx = a.y - b.y;
+			double ny = b.x - a.x;
 			
-			typedef rz_line<T> line2d;
-			if (intersect_2d(line2d(pt1, pt2), line2d(pt3, pt4))) {
-				return true;
-			}
+			double edge = nx * a.x + ny * a.y;
+			double apex = nx * c.x + ny * c.y;
+			
+			double other_0 = nx * other[0].x + ny * other[0].y;
+			double other_1 = nx * other[1].x + ny * other[1].y;
+			double other_2 = nx * other[2].x + ny * other[2].y;
+			
+			apart |= (std::min(other_0, std::min(other_1, other_2)) > std::max(edge, apex)) |
+				(std::max(other_0, std::max(other_1, other_2)) < std::min(edge, apex));
 		}
 	}
 	
-	return false;
+	return !apart;
 }
 
+// closed: boxes touching by an edge or a corner intersect, a flat (zero
+// width or height) box is a segment or a point. no separating x or y gap
 template <typename T>
 inline bool intersect_2d(const rz_aabb<T>& aabb, const rz_aabb<T>& aabb_b) {
-	if (aabb == aabb_b) {
-		return true;
-	}
+	bool apart = (aabb.max.x < aabb_b.min.x) | (aabb.min.x > aabb_b.max.x) |
+		(aabb.max.y < aabb_b.min.y) | (aabb.min.y > aabb_b.max.y);
+	
+	return !apart;
+}
 
-	double total_boxes_x_len = fabs(fmax(aabb.max.x, aabb_b.max.x) - fmin(aabb.min.x, aabb_b.min.x));
-	double total_boxes_y_len = fabs(fmax(aabb.max.y, aabb_b.max.y) - fmin(aabb.min.y, aabb_b.min.y));
+// closed: a line touching the aabb by an end point or running along its
+// edge intersects it. slab test without the clipping divides: the segment
+// bounds must overlap the x and y slabs of the aabb, and the aabb corners
+// must not all lie on one side of the line. a zero length line is a point
+template <typename T>
+inline bool intersect_2d(const rz_aabb<T>& aabb, const rz_line<T>& line) {
+	const T& a = line.begin;
+	const T& b = line.end;
 	
-	if (total_boxes_x_len < (aabb.width() + aabb_b.width()) && total_boxes_y_len < (aabb.height() + aabb_b.height())) {
-		return true;
-	}
+	bool apart = (std::max(a.x, b.x) < aabb.min.x) | (std::min(a.x, b.x) > aabb.max.x) |
+		(std::max(a.y, b.y) < aabb.min.y) | (std::min(a.y, b.y) > aabb.max.y);
 	
-	return false;
+	double nx = a.y - b.y;
+	double ny = b.x - a.x;
+	double offset = nx * a.x + ny * a.y;
+	
+	double box_lo = std::min(nx * aabb.min.x, nx * aabb.max.x) + std::min(ny * aabb.min.y, ny * aabb.max.y);
+	double box_hi = std::max(nx * aabb.min.x, nx * aabb.max.x) + std::max(ny * aabb.min.y, ny * aabb.max.y);
+	
+	apart |= (box_lo > offset) | (box_hi < offset);
+	
+	return !apart;
 }
 
 template <typename T>
-inline bool intersect_2d(const rz_aabb<T>& aabb, const rz_line<T>& line) {
-	// go through aabb vertexes
-	if (line.begin.x > aabb.min.x && line.begin.x < aabb.max.x &&
-		line.begin.y > aabb.min.y && line.begin.y < aabb.max.y) {
-		return true;
+inline bool intersect_2d(const rz_line<T>& line, const rz_aabb<T>& aabb) {
+	return intersect_2d(aabb, line);
+}
+
+// closed: points on the edges and corners are inside
+template <typename T>
+inline bool intersect_2d(const rz_aabb<T>& aabb, const T& pt) {
+	return (pt.x >= aabb.min.x) & (pt.x <= aabb.max.x) & (pt.y >= aabb.min.y) & (pt.y <= aabb.max.y);
+}
+
+// part of the line inside the (closed) aabb, as parameters along the line
+// from 0 at line.begin to 1 at line.end. slab test
+template <typename T>
+inline bool clip_2d(const rz_line<T>& line, const rz_aabb<T>& aabb, double& t_in, double& t_out) {
+	double origin[2] = { line.begin.x, line.begin.y };
+	double dir[2] = { line.end.x - line.begin.x, line.end.y - line.begin.y };
+	double slab_min[2] = { aabb.min.x, aabb.min.y };
+	double slab_max[2] = { aabb.max.x, aabb.max.y };
+	
+	t_in = 0.0;
+	t_out = 1.0;
+	
+	for (int i = 0; i < 2; ++i) {
+		if (fabs(dir[i]) < EPS) {
+			// parallel to the slab, either always inside or never
+			if (origin[i] < slab_min[i] || origin[i] > slab_max[i]) {
+				return false;
+			}
+			
+			continue;
+		}
+		
+		double t_a = (slab_min[i] - origin[i]) / dir[i];
+		double t_b = (slab_max[i] - origin[i]) / dir[i];
+		
+		t_in = fmax(t_in, fmin(t_a, t_b));
+		t_out = fmin(t_out, fmax(t_a, t_b));
+		
+		if (t_in > t_out) {
+			return false;
+		}
 	}
 	
-	if (line.end.x > aabb.min.x && line.end.x < aabb.max.x &&
-		line.end.y > aabb.min.y && line.end.y < aabb.max.y) {
+	return true;
+}
+
+// intersections along the line, t is the parameter of the first point
+// where line touches the object (0 at line.begin, 1 at line.end)
+template <typename T>
+inline bool intersect_2d(const rz_line<T>& line, const rz_tri<T>& tri, double& t) {
+	if (intersect_2d(tri, line.begin)) {
+		t = 0.0;
 		return true;
 	}
 	
-	T aabb_points[4];
-	aabb_points[0] = aabb.min;
-	aabb_points[1] = T(aabb.min.x, aabb.max.y);
-	aabb_points[2] = aabb.max;
-	aabb_points[3] = T(aabb.max.x, aabb.min.y);
+	// otherwise line enters through one of the edges
+	bool hit = false;
+	t = 1.0;
 	
-	// go through aabb edges
-	for (int i = 0; i < 4; ++i) {
-		rz_line<T> aabb_line;
-		aabb_line.begin = aabb_points[i];
-		
-		if (i == 3) {
-			aabb_line.end = aabb_points[0];
-		}
-		else {
-			aabb_line.end = aabb_points[i + 1];
-		}
+	for (int i = 0; i < 3; ++i) {
+		double edge_t;
+		rz_line<T> edge(tri.point[i], tri.point[(i + 1) % 3]);
 		
-		if (intersect_2d(line, aabb_line)) {
-			return true;
+		if (intersect_2d(line, edge, edge_t) && (!hit || edge_t < t)) {
+			t = edge_t;
+			hit = true;
 		}
 	}
 	
-	return false;
+	return hit;
 }
 
 template <typename T>
-inline bool intersect_2d(const rz_aabb<T>& aabb, const T& pt) {
-	return (pt.x > aabb.min.x && pt.x <= aabb.max.x && pt.y > aabb.min.y && pt.y <= aabb.max.y);
+inline bool intersect_2d(const rz_line<T>& line, const rz_aabb<T>& aabb, double& t) {
+	double t_out;
+	return clip_2d(line, aabb, t, t_out);
+}
+
+template <typename T>
+inline bool intersect_2d(const rz_line<T>& line, const rz_tri<T>& tri) {
+	double t;
+	return intersect_2d(line, tri, t);
+}
+
+template <typename T>
+inline bool intersect_2d(const rz_tri<T>& tri, const rz_line<T>& line) {
+	return intersect_2d(line, tri);
 }
 
 template <typename T>
@@ -315,6 +451,59 @@ inline double dot_product(const T& a, const T& b) {
 	return a.x * b.x + a.y * b.y;
 }
 
+// distance from a point to the closest point of the object, 0 inside
+template <typename T>
+inline double distance_2d(const rz_aabb<T>& aabb, const T& pt) {
+	double dx = fmax(fmax(aabb.min.x - pt.x, pt.x - aabb.max.x), 0.0);
+	double dy = fmax(fmax(aabb.min.y - pt.y, pt.y - aabb.max.y), 0.0);
+	
+	return sqrt(dx * dx + dy * dy);
+}
+
+template <typename T>
+inline double distance_2d(const rz_line<T>& line, const T& pt) {
+	T dir = line.end - line.begin;
+	T to_pt = pt - line.begin;
+	
+	// closest point is the projection clamped to the segment
+	double len_sq = dot_product(dir, dir);
+	double t = (len_sq < EPS * EPS) ? 0.0 : dot_product(dir, to_pt) / len_sq;
+	t = fmax(0.0, fmin(1.0, t));
+	
+	T closest(line.begin.x + t * dir.x, line.begin.y + t * dir.y);
+	return (pt - closest).length();
+}
+
+template <typename T>
+inline double distance_2d(const rz_tri<T>& tri, const T& pt) {
+	if (intersect_2d(tri, pt)) {
+		return 0.0;
+	}
+	
+	// outside (or on the border), closest point lies on one of the edges
+	double dist_a = distance_2d(rz_line<T>(tri.point[0], tri.point[1]), pt);
+	double dist_b = distance_2d(rz_line<T>(tri.point[1], tri.point[2]), pt);
+	double dist_c = distance_2d(rz_line<T>(tri.point[2], tri.point[0]), pt);
+	
+	return fmin(dist_a, fmin(dist_b, dist_c));
+}
+
+// spreads lower 32 bits of value over even bits of the result
+inline uint64_t morton_spread_2d(uint32_t value) {
+	uint64_t x = value;
+	x = (x | (x << 16)) & 0x0000FFFF0000FFFFULL;
+	x = (x | (x << 8))  & 0x00FF00FF00FF00FFULL;
+	x = (x | (x << 4))  & 0x0F0F0F0F0F0F0F0FULL;
+	x = (x | (x << 2))  & 0x3333333333333333ULL;
+	x = (x | (x << 1))  & 0x5555555555555555ULL;
+	return x;
+}
+
+// z-order key of a cell, x goes to even bits and y to odd bits
+inline uint64_t morton_encode_2d(uint32_t x, uint32_t y) {
+	return morton_spread_2d(x) | (morton_spread_2d(y) << 1);
+}
+
 } // namespace rimz
 
 #endif // _RZ_GEOMETRY_MATH_HPP_INCLUDED_
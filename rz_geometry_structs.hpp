@@ -23,6 +23,7 @@
 #define _RZ_GEOMETRY_STRUCTS_HPP_INCLUDED_
 
 #include <math.h>
+#include <string.h>
 
 namespace rimz {
 
@@ -230,7 +231,7 @@ class rz_aabb {
 public:
 	rz_aabb() {}
 	rz_aabb(const T& min_, const T& max_) : min(min_), max(max_) {}
-	rz_aabb(const rz_aabb& aabb) : min(aabb.min), max(aabb.min) {}
+	rz_aabb(const rz_aabb& aabb) : min(aabb.min), max(aabb.max) {}
 
 	inline rz_aabb<T> offset(double x, double y) {
 		min.x -= x;
@@ -0,0 +1,388 @@
+/** @file rz_instrumentation.hpp */
+// classes: rz_no_instrumentation, rz_query_instrumentation,
+// rz_latency_histogram, rz_query_profile
+// description: query instrumentation policies of rz_quadtree. a tree
+// creates a probe for every point and aabb query, the traversal reports
+// visited nodes, reached leaves, exact tests and emitted objects to it and
+// the probe records them with the query latency when it goes out of scope.
+// rz_no_instrumentation (the default) has empty probes, so queries compile
+// to what they were without instrumentation.
+// rz_query_instrumentation keeps counters and a latency histogram per
+// query kind in a slot per thread. the owning thread is the only writer of
+// its slot, so recording takes no locks and no atomic read-modify-write.
+// snapshot(), reset() and snapshot_and_reset() may be called from any
+// thread while queries run.
+// last updated: aug.28.2011
+
+// Copyright (C) 2011 Rim Zaidullin <tinybit@yandex.ru>
+
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+
+#ifndef _RZ_INSTRUMENTATION_HPP_INCLUDED_
+#define _RZ_INSTRUMENTATION_HPP_INCLUDED_
+
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <vector>
+#include <utility>
+#include <stddef.h>
+#include <stdint.h>
+
+namespace rimz {
+
+enum rz_query_kind {
+	RZ_POINT_QUERY = 0,
+	RZ_AABB_QUERY = 1,
+	RZ_QUERY_KINDS = 2
+};
+
+// no instrumentation, the probe has no state and its hooks are empty
+struct rz_no_instrumentation {
+	class probe {
+	public:
+		probe(rz_no_instrumentation&, rz_query_kind) {}
+
+		void node() {}
+		void leaf() {}
+		void exact_test() {}
+		void emit() {}
+	};
+};
+
+// log-linear (hdr style) buckets of nanoseconds: values below 16 have a
+// bucket each, every further power of two is split into 16 buckets, so a
+// bucket is at most 1/16 of its value wide. values from 2^40 ns (~18
+// minutes) up share the last bucket
+class rz_latency_histogram {
+public:
+	enum {
+		sub_bits = 4,
+		max_bits = 40,
+		buckets_count = (max_bits - sub_bits + 1) << sub_bits
+	};
+
+	static size_t bucket(uint64_t value) {
+		if (value >= ((uint64_t)1 << max_bits)) {
+			return buckets_count - 1;
+		}
+
+		if (value < ((uint64_t)1 << sub_bits)) {
+			return (size_t)value;
+		}
+
+		size_t shift = highest_bit(value) - sub_bits;
+		return ((shift + 1) << sub_bits) + (size_t)((value >> shift) & (((uint64_t)1 << sub_bits) - 1));
+	}
+
+	// position of the highest set bit of a non zero value
+	static size_t highest_bit(uint64_t value) {
+#if defined(__GNUC__)
+		return 63 - __builtin_clzll(value);
+#else
+		size_t bit = 0;
+		while (value >>= 1) {
+			++bit;
+		}
+
+		return bit;
+#endif
+	}
+
+	// smallest value of the bucket
+	static uint64_t bucket_min(size_t bucket) {
+		if (bucket < ((size_t)1 << sub_bits)) {
+			return bucket;
+		}
+
+		size_t shift = (bucket >> sub_bits) - 1;
+		return (((uint64_t)1 << sub_bits) + (bucket & (((size_t)1 << sub_bits) - 1))) << shift;
+	}
+};
+
+// totals of one query kind
+struct rz_query_profile {
+	rz_query_profile() :
+	queries(0), nodes_visited(0), leaves_reached(0), exact_tests(0), objects_emitted(0), latency(rz_latency_histogram::buckets_count, 0) {
+	}
+
+	uint64_t queries;
+	uint64_t nodes_visited;
+	uint64_t leaves_reached;
+	uint64_t exact_tests;
+	uint64_t objects_emitted;
+	std::vector<uint64_t> latency;	// queries per rz_latency_histogram bucket
+
+	// lower bound of the latency (ns) at the fraction of queries, 0.99 for p99
+	uint64_t latency_at(double fraction) const {
+		if (queries == 0) {
+			return 0;
+		}
+
+		uint64_t rank = (uint64_t)(fraction * (double)(queries - 1));
+		uint64_t seen = 0;
+
+		for (size_t i = 0; i < latency.size(); ++i) {
+			seen += latency[i];
+
+			if (seen > rank) {
+				return rz_latency_histogram::bucket_min(i);
+			}
+		}
+
+		return rz_latency_histogram::bucket_min(latency.size() - 1);
+	}
+};
+
+struct rz_query_profiles {
+	rz_query_profile kinds[RZ_QUERY_KINDS];
+};
+
+class rz_query_instrumentation {
+public:
+	typedef std::chrono::steady_clock clock;
+
+	class probe {
+	public:
+		probe(rz_query_instrumentation& owner, rz_query_kind kind) :
+		owner_(owner), kind_(kind), nodes_(0), leaves_(0), exact_tests_(0), emitted_(0), start_(clock::now()) {
+		}
+
+		~probe() {
+			uint64_t elapsed = (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(clock::now() - start_).count();
+			owner_.record(kind_, nodes_, leaves_, exact_tests_, emitted_, elapsed);
+		}
+
+		void node() {
+			++nodes_;
+		}
+
+		void leaf() {
+			++leaves_;
+		}
+
+		void exact_test() {
+			++exact_tests_;
+		}
+
+		void emit() {
+			++emitted_;
+		}
+
+	private:
+		probe(const probe&);
+		probe& operator = (const probe&);
+
+		rz_query_instrumentation& owner_;
+		rz_query_kind kind_;
+		uint64_t nodes_;
+		uint64_t leaves_;
+		uint64_t exact_tests_;
+		uint64_t emitted_;
+		clock::time_point start_;
+	};
+
+	rz_query_instrumentation() : id_(next_id()) {
+		std::lock_guard<std::mutex> lock(registry_mutex());
+		live_ids().insert(id_);
+	}
+
+	~rz_query_instrumentation() {
+		std::lock_guard<std::mutex> lock(registry_mutex());
+		live_ids().erase(id_);
+	}
+
+	// totals since construction or the last reset
+	rz_query_profiles snapshot() const {
+		std::lock_guard<std::mutex> lock(mutex_);
+		rz_query_profiles result = totals_locked();
+		subtract(result, baseline_);
+		return result;
+	}
+
+	// counters are never cleared under the writers, a reset moves the
+	// baseline that snapshots subtract. totals and baseline are taken under
+	// one lock, so a snapshot never sees a baseline above its totals
+	void reset() {
+		std::lock_guard<std::mutex> lock(mutex_);
+		baseline_ = totals_locked();
+	}
+
+	// snapshot and reset at once, a query is in exactly one of the
+	// snapshots taken this way
+	rz_query_profiles snapshot_and_reset() {
+		std::lock_guard<std::mutex> lock(mutex_);
+		rz_query_profiles current = totals_locked();
+		rz_query_profiles result = current;
+		subtract(result, baseline_);
+		baseline_ = current;
+		return result;
+	}
+
+private:
+	rz_query_instrumentation(const rz_query_instrumentation&);
+	rz_query_instrumentation& operator = (const rz_query_instrumentation&);
+
+	enum {
+		counter_queries = 0,
+		counter_nodes,
+		counter_leaves,
+		counter_exact_tests,
+		counter_emitted,
+		counters_count
+	};
+
+	// written by one thread only, read by snapshots
+	struct thread_slot {
+		thread_slot() {
+			for (size_t k = 0; k < RZ_QUERY_KINDS; ++k) {
+				for (size_t i = 0; i < counters_count; ++i) {
+					counters[k][i].store(0, std::memory_order_relaxed);
+				}
+
+				for (size_t i = 0; i < rz_latency_histogram::buckets_count; ++i) {
+					latency[k][i].store(0, std::memory_order_relaxed);
+				}
+			}
+		}
+
+		std::atomic<uint64_t> counters[RZ_QUERY_KINDS][counters_count];
+		std::atomic<uint64_t> latency[RZ_QUERY_KINDS][rz_latency_histogram::buckets_count];
+	};
+
+	static void add(std::atomic<uint64_t>& counter, uint64_t value) {
+		counter.store(counter.load(std::memory_order_relaxed) + value, std::memory_order_relaxed);
+	}
+
+	void record(rz_query_kind kind, uint64_t nodes, uint64_t leaves, uint64_t exact_tests, uint64_t emitted, uint64_t elapsed) {
+		thread_slot& slot = this_thread_slot();
+
+		add(slot.counters[kind][counter_queries], 1);
+		add(slot.counters[kind][counter_nodes], nodes);
+		add(slot.counters[kind][counter_leaves], leaves);
+		add(slot.counters[kind][counter_exact_tests], exact_tests);
+		add(slot.counters[kind][counter_emitted], emitted);
+		add(slot.latency[kind][rz_latency_histogram::bucket(elapsed)], 1);
+	}
+
+	// slots are found by instance id, ids aren't reused, so a thread never
+	// mistakes a new instance at the address of a destroyed one for it.
+	// the last instance used is checked first. a miss drops the entries of
+	// destroyed instances, so the cache holds the live instances the
+	// thread recorded for, their slot pointers are never dangling
+	thread_slot& this_thread_slot() {
+		static thread_local std::vector<std::pair<uint64_t, thread_slot*> > cache;
+		static thread_local size_t last = 0;
+
+		if (last < cache.size() && cache[last].first == id_) {
+			return *cache[last].second;
+		}
+
+		for (size_t i = 0; i < cache.size(); ++i) {
+			if (cache[i].first == id_) {
+				last = i;
+				return *cache[i].second;
+			}
+		}
+
+		{
+			std::lock_guard<std::mutex> lock(registry_mutex());
+			const std::set<uint64_t>& ids = live_ids();
+			size_t kept = 0;
+
+			for (size_t i = 0; i < cache.size(); ++i) {
+				if (ids.count(cache[i].first)) {
+					cache[kept++] = cache[i];
+				}
+			}
+
+			cache.resize(kept);
+		}
+
+		std::lock_guard<std::mutex> lock(mutex_);
+		slots_.push_back(std::unique_ptr<thread_slot>(new thread_slot()));
+		cache.push_back(std::make_pair(id_, slots_.back().get()));
+		last = cache.size() - 1;
+		return *slots_.back();
+	}
+
+	// mutex_ must be held
+	rz_query_profiles totals_locked() const {
+		rz_query_profiles result;
+
+		for (size_t s = 0; s < slots_.size(); ++s) {
+			const thread_slot& slot = *slots_[s];
+
+			for (size_t k = 0; k < RZ_QUERY_KINDS; ++k) {
+				rz_query_profile& profile = result.kinds[k];
+				profile.queries += slot.counters[k][counter_queries].load(std::memory_order_relaxed);
+				profile.nodes_visited += slot.counters[k][counter_nodes].load(std::memory_order_relaxed);
+				profile.leaves_reached += slot.counters[k][counter_leaves].load(std::memory_order_relaxed);
+				profile.exact_tests += slot.counters[k][counter_exact_tests].load(std::memory_order_relaxed);
+				profile.objects_emitted += slot.counters[k][counter_emitted].load(std::memory_order_relaxed);
+
+				for (size_t i = 0; i < rz_latency_histogram::buckets_count; ++i) {
+					profile.latency[i] += slot.latency[k][i].load(std::memory_order_relaxed);
+				}
+			}
+		}
+
+		return result;
+	}
+
+	static void subtract(rz_query_profiles& result, const rz_query_profiles& baseline) {
+		for (size_t k = 0; k < RZ_QUERY_KINDS; ++k) {
+			rz_query_profile& profile = result.kinds[k];
+			const rz_query_profile& base = baseline.kinds[k];
+			profile.queries -= base.queries;
+			profile.nodes_visited -= base.nodes_visited;
+			profile.leaves_reached -= base.leaves_reached;
+			profile.exact_tests -= base.exact_tests;
+			profile.objects_emitted -= base.objects_emitted;
+
+			for (size_t i = 0; i < rz_latency_histogram::buckets_count; ++i) {
+				profile.latency[i] -= base.latency[i];
+			}
+		}
+	}
+
+	static uint64_t next_id() {
+		static std::atomic<uint64_t> id(0);
+		return ++id;
+	}
+
+	// ids of the instances alive, taken only on construction, destruction
+	// and a thread's first query on an instance
+	static std::set<uint64_t>& live_ids() {
+		static std::set<uint64_t> ids;
+		return ids;
+	}
+
+	static std::mutex& registry_mutex() {
+		static std::mutex mutex;
+		return mutex;
+	}
+
+	uint64_t id_;
+	mutable std::mutex mutex_;		// guards slots_ and baseline_, never taken by a recording thread after its first query
+	std::vector<std::unique_ptr<thread_slot> > slots_;
+	rz_query_profiles baseline_;
+};
+
+} // namespace rimz
+
+#endif // _RZ_INSTRUMENTATION_HPP_INCLUDED_
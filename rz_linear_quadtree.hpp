@@ -0,0 +1,382 @@
+/** @file rz_linear_quadtree.hpp */
+// class: rz_linear_quadtree
+// description: pointerless variant of rz_quadtree. leaves are kept as
+// a sorted array of morton (z-order) keys plus ranges into one contiguous
+// index buffer, there are no node objects at all. it's built with the
+// same subdivision rules as rz_quadtree, so both trees can be compared
+// on identical data. point lookup is a key computation plus a binary
+// search, aabb lookup walks the implicit cells over the key array.
+// last updated: aug.28.2011
+
+// Copyright (C) 2011 Rim Zaidullin <tinybit@yandex.ru>
+
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+
+#ifndef _RZ_LINEAR_QUADTREE_HPP_INCLUDED_
+#define _RZ_LINEAR_QUADTREE_HPP_INCLUDED_
+
+#include <cmath>
+#include <vector>
+#include <algorithm>
+#include <stdexcept>
+#include <stdint.h>
+
+#include "rz_geometry_structs.hpp"
+#include "rz_geometry_math.hpp"
+
+namespace rimz {
+
+template <typename T>
+class rz_linear_quadtree {
+public:
+	typedef std::vector<T> o_vector;
+	typedef uint32_t index_type;
+	typedef std::vector<index_type> index_vector;
+	typedef typename T::point_type point2d;
+	typedef rz_aabb<point2d> aabb2d;
+
+	rz_linear_quadtree(const o_vector& objects_list);
+	rz_linear_quadtree(const o_vector& objects_list, size_t objects_threshold, size_t depth_threshold);
+	~rz_linear_quadtree() {}
+
+	// output vectors are cleared first, as with rz_quadtree
+	void get_objects_from_point(const point2d& pt, o_vector& objects) const;
+	void get_objects_from_aabb(const aabb2d& aabb, o_vector& objects) const;
+
+	void get_indices_from_point(const point2d& pt, index_vector& indices) const;
+	void get_indices_from_aabb(const aabb2d& aabb, index_vector& indices) const;
+
+	const T& object(index_type index) const;
+	const o_vector& objects() const;
+	size_t size() const;
+	size_t leaf_count() const;
+
+	// max depth_threshold, cell coords of the deepest level must fit 32 bits
+	static const size_t max_depth = 32;
+
+private:
+	// leaf cell, covers keys [key, key + 4^(depth_threshold_ - level))
+	struct leaf_cell {
+		uint32_t first;		// first element in indices_
+		uint32_t count;
+		uint32_t level;
+	};
+
+	void build_tree();
+	void build_sub_tree(const index_vector& indices, uint64_t key, size_t level, const point2d& box_origin, double box_size);
+	void get_min_max(const o_vector& objects_list, point2d& min, point2d& max);
+	void partition_objects(const index_vector& indices, const point2d& box_origin, double sub_box_size, index_vector* sub_indices) const;
+
+	bool point_to_key(const point2d& pt, uint64_t& key) const;
+	void intersect_cells_with_aabb(const aabb2d& aabb, index_vector& indices, size_t first_leaf, size_t last_leaf, uint64_t key, size_t level, const point2d& box_origin, double box_size) const;
+	uint64_t key_span(size_t level) const;
+	static bool boxes_overlap(const aabb2d& a, const aabb2d& b);
+
+	o_vector objects_;
+
+	std::vector<uint64_t> keys_;		// sorted leaf keys, parallel to leaves_
+	std::vector<leaf_cell> leaves_;
+	index_vector indices_;			// leaf contents, one slice per leaf
+
+	point2d min_;		// actual data min (also used as root cell coords origin)
+	point2d max_;		// actual data max
+	double box_size_;	// aligned root cell size
+
+	size_t objects_threshold_;
+	size_t depth_threshold_;
+};
+
+template <typename T> inline
+rz_linear_quadtree<T>::rz_linear_quadtree(const o_vector& objects_list) :
+objects_(objects_list), objects_threshold_(10), depth_threshold_(12) {
+	build_tree();
+}
+
+template <typename T> inline
+rz_linear_quadtree<T>::rz_linear_quadtree(const o_vector& objects_list, size_t objects_threshold, size_t depth_threshold) :
+objects_(objects_list), objects_threshold_(objects_threshold), depth_threshold_(depth_threshold) {
+	build_tree();
+}
+
+template <typename T> inline const T&
+rz_linear_quadtree<T>::object(index_type index) const {
+	return objects_[index];
+}
+
+template <typename T> inline const typename rz_linear_quadtree<T>::o_vector&
+rz_linear_quadtree<T>::objects() const {
+	return objects_;
+}
+
+template <typename T> inline size_t
+rz_linear_quadtree<T>::size() const {
+	return objects_.size();
+}
+
+template <typename T> inline size_t
+rz_linear_quadtree<T>::leaf_count() const {
+	return leaves_.size();
+}
+
+template <typename T> inline uint64_t
+rz_linear_quadtree<T>::key_span(size_t level) const {
+	size_t shift = 2 * (depth_threshold_ - level);
+	return (shift >= 64) ? 0 : ((uint64_t)1 << shift);
+}
+
+template <typename T> inline bool
+rz_linear_quadtree<T>::boxes_overlap(const aabb2d& a, const aabb2d& b) {
+	// closed boxes, touching counts
+	return !(a.max.x < b.min.x || a.min.x > b.max.x || a.max.y < b.min.y || a.min.y > b.max.y);
+}
+
+template <typename T> inline void
+rz_linear_quadtree<T>::get_min_max(const o_vector& objects_list, point2d& min, point2d& max) {
+	min = point2d(MAXF, MAXF);
+	max = point2d(MINF, MINF);
+
+	for (size_t i = 0; i < objects_list.size(); ++i) {
+		point2d obj_min = min_2d(objects_list[i]);
+		point2d obj_max = max_2d(objects_list[i]);
+
+		min.x = obj_min.x < min.x ? obj_min.x : min.x;
+		min.y = obj_min.y < min.y ? obj_min.y : min.y;
+		max.x = obj_max.x > max.x ? obj_max.x : max.x;
+		max.y = obj_max.y > max.y ? obj_max.y : max.y;
+	}
+}
+
+template <typename T> inline void
+rz_linear_quadtree<T>::build_tree() {
+	if (objects_.size() > (size_t)UINT32_MAX) {
+		throw std::runtime_error("rz_linear_quadtree can't index more than 2^32 - 1 objects!");
+	}
+
+	if (depth_threshold_ > max_depth) {
+		throw std::runtime_error("rz_linear_quadtree depth_threshold exceeds max_depth!");
+	}
+
+	get_min_max(objects_, min_, max_);
+
+	double size_x = fabs(max_.x - min_.x);
+	double size_y = fabs(max_.y - min_.y);
+	// a single point (every object with the same bounds) gets a unit cell,
+	// as the root box of rz_quadtree, point_to_key divides by the size
+	box_size_ = (size_x > size_y) ? size_x : size_y;
+	box_size_ = box_size_ > 0.0 ? box_size_ : 1.0;
+
+	index_vector indices(objects_.size());
+	for (size_t i = 0; i < indices.size(); ++i) {
+		indices[i] = (index_type)i;
+	}
+
+	// leaves are emitted in z-order, so keys_ comes out sorted
+	build_sub_tree(indices, 0, 0, min_, box_size_);
+}
+
+template <typename T> inline void
+rz_linear_quadtree<T>::build_sub_tree(const index_vector& indices, uint64_t key, size_t level, const point2d& box_origin, double box_size) {
+	// same cell rules as rz_quadtree::build_sub_tree, empty leaves aren't
+	// stored. closed test, a flat data box (objects on one line) touches
+	// the cells along it
+	point2d box_max(box_origin.x + box_size, box_origin.y + box_size);
+	aabb2d cell_box(box_origin, box_max);
+	aabb2d data_box(min_, max_);
+
+	if (false == boxes_overlap(cell_box, data_box)) {
+		return;
+	}
+
+	if (indices.size() <= objects_threshold_ || level >= depth_threshold_) {
+		if (indices.empty()) {
+			return;
+		}
+
+		if (indices_.size() + indices.size() > (size_t)UINT32_MAX) {
+			throw std::runtime_error("rz_linear_quadtree leaf index buffer overflow!");
+		}
+
+		leaf_cell leaf;
+		leaf.first = (uint32_t)indices_.size();
+		leaf.count = (uint32_t)indices.size();
+		leaf.level = (uint32_t)level;
+
+		keys_.push_back(key);
+		leaves_.push_back(leaf);
+		indices_.insert(indices_.end(), indices.begin(), indices.end());
+		return;
+	}
+
+	double sub_box_size = box_size / 2.0;
+	uint64_t sub_span = key_span(level + 1);
+
+	// one pass over objects fills the children lists, z-order: C (x0, y0),
+	// D (x1, y0), A (x0, y1), B (x1, y1)
+	index_vector sub_indices[4];
+	partition_objects(indices, box_origin, sub_box_size, sub_indices);
+
+	for (size_t i = 0; i < 4; ++i) {
+		point2d sub_box_origin(box_origin.x + (i & 1) * sub_box_size, box_origin.y + (i >> 1) * sub_box_size);
+		build_sub_tree(sub_indices[i], key + i * sub_span, level + 1, sub_box_origin, sub_box_size);
+	}
+}
+
+template <typename T> inline void
+rz_linear_quadtree<T>::partition_objects(const index_vector& indices, const point2d& box_origin, double sub_box_size, index_vector* sub_indices) const {
+	aabb2d sub_boxes[4];
+
+	for (size_t i = 0; i < 4; ++i) {
+		point2d sub_box_origin(box_origin.x + (i & 1) * sub_box_size, box_origin.y + (i >> 1) * sub_box_size);
+		sub_boxes[i] = aabb2d(sub_box_origin, point2d(sub_box_origin.x + sub_box_size, sub_box_origin.y + sub_box_size));
+	}
+
+	// closed cell tests, an object on a split line goes to both sides
+	for (size_t i = 0; i < indices.size(); ++i) {
+		const T& object = objects_[indices[i]];
+
+		for (size_t j = 0; j < 4; ++j) {
+			if (intersect_2d(sub_boxes[j], object)) {
+				sub_indices[j].push_back(indices[i]);
+			}
+		}
+	}
+}
+
+template <typename T> inline bool
+rz_linear_quadtree<T>::point_to_key(const point2d& pt, uint64_t& key) const {
+	aabb2d box(min_, max_);
+	if (false == intersect_2d(box, pt)) {
+		return false;
+	}
+
+	// a point on a cell edge goes to the lower cell, which holds every
+	// object touching the point as the cell tests are closed, hence ceil - 1
+	double cells = ldexp(1.0, (int)depth_threshold_);
+	double max_cell = cells - 1.0;
+	double cx = ceil((pt.x - min_.x) / box_size_ * cells) - 1.0;
+	double cy = ceil((pt.y - min_.y) / box_size_ * cells) - 1.0;
+
+	cx = cx < 0.0 ? 0.0 : (cx > max_cell ? max_cell : cx);
+	cy = cy < 0.0 ? 0.0 : (cy > max_cell ? max_cell : cy);
+
+	key = morton_encode_2d((uint32_t)cx, (uint32_t)cy);
+	return true;
+}
+
+template <typename T> inline void
+rz_linear_quadtree<T>::get_objects_from_point(const point2d& pt, o_vector& objects) const {
+	index_vector indices;
+	get_indices_from_point(pt, indices);
+
+	objects.resize(indices.size());
+	for (size_t i = 0; i < indices.size(); ++i) {
+		objects[i] = objects_[indices[i]];
+	}
+}
+
+template <typename T> inline void
+rz_linear_quadtree<T>::get_objects_from_aabb(const aabb2d& aabb, o_vector& objects) const {
+	index_vector indices;
+	get_indices_from_aabb(aabb, indices);
+
+	objects.resize(indices.size());
+	for (size_t i = 0; i < indices.size(); ++i) {
+		objects[i] = objects_[indices[i]];
+	}
+}
+
+template <typename T> inline void
+rz_linear_quadtree<T>::get_indices_from_point(const point2d& pt, index_vector& indices) const {
+	indices.clear();
+
+	uint64_t key;
+	if (false == point_to_key(pt, key)) {
+		return;
+	}
+
+	// last leaf starting at or before the key, then check it covers the key
+	std::vector<uint64_t>::const_iterator it = std::upper_bound(keys_.begin(), keys_.end(), key);
+	if (it == keys_.begin()) {
+		return;
+	}
+
+	size_t leaf_index = (it - keys_.begin()) - 1;
+	const leaf_cell& leaf = leaves_[leaf_index];
+	uint64_t span = key_span(leaf.level);
+
+	if (span != 0 && key - keys_[leaf_index] >= span) {
+		return;
+	}
+
+	indices.assign(indices_.begin() + leaf.first, indices_.begin() + leaf.first + leaf.count);
+}
+
+template <typename T> inline void
+rz_linear_quadtree<T>::get_indices_from_aabb(const aabb2d& aabb, index_vector& indices) const {
+	indices.clear();
+
+	aabb2d box(min_, max_);
+	if (false == boxes_overlap(box, aabb)) {
+		return;
+	}
+
+	intersect_cells_with_aabb(aabb, indices, 0, leaves_.size(), 0, 0, min_, box_size_);
+}
+
+template <typename T> inline void
+rz_linear_quadtree<T>::intersect_cells_with_aabb(const aabb2d& aabb, index_vector& indices, size_t first_leaf, size_t last_leaf, uint64_t key, size_t level, const point2d& box_origin, double box_size) const {
+	// no stored leaves inside this cell
+	if (first_leaf >= last_leaf) {
+		return;
+	}
+
+	aabb2d cell_box(box_origin, point2d(box_origin.x + box_size, box_origin.y + box_size));
+	if (false == boxes_overlap(cell_box, aabb)) {
+		return;
+	}
+
+	// the cell itself is a leaf
+	if (leaves_[first_leaf].level == level) {
+		const leaf_cell& leaf = leaves_[first_leaf];
+		indices.insert(indices.end(), indices_.begin() + leaf.first, indices_.begin() + leaf.first + leaf.count);
+		return;
+	}
+
+	double sub_box_size = box_size / 2.0;
+	uint64_t sub_span = key_span(level + 1);
+
+	// split leaf range into the four z-ordered sub-cells
+	size_t bounds[5];
+	bounds[0] = first_leaf;
+	bounds[4] = last_leaf;
+
+	for (size_t i = 1; i < 4; ++i) {
+		bounds[i] = std::lower_bound(keys_.begin() + bounds[i - 1], keys_.begin() + last_leaf, key + i * sub_span) - keys_.begin();
+	}
+
+	point2d origins[4];
+	origins[0] = point2d(box_origin.x, box_origin.y);
+	origins[1] = point2d(box_origin.x + sub_box_size, box_origin.y);
+	origins[2] = point2d(box_origin.x, box_origin.y + sub_box_size);
+	origins[3] = point2d(box_origin.x + sub_box_size, box_origin.y + sub_box_size);
+
+	for (size_t i = 0; i < 4; ++i) {
+		intersect_cells_with_aabb(aabb, indices, bounds[i], bounds[i + 1], key + i * sub_span, level + 1, origins[i], sub_box_size);
+	}
+}
+
+} // namespace rimz
+
+#endif // _RZ_LINEAR_QUADTREE_HPP_INCLUDED_
@@ -0,0 +1,442 @@
+/** @file rz_loose_quadtree.hpp */
+// class: rz_loose_quadtree
+// description: loose variant of rz_quadtree. every object is stored in
+// exactly one node, the deepest one whose cell contains the object's
+// centre and whose loose bounds (the cell scaled by looseness around its
+// centre) contain the whole object. objects too big for the children
+// stay in internal nodes, so long segments and big triangles are never
+// replicated and queries never report an object twice. queries visit
+// the nodes which loose bounds are hit.
+// last updated: aug.28.2011
+
+// Copyright (C) 2011 Rim Zaidullin <tinybit@yandex.ru>
+
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+
+#ifndef _RZ_LOOSE_QUADTREE_HPP_INCLUDED_
+#define _RZ_LOOSE_QUADTREE_HPP_INCLUDED_
+
+#include <cmath>
+#include <vector>
+#include <algorithm>
+#include <stdexcept>
+#include <stdint.h>
+
+#include "rz_geometry_structs.hpp"
+#include "rz_geometry_math.hpp"
+#include "rz_query.hpp"
+
+namespace rimz {
+
+template <typename T>
+class rz_loose_quadtree {
+public:
+	typedef std::vector<T> o_vector;
+	typedef uint32_t index_type;
+	typedef std::vector<index_type> index_vector;
+	typedef typename T::point_type point2d;
+	typedef rz_aabb<point2d> aabb2d;
+
+	// looseness >= 1, 1 gives a tree where only points leave the root
+	rz_loose_quadtree(const o_vector& objects_list, double looseness = 2.0);
+	rz_loose_quadtree(const o_vector& objects_list, double looseness, size_t objects_threshold, size_t depth_threshold);
+	~rz_loose_quadtree() {}
+
+	// objects are filtered by their bounds, RZ_QUERY_EXACT adds the exact
+	// test. every object is reported once, RZ_QUERY_UNIQUE changes nothing.
+	// output vectors are cleared first, as with rz_quadtree
+	void get_objects_from_point(const point2d& pt, o_vector& objects, unsigned int flags = RZ_QUERY_DEFAULT) const;
+	void get_objects_from_aabb(const aabb2d& aabb, o_vector& objects, unsigned int flags = RZ_QUERY_DEFAULT) const;
+
+	void get_indices_from_point(const point2d& pt, index_vector& indices, unsigned int flags = RZ_QUERY_DEFAULT) const;
+	void get_indices_from_aabb(const aabb2d& aabb, index_vector& indices, unsigned int flags = RZ_QUERY_DEFAULT) const;
+
+	// f(const T& object) returns false to stop, false if it was stopped
+	template <typename F> bool query_point(const point2d& pt, F&& f, unsigned int flags = RZ_QUERY_DEFAULT) const;
+	template <typename F> bool query_aabb(const aabb2d& aabb, F&& f, unsigned int flags = RZ_QUERY_DEFAULT) const;
+
+	const T& object(index_type index) const;
+	const o_vector& objects() const;
+	size_t size() const;
+	size_t node_count() const;
+	double looseness() const;
+
+	// stored object references per object, always 1 here, compare with
+	// rz_quadtree::replication()
+	double replication() const;
+
+private:
+	struct loose_node {
+		point2d origin;		// cell origin, loose bounds are computed from the cell
+		double size;
+		uint32_t first;		// objects of the node, slice of indices_
+		uint32_t count;
+		uint32_t children;	// first of four children in nodes_ (A, B, C, D), 0 for leaves
+	};
+
+	void build_tree();
+	void build_node(size_t node_index, index_vector& indices, size_t depth);
+	void get_min_max(const o_vector& objects_list, point2d& min, point2d& max);
+	aabb2d loose_box(const loose_node& node) const;
+
+	template <typename F> bool visit_point(const point2d& pt, unsigned int flags, F& visitor) const;
+	template <typename F> bool visit_aabb(const aabb2d& aabb, unsigned int flags, F& visitor) const;
+	template <typename F> bool intersect_node_with_point(const point2d& pt, size_t node_index, unsigned int flags, F& visitor) const;
+	template <typename F> bool intersect_node_with_aabb(const aabb2d& aabb, size_t node_index, unsigned int flags, F& visitor) const;
+
+	o_vector objects_;
+	std::vector<aabb2d> bounds_;	// objects bounds, same order as objects_
+
+	std::vector<loose_node> nodes_;	// root first, siblings next to each other
+	index_vector indices_;		// node contents, one slice per node
+
+	point2d min_;		// actual data min (also used as root cell coords origin)
+	point2d max_;		// actual data max
+	double box_size_;	// aligned root cell size
+
+	double looseness_;
+	size_t objects_threshold_;
+	size_t depth_threshold_;
+};
+
+template <typename T> inline
+rz_loose_quadtree<T>::rz_loose_quadtree(const o_vector& objects_list, double looseness) :
+objects_(objects_list), looseness_(looseness), objects_threshold_(10), depth_threshold_(12) {
+	build_tree();
+}
+
+template <typename T> inline
+rz_loose_quadtree<T>::rz_loose_quadtree(const o_vector& objects_list, double looseness, size_t objects_threshold, size_t depth_threshold) :
+objects_(objects_list), looseness_(looseness), objects_threshold_(objects_threshold), depth_threshold_(depth_threshold) {
+	build_tree();
+}
+
+template <typename T> inline const T&
+rz_loose_quadtree<T>::object(index_type index) const {
+	return objects_[index];
+}
+
+template <typename T> inline const typename rz_loose_quadtree<T>::o_vector&
+rz_loose_quadtree<T>::objects() const {
+	return objects_;
+}
+
+template <typename T> inline size_t
+rz_loose_quadtree<T>::size() const {
+	return objects_.size();
+}
+
+template <typename T> inline size_t
+rz_loose_quadtree<T>::node_count() const {
+	return nodes_.size();
+}
+
+template <typename T> inline double
+rz_loose_quadtree<T>::looseness() const {
+	return looseness_;
+}
+
+template <typename T> inline double
+rz_loose_quadtree<T>::replication() const {
+	if (objects_.empty()) {
+		return 0.0;
+	}
+
+	return (double)indices_.size() / (double)objects_.size();
+}
+
+template <typename T> inline void
+rz_loose_quadtree<T>::get_min_max(const o_vector& objects_list, point2d& min, point2d& max) {
+	min = point2d(MAXF, MAXF);
+	max = point2d(MINF, MINF);
+
+	for (size_t i = 0; i < objects_list.size(); ++i) {
+		point2d obj_min = min_2d(objects_list[i]);
+		point2d obj_max = max_2d(objects_list[i]);
+
+		min.x = fmin(min.x, obj_min.x);
+		min.y = fmin(min.y, obj_min.y);
+		max.x = fmax(max.x, obj_max.x);
+		max.y = fmax(max.y, obj_max.y);
+	}
+}
+
+template <typename T> inline void
+rz_loose_quadtree<T>::build_tree() {
+	if (objects_.size() > (size_t)UINT32_MAX) {
+		throw std::runtime_error("rz_loose_quadtree can't index more than 2^32 - 1 objects!");
+	}
+
+	if (!(looseness_ >= 1.0)) {
+		throw std::runtime_error("rz_loose_quadtree looseness must be at least 1!");
+	}
+
+	// calc objects min/max and max align size
+	get_min_max(objects_, min_, max_);
+	box_size_ = fmax(fabs(max_.x - min_.x), fabs(max_.y - min_.y));
+
+	bounds_.resize(objects_.size());
+	index_vector indices(objects_.size());
+
+	for (size_t i = 0; i < objects_.size(); ++i) {
+		bounds_[i] = aabb2d(min_2d(objects_[i]), max_2d(objects_[i]));
+		indices[i] = (index_type)i;
+	}
+
+	loose_node root;
+	root.origin = min_;
+	root.size = box_size_;
+	root.first = 0;
+	root.count = 0;
+	root.children = 0;
+
+	nodes_.push_back(root);
+	indices_.reserve(objects_.size());
+
+	build_node(0, indices, 0);
+}
+
+template <typename T> inline void
+rz_loose_quadtree<T>::build_node(size_t node_index, index_vector& indices, size_t depth) {
+	loose_node node = nodes_[node_index];
+
+	// objects fitting the loose bounds of the child holding their centre go down
+	double sub_box_size = node.size / 2.0;
+	double max_extent = (looseness_ - 1.0) * sub_box_size;
+	double mid_x = node.origin.x + sub_box_size;
+	double mid_y = node.origin.y + sub_box_size;
+
+	index_vector node_indices;
+	index_vector sub_indices[4];
+
+	if (indices.size() <= objects_threshold_ || depth >= depth_threshold_) {
+		node_indices.swap(indices);
+	}
+	else {
+		for (size_t i = 0; i < indices.size(); ++i) {
+			const aabb2d& bounds = bounds_[indices[i]];
+
+			if (bounds.width() > max_extent || bounds.height() > max_extent) {
+				node_indices.push_back(indices[i]);
+				continue;
+			}
+
+			// A top-left, B top-right, C bottom-left, D bottom-right
+			bool right = (bounds.min.x + bounds.max.x) * 0.5 >= mid_x;
+			bool top = (bounds.min.y + bounds.max.y) * 0.5 >= mid_y;
+			sub_indices[(top ? 0 : 2) + (right ? 1 : 0)].push_back(indices[i]);
+		}
+
+		index_vector().swap(indices);
+	}
+
+	nodes_[node_index].first = (uint32_t)indices_.size();
+	nodes_[node_index].count = (uint32_t)node_indices.size();
+	indices_.insert(indices_.end(), node_indices.begin(), node_indices.end());
+
+	if (sub_indices[0].empty() && sub_indices[1].empty() && sub_indices[2].empty() && sub_indices[3].empty()) {
+		return;
+	}
+
+	size_t children = nodes_.size();
+	nodes_[node_index].children = (uint32_t)children;
+
+	point2d sub_box_origins[4];
+	sub_box_origins[0] = point2d(node.origin.x, node.origin.y + sub_box_size);			// sub-box A
+	sub_box_origins[1] = point2d(node.origin.x + sub_box_size, node.origin.y + sub_box_size);	// sub-box B
+	sub_box_origins[2] = point2d(node.origin.x, node.origin.y);					// sub-box C
+	sub_box_origins[3] = point2d(node.origin.x + sub_box_size, node.origin.y);			// sub-box D
+
+	for (size_t i = 0; i < 4; ++i) {
+		loose_node sub_node;
+		sub_node.origin = sub_box_origins[i];
+		sub_node.size = sub_box_size;
+		sub_node.first = 0;
+		sub_node.count = 0;
+		sub_node.children = 0;
+		nodes_.push_back(sub_node);
+	}
+
+	for (size_t i = 0; i < 4; ++i) {
+		build_node(children + i, sub_indices[i], depth + 1);
+	}
+}
+
+template <typename T> inline typename rz_loose_quadtree<T>::aabb2d
+rz_loose_quadtree<T>::loose_box(const loose_node& node) const {
+	double margin = (looseness_ - 1.0) * node.size * 0.5;
+	return aabb2d(point2d(node.origin.x - margin, node.origin.y - margin), point2d(node.origin.x + node.size + margin, node.origin.y + node.size + margin));
+}
+
+template <typename T> inline void
+rz_loose_quadtree<T>::get_objects_from_point(const point2d& pt, o_vector& objects, unsigned int flags) const {
+	objects.clear();
+	query_point(pt, [&objects](const T& object) {
+		objects.push_back(object);
+		return true;
+	}, flags);
+}
+
+template <typename T> inline void
+rz_loose_quadtree<T>::get_objects_from_aabb(const aabb2d& aabb, o_vector& objects, unsigned int flags) const {
+	objects.clear();
+	query_aabb(aabb, [&objects](const T& object) {
+		objects.push_back(object);
+		return true;
+	}, flags);
+}
+
+template <typename T> inline void
+rz_loose_quadtree<T>::get_indices_from_point(const point2d& pt, index_vector& indices, unsigned int flags) const {
+	indices.clear();
+
+	auto visitor = [&indices](index_type index) {
+		indices.push_back(index);
+		return true;
+	};
+
+	visit_point(pt, flags, visitor);
+}
+
+template <typename T> inline void
+rz_loose_quadtree<T>::get_indices_from_aabb(const aabb2d& aabb, index_vector& indices, unsigned int flags) const {
+	indices.clear();
+
+	auto visitor = [&indices](index_type index) {
+		indices.push_back(index);
+		return true;
+	};
+
+	visit_aabb(aabb, flags, visitor);
+}
+
+template <typename T> template <typename F> inline bool
+rz_loose_quadtree<T>::query_point(const point2d& pt, F&& f, unsigned int flags) const {
+	auto visitor = [this, &f](index_type index) -> bool {
+		return f(objects_[index]);
+	};
+
+	return visit_point(pt, flags, visitor);
+}
+
+template <typename T> template <typename F> inline bool
+rz_loose_quadtree<T>::query_aabb(const aabb2d& aabb, F&& f, unsigned int flags) const {
+	auto visitor = [this, &f](index_type index) -> bool {
+		return f(objects_[index]);
+	};
+
+	return visit_aabb(aabb, flags, visitor);
+}
+
+template <typename T> template <typename F> inline bool
+rz_loose_quadtree<T>::visit_point(const point2d& pt, unsigned int flags, F& visitor) const {
+	if (objects_.empty()) {
+		return true;
+	}
+
+	return intersect_node_with_point(pt, 0, flags, visitor);
+}
+
+template <typename T> template <typename F> inline bool
+rz_loose_quadtree<T>::visit_aabb(const aabb2d& aabb, unsigned int flags, F& visitor) const {
+	if (objects_.empty()) {
+		return true;
+	}
+
+	return intersect_node_with_aabb(aabb, 0, flags, visitor);
+}
+
+template <typename T> template <typename F> inline bool
+rz_loose_quadtree<T>::intersect_node_with_point(const point2d& pt, size_t node_index, unsigned int flags, F& visitor) const {
+	const loose_node& node = nodes_[node_index];
+	aabb2d box = loose_box(node);
+
+	if (pt.x < box.min.x || pt.x > box.max.x || pt.y < box.min.y || pt.y > box.max.y) {
+		return true;
+	}
+
+	for (size_t i = node.first; i < node.first + node.count; ++i) {
+		index_type index = indices_[i];
+		const aabb2d& bounds = bounds_[index];
+
+		if (pt.x < bounds.min.x || pt.x > bounds.max.x || pt.y < bounds.min.y || pt.y > bounds.max.y) {
+			continue;
+		}
+
+		if ((flags & RZ_QUERY_EXACT) && false == intersect_2d(objects_[index], pt)) {
+			continue;
+		}
+
+		if (!visitor(index)) {
+			return false;
+		}
+	}
+
+	if (node.children == 0) {
+		return true;
+	}
+
+	// loose bounds of the siblings overlap, any of them may hold the point
+	for (size_t i = 0; i < 4; ++i) {
+		if (!intersect_node_with_point(pt, node.children + i, flags, visitor)) {
+			return false;
+		}
+	}
+
+	return true;
+}
+
+template <typename T> template <typename F> inline bool
+rz_loose_quadtree<T>::intersect_node_with_aabb(const aabb2d& aabb, size_t node_index, unsigned int flags, F& visitor) const {
+	const loose_node& node = nodes_[node_index];
+	aabb2d box = loose_box(node);
+
+	if (aabb.max.x < box.min.x || aabb.min.x > box.max.x || aabb.max.y < box.min.y || aabb.min.y > box.max.y) {
+		return true;
+	}
+
+	for (size_t i = node.first; i < node.first + node.count; ++i) {
+		index_type index = indices_[i];
+		const aabb2d& bounds = bounds_[index];
+
+		if (bounds.max.x < aabb.min.x || bounds.min.x > aabb.max.x || bounds.max.y < aabb.min.y || bounds.min.y > aabb.max.y) {
+			continue;
+		}
+
+		if ((flags & RZ_QUERY_EXACT) && false == intersect_2d(aabb, objects_[index])) {
+			continue;
+		}
+
+		if (!visitor(index)) {
+			return false;
+		}
+	}
+
+	if (node.children == 0) {
+		return true;
+	}
+
+	for (size_t i = 0; i < 4; ++i) {
+		if (!intersect_node_with_aabb(aabb, node.children + i, flags, visitor)) {
+			return false;
+		}
+	}
+
+	return true;
+}
+
+} // namespace rimz
+
+#endif // _RZ_LOOSE_QUADTREE_HPP_INCLUDED_
@@ -0,0 +1,471 @@
+/** @file rz_mapped_quadtree.hpp */
+// class: rz_mapped_quadtree
+// description: read-only quadtree working directly on a memory mapped
+// image written by rz_quadtree::save. opening a file maps it and checks
+// the header and section bounds only, nothing is parsed or copied and no
+// section is paged in. node links, leaf ranges and object indices are
+// bounds checked as queries reach them, so a corrupted file throws instead
+// of being read out of bounds. validate() checks the whole file up front.
+// the mapping is shared, so processes that open the same file share one
+// page cache copy of it.
+// queries give the same results as the rz_quadtree that was saved.
+// posix only (mmap)
+// last updated: aug.28.2011
+
+// Copyright (C) 2011 Rim Zaidullin <tinybit@yandex.ru>
+
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+
+#ifndef _RZ_MAPPED_QUADTREE_HPP_INCLUDED_
+#define _RZ_MAPPED_QUADTREE_HPP_INCLUDED_
+
+#include <string>
+#include <vector>
+#include <stdexcept>
+#include <string.h>
+#include <stdint.h>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "rz_geometry_structs.hpp"
+#include "rz_geometry_math.hpp"
+#include "rz_query.hpp"
+#include "rz_quadtree_node.hpp"
+#include "rz_quadtree_file.hpp"
+
+namespace rimz {
+
+template <typename T>
+class rz_mapped_quadtree {
+public:
+	typedef uint32_t index_type;
+	typedef std::vector<index_type> index_vector;
+	typedef typename T::point_type point2d;
+	typedef rz_aabb<point2d> aabb2d;
+
+	explicit rz_mapped_quadtree(const std::string& path);
+	~rz_mapped_quadtree();
+
+	// output vectors are cleared first, as with rz_quadtree
+	void get_indices_from_point(const point2d& pt, index_vector& indices, unsigned int flags = RZ_QUERY_DEFAULT) const;
+	void get_indices_from_aabb(const aabb2d& aabb, index_vector& indices, unsigned int flags = RZ_QUERY_DEFAULT) const;
+	void get_indices_from_aabb(const aabb2d& aabb, index_vector& indices, unsigned int flags, rz_query_context& context) const;
+
+	// f(const T& object) returns false to stop the traversal
+	template <typename F> bool query_point(const point2d& pt, F&& f, unsigned int flags = RZ_QUERY_DEFAULT) const;
+	template <typename F> bool query_aabb(const aabb2d& aabb, F&& f, unsigned int flags = RZ_QUERY_DEFAULT) const;
+	template <typename F> bool query_aabb(const aabb2d& aabb, F&& f, unsigned int flags, rz_query_context& context) const;
+
+	// objects live in the mapping, references stay valid while the tree is open
+	const T& object(index_type index) const;
+	size_t size() const;
+
+	// one pass over all nodes and leaf indices, throws on the first one out
+	// of bounds. opening doesn't do it, call it for files from untrusted sources
+	void validate() const;
+
+private:
+	typedef rz_quadtree_file_node f_node;
+
+	rz_mapped_quadtree(const rz_mapped_quadtree&);
+	rz_mapped_quadtree& operator = (const rz_mapped_quadtree&);
+
+	void map_file(const std::string& path);
+	void check_header(size_t file_size);
+	static bool section_fits(uint64_t offset, uint64_t count, uint64_t size, uint64_t end);
+
+	const f_node* node_children(const f_node* node) const;
+	const index_type* leaf_indices(const f_node* node) const;
+	index_type checked_index(index_type index) const;
+
+	template <typename F> bool visit_point(const point2d& pt, unsigned int flags, F& visitor) const;
+	template <typename F> bool visit_aabb(const aabb2d& aabb, unsigned int flags, rz_query_context& context, F& visitor) const;
+	template <typename F> bool intersect_tree_with_point(const point2d& pt, const f_node* node, F& visitor) const;
+	template <typename F> bool intersect_tree_with_aabb(const aabb2d& aabb, const f_node* node, rz_query_context* unique_context, F& visitor) const;
+
+	aabb2d node_box(const f_node* node) const;
+	static bool boxes_overlap(const aabb2d& a, const aabb2d& b);
+
+	void* data_;
+	size_t data_size_;
+
+	const rz_quadtree_file_header* header_;
+	const f_node* nodes_;
+	const index_type* indices_;
+	const aabb2d* bounds_;
+	const T* objects_;
+
+	uint32_t nodes_count_;
+	uint32_t indices_count_;
+	uint32_t objects_count_;
+
+	point2d min_;
+	point2d max_;
+};
+
+template <typename T> inline
+rz_mapped_quadtree<T>::rz_mapped_quadtree(const std::string& path) :
+data_(NULL), data_size_(0), header_(NULL), nodes_(NULL), indices_(NULL), bounds_(NULL), objects_(NULL),
+nodes_count_(0), indices_count_(0), objects_count_(0) {
+	map_file(path);
+
+	try {
+		check_header(data_size_);
+
+		const char* base = (const char*)data_;
+		nodes_ = (const f_node*)(base + header_->nodes_offset);
+		indices_ = (const index_type*)(base + header_->indices_offset);
+		bounds_ = (const aabb2d*)(base + header_->bounds_offset);
+		objects_ = (const T*)(base + header_->objects_offset);
+	}
+	catch (...) {
+		munmap(data_, data_size_);
+		throw;
+	}
+
+	// check_header made sure they fit in 32 bits
+	nodes_count_ = (uint32_t)header_->nodes_count;
+	indices_count_ = (uint32_t)header_->indices_count;
+	objects_count_ = (uint32_t)header_->objects_count;
+
+	min_ = point2d(header_->min_x, header_->min_y);
+	max_ = point2d(header_->max_x, header_->max_y);
+}
+
+template <typename T> inline
+rz_mapped_quadtree<T>::~rz_mapped_quadtree() {
+	munmap(data_, data_size_);
+}
+
+template <typename T> inline void
+rz_mapped_quadtree<T>::map_file(const std::string& path) {
+	int fd = open(path.c_str(), O_RDONLY);
+	if (fd < 0) {
+		throw std::runtime_error("rz_mapped_quadtree can't open file!");
+	}
+
+	struct stat file_stat;
+	if (fstat(fd, &file_stat) != 0 || file_stat.st_size < (off_t)sizeof(rz_quadtree_file_header)) {
+		close(fd);
+		throw std::runtime_error("rz_mapped_quadtree file is too small!");
+	}
+
+	data_size_ = (size_t)file_stat.st_size;
+	data_ = mmap(NULL, data_size_, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+
+	if (data_ == MAP_FAILED) {
+		data_ = NULL;
+		throw std::runtime_error("rz_mapped_quadtree can't map file!");
+	}
+
+	header_ = (const rz_quadtree_file_header*)data_;
+}
+
+template <typename T> inline void
+rz_mapped_quadtree<T>::check_header(size_t file_size) {
+	if (memcmp(header_->magic, RZ_QUADTREE_FILE_MAGIC, sizeof(header_->magic)) != 0) {
+		throw std::runtime_error("rz_mapped_quadtree file isn't a quadtree image!");
+	}
+
+	if (header_->version != RZ_QUADTREE_FILE_VERSION) {
+		throw std::runtime_error("rz_mapped_quadtree unsupported file version!");
+	}
+
+	if (header_->byte_order != RZ_QUADTREE_FILE_BYTE_ORDER) {
+		throw std::runtime_error("rz_mapped_quadtree file was written with another byte order!");
+	}
+
+	if (header_->header_size != sizeof(rz_quadtree_file_header) || header_->node_size != sizeof(f_node) ||
+		header_->object_size != sizeof(T) || header_->bounds_size != sizeof(aabb2d)) {
+		throw std::runtime_error("rz_mapped_quadtree file was written for other types!");
+	}
+
+	// sections in order, aligned for their types. node links and leaf
+	// ranges are 32 bit, so are the counts they refer to
+	if (header_->file_size != file_size || header_->nodes_count == 0 ||
+		header_->nodes_count > UINT32_MAX || header_->indices_count > UINT32_MAX || header_->objects_count > UINT32_MAX ||
+		header_->nodes_offset < sizeof(rz_quadtree_file_header) ||
+		header_->nodes_offset % alignof(f_node) != 0 || header_->indices_offset % alignof(index_type) != 0 ||
+		header_->bounds_offset % alignof(aabb2d) != 0 || header_->objects_offset % alignof(T) != 0 ||
+		!section_fits(header_->nodes_offset, header_->nodes_count, sizeof(f_node), header_->indices_offset) ||
+		!section_fits(header_->indices_offset, header_->indices_count, sizeof(index_type), header_->bounds_offset) ||
+		!section_fits(header_->bounds_offset, header_->objects_count, sizeof(aabb2d), header_->objects_offset) ||
+		!section_fits(header_->objects_offset, header_->objects_count, sizeof(T), file_size)) {
+		throw std::runtime_error("rz_mapped_quadtree file is truncated or corrupted!");
+	}
+}
+
+template <typename T> inline bool
+rz_mapped_quadtree<T>::section_fits(uint64_t offset, uint64_t count, uint64_t size, uint64_t end) {
+	// offset + count * size <= end, without overflowing
+	return offset <= end && count <= (end - offset) / size;
+}
+
+template <typename T> inline void
+rz_mapped_quadtree<T>::validate() const {
+	for (uint32_t i = 0; i < nodes_count_; ++i) {
+		if (nodes_[i].leaf) {
+			leaf_indices(nodes_ + i);
+		}
+		else {
+			node_children(nodes_ + i);
+		}
+	}
+
+	for (uint32_t i = 0; i < indices_count_; ++i) {
+		checked_index(indices_[i]);
+	}
+}
+
+template <typename T> inline const typename rz_mapped_quadtree<T>::f_node*
+rz_mapped_quadtree<T>::node_children(const f_node* node) const {
+	// children come after their parent, so a descent always ends
+	uint64_t i = (uint64_t)(node - nodes_);
+
+	if (node->children == 0 || node->children > 15 || node->first <= i ||
+		(uint64_t)node->first + children_mask_count(node->children) > nodes_count_) {
+		throw std::runtime_error("rz_mapped_quadtree file has a node out of bounds!");
+	}
+
+	return nodes_ + node->first;
+}
+
+template <typename T> inline const typename rz_mapped_quadtree<T>::index_type*
+rz_mapped_quadtree<T>::leaf_indices(const f_node* node) const {
+	if (node->count > indices_count_ || node->first > indices_count_ - node->count) {
+		throw std::runtime_error("rz_mapped_quadtree file has a leaf out of bounds!");
+	}
+
+	return indices_ + node->first;
+}
+
+template <typename T> inline typename rz_mapped_quadtree<T>::index_type
+rz_mapped_quadtree<T>::checked_index(index_type index) const {
+	if (index >= objects_count_) {
+		throw std::runtime_error("rz_mapped_quadtree file has an object index out of bounds!");
+	}
+
+	return index;
+}
+
+template <typename T> inline const T&
+rz_mapped_quadtree<T>::object(index_type index) const {
+	return objects_[index];
+}
+
+template <typename T> inline size_t
+rz_mapped_quadtree<T>::size() const {
+	return (size_t)header_->objects_count;
+}
+
+template <typename T> inline typename rz_mapped_quadtree<T>::aabb2d
+rz_mapped_quadtree<T>::node_box(const f_node* node) const {
+	return aabb2d(point2d(node->min_x, node->min_y), point2d(node->max_x, node->max_y));
+}
+
+template <typename T> inline bool
+rz_mapped_quadtree<T>::boxes_overlap(const aabb2d& a, const aabb2d& b) {
+	// closed boxes, touching counts
+	return !(a.max.x < b.min.x || a.min.x > b.max.x || a.max.y < b.min.y || a.min.y > b.max.y);
+}
+
+template <typename T> inline void
+rz_mapped_quadtree<T>::get_indices_from_point(const point2d& pt, index_vector& indices, unsigned int flags) const {
+	indices.clear();
+
+	auto visitor = [&indices](index_type index) {
+		indices.push_back(index);
+		return true;
+	};
+
+	visit_point(pt, flags, visitor);
+}
+
+template <typename T> inline void
+rz_mapped_quadtree<T>::get_indices_from_aabb(const aabb2d& aabb, index_vector& indices, unsigned int flags) const {
+	rz_query_scope scope;
+	get_indices_from_aabb(aabb, indices, flags, scope.context());
+}
+
+template <typename T> inline void
+rz_mapped_quadtree<T>::get_indices_from_aabb(const aabb2d& aabb, index_vector& indices, unsigned int flags, rz_query_context& context) const {
+	indices.clear();
+
+	auto visitor = [&indices](index_type index) {
+		indices.push_back(index);
+		return true;
+	};
+
+	visit_aabb(aabb, flags, context, visitor);
+}
+
+template <typename T> template <typename F> inline bool
+rz_mapped_quadtree<T>::query_point(const point2d& pt, F&& f, unsigned int flags) const {
+	auto visitor = [this, &f](index_type index) -> bool {
+		return f(objects_[index]);
+	};
+
+	return visit_point(pt, flags, visitor);
+}
+
+template <typename T> template <typename F> inline bool
+rz_mapped_quadtree<T>::query_aabb(const aabb2d& aabb, F&& f, unsigned int flags) const {
+	rz_query_scope scope;
+	return query_aabb(aabb, f, flags, scope.context());
+}
+
+template <typename T> template <typename F> inline bool
+rz_mapped_quadtree<T>::query_aabb(const aabb2d& aabb, F&& f, unsigned int flags, rz_query_context& context) const {
+	auto visitor = [this, &f](index_type index) -> bool {
+		return f(objects_[index]);
+	};
+
+	return visit_aabb(aabb, flags, context, visitor);
+}
+
+template <typename T> template <typename F> inline bool
+rz_mapped_quadtree<T>::visit_point(const point2d& pt, unsigned int flags, F& visitor) const {
+	aabb2d box(min_, max_);
+	if (false == intersect_2d(box, pt) || false == intersect_2d(node_box(nodes_), pt)) {
+		return true;
+	}
+
+	if (flags & RZ_QUERY_EXACT) {
+		auto exact_visitor = [this, &pt, &visitor](index_type index) -> bool {
+			const aabb2d& bounds = bounds_[index];
+
+			if (pt.x < bounds.min.x || pt.x > bounds.max.x || pt.y < bounds.min.y || pt.y > bounds.max.y) {
+				return true;
+			}
+
+			if (false == intersect_2d(objects_[index], pt)) {
+				return true;
+			}
+
+			return visitor(index);
+		};
+
+		return intersect_tree_with_point(pt, nodes_, exact_visitor);
+	}
+
+	return intersect_tree_with_point(pt, nodes_, visitor);
+}
+
+template <typename T> template <typename F> inline bool
+rz_mapped_quadtree<T>::visit_aabb(const aabb2d& aabb, unsigned int flags, rz_query_context& context, F& visitor) const {
+	aabb2d box(min_, max_);
+	if (false == boxes_overlap(box, aabb) || false == boxes_overlap(node_box(nodes_), aabb)) {
+		return true;
+	}
+
+	rz_query_context* unique_context = NULL;
+
+	if (flags & RZ_QUERY_UNIQUE) {
+		context.begin_query(size());
+		unique_context = &context;
+	}
+
+	if (flags & RZ_QUERY_EXACT) {
+		auto exact_visitor = [this, &aabb, &visitor](index_type index) -> bool {
+			const aabb2d& bounds = bounds_[index];
+
+			if (bounds.max.x < aabb.min.x || bounds.min.x > aabb.max.x || bounds.max.y < aabb.min.y || bounds.min.y > aabb.max.y) {
+				return true;
+			}
+
+			if (false == intersect_2d(aabb, objects_[index])) {
+				return true;
+			}
+
+			return visitor(index);
+		};
+
+		return intersect_tree_with_aabb(aabb, nodes_, unique_context, exact_visitor);
+	}
+
+	return intersect_tree_with_aabb(aabb, nodes_, unique_context, visitor);
+}
+
+template <typename T> template <typename F> inline bool
+rz_mapped_quadtree<T>::intersect_tree_with_point(const point2d& pt, const f_node* node, F& visitor) const {
+	// node is known to contain the point, descend to the leaf
+	while (!node->leaf) {
+		const f_node* children = node_children(node);
+		const f_node* next = NULL;
+
+		for (size_t i = 0; i < children_mask_count(node->children); ++i) {
+			if (intersect_2d(node_box(children + i), pt)) {
+				next = children + i;
+				break;
+			}
+		}
+
+		if (!next) {
+			return true;
+		}
+
+		node = next;
+	}
+
+	const index_type* node_indices = leaf_indices(node);
+
+	for (uint32_t i = 0; i < node->count; ++i) {
+		if (!visitor(checked_index(node_indices[i]))) {
+			return false;
+		}
+	}
+
+	return true;
+}
+
+template <typename T> template <typename F> inline bool
+rz_mapped_quadtree<T>::intersect_tree_with_aabb(const aabb2d& aabb, const f_node* node, rz_query_context* unique_context, F& visitor) const {
+	// node is known to intersect the aabb
+	if (node->leaf) {
+		const index_type* node_indices = leaf_indices(node);
+
+		for (uint32_t i = 0; i < node->count; ++i) {
+			index_type index = checked_index(node_indices[i]);
+
+			if (unique_context && false == unique_context->mark(index)) {
+				continue;
+			}
+
+			if (!visitor(index)) {
+				return false;
+			}
+		}
+
+		return true;
+	}
+
+	const f_node* children = node_children(node);
+
+	for (size_t i = 0; i < children_mask_count(node->children); ++i) {
+		if (boxes_overlap(node_box(children + i), aabb) && !intersect_tree_with_aabb(aabb, children + i, unique_context, visitor)) {
+			return false;
+		}
+	}
+
+	return true;
+}
+
+} // namespace rimz
+
+#endif // _RZ_MAPPED_QUADTREE_HPP_INCLUDED_
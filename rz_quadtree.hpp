@@ -27,70 +27,561 @@
 #define _RZ_QUADTREE_HPP_INCLUDED_
 
 #include <cmath>
+#include <cstring>
+#include <stdint.h>
+#include <queue>
 #include <memory>
+#include <utility>
+#include <tuple>
+#include <algorithm>
+#include <string>
+#include <fstream>
 #include <iomanip>
 #include <stdexcept>
+#include <type_traits>
+#include <chrono>
 
 #include "rz_quadtree_node.hpp"
 #include "rz_geometry_structs.hpp"
 #include "rz_geometry_math.hpp"
+#include "rz_thread_pool.hpp"
+#include "rz_query.hpp"
+#include "rz_quadtree_file.hpp"
+#include "rz_bounds_filter.hpp"
+#include "rz_instrumentation.hpp"
 		
 namespace rimz {
 
-template <typename T>
+// split decision by expected query cost. a query reaching a leaf tests
+// every object in it, a query reaching an internal node visits the
+// children it overlaps and tests their objects. for queries of side q
+// spread evenly over a w x h node, a w_i x h_i child is reached with
+// probability p_i = (w_i + q) * (h_i + q) / ((w + q) * (h + q)), so a node
+// splits when
+//   sum of p_i * (node_cost + child objects * test_cost) < objects * test_cost
+// objects crossing the midlines count in every child they touch, which is
+// what replication costs the queries. the children are assumed to stay
+// leaves, the decision is taken again for every one of them
+struct rz_split_cost {
+	rz_split_cost() :
+	enabled(false), node_cost(4.0), test_cost(1.0), query_size(0.0) {
+	}
+
+	bool enabled;
+	double node_cost;	// cost of visiting a node, in any unit shared with test_cost
+	double test_cost;	// cost of the bounds and exact test of one object
+	double query_size;	// typical query box side, 0 for point queries
+};
+
+// where a node is split into its four children
+enum rz_split_policy {
+	RZ_SPLIT_MIDPOINT,		// middle of the cell
+	RZ_SPLIT_MEDIAN,		// median of the objects centers, on each axis
+	RZ_SPLIT_SAH			// least objects scanned by queries over the cell, on each axis
+};
+
+// median and sah nodes stay leaves when their children would hold more
+// than this many times their objects
+static const size_t RZ_SPLIT_REPLICATION_LIMIT = 2;
+
+// tree construction parameters
+struct rz_quadtree_options {
+	rz_quadtree_options() :
+	objects_threshold(10), depth_threshold(12), thread_pool(NULL), parallel_cutoff(4096),
+	split_policy(RZ_SPLIT_MIDPOINT), rectangular_root(false) {
+	}
+
+	size_t objects_threshold;	// max objects in a leaf (unless depth_threshold is hit), with split_cost
+					// nodes up to this many objects never split, larger ones split if it pays
+	size_t depth_threshold;		// max tree depth
+	rz_thread_pool* thread_pool;	// builds in parallel when set, result is the same as sequential
+	size_t parallel_cutoff;		// nodes with fewer objects are built sequentially
+	rz_split_cost split_cost;	// cost model split decision, off by default
+	rz_split_policy split_policy;	// split points, inserts split leaves the same way
+	bool rectangular_root;		// root cell is the data box rather than a square of its longer side
+};
+
+// counters of the paths taken by object updates
+struct rz_quadtree_update_stats {
+	rz_quadtree_update_stats() :
+	in_place(0), relocated(0), repeated(0), skipped(0) {
+	}
+
+	size_t in_place;	// object stayed in the same leaves, only its data changed
+	size_t relocated;	// object crossed cell boundaries and was reinserted
+	size_t repeated;	// later update of an object relocated earlier in the batch, reinserted once
+	size_t skipped;		// index of a removed or never inserted object
+};
+
+// shape of the tree, see rz_quadtree::stats. depths count from the root at 0
+struct rz_quadtree_stats {
+	rz_quadtree_stats() :
+	nodes(0), leaves(0), empty_leaves(0), overfull_leaves(0), max_depth(0), objects(0), references(0), replication(0.0),
+	objects_bytes(0), bounds_bytes(0), bookkeeping_bytes(0), nodes_bytes(0), leaf_indices_bytes(0), leaf_bounds_bytes(0),
+	unused_leaf_entries(0), total_bytes(0) {
+	}
+
+	size_t nodes;			// root included
+	size_t leaves;
+	size_t empty_leaves;
+	size_t overfull_leaves;		// stopped by depth_threshold with more than objects_threshold objects
+	size_t max_depth;
+	std::vector<size_t> depth_histogram;	// leaves at every depth
+	std::vector<size_t> occupancy_histogram;	// leaves by objects count, [0] empty, [i] from 2^(i-1) to 2^i - 1
+
+	size_t objects;			// objects in the tree
+	size_t references;		// objects stored in leaves, counted once per leaf
+	double replication;		// references / objects
+
+	// bytes by component, capacities rather than sizes
+	size_t objects_bytes;
+	size_t bounds_bytes;		// double bounds of the objects
+	size_t bookkeeping_bytes;	// alive flags and free slots
+	size_t nodes_bytes;
+	size_t leaf_indices_bytes;
+	size_t leaf_bounds_bytes;	// float bounds next to the leaf indices
+	size_t unused_leaf_entries;	// leaf buffer entries waiting for compaction
+	size_t total_bytes;		// all of the above and the tree object
+};
+
+// formats of rz_quadtree::save_leaves
+enum rz_leaves_format {
+	RZ_LEAVES_GEOJSON,		// feature collection, a polygon per leaf
+	RZ_LEAVES_CSV			// min_x,min_y,max_x,max_y,depth,count,overfull per leaf
+};
+
+// Alloc is rebound to allocate nodes and leaf index slices, objects are
+// kept in a plain o_vector
+// Instrument is the query instrumentation policy, rz_query_instrumentation
+// counts the work and latency of point and aabb queries, see
+// rz_instrumentation.hpp
+template <typename T, typename Alloc = std::allocator<T>, typename Instrument = rz_no_instrumentation>
 class rz_quadtree {
 public:
 	typedef std::vector<T> o_vector;
 	typedef rz_quadtree_node<T> q_node;
+	typedef typename q_node::index_type index_type;
+	typedef typename q_node::index_vector index_vector;
 	typedef typename T::point_type point2d;
 	typedef rz_aabb<point2d> aabb2d;
+	typedef rz_line<point2d> line2d;
+	typedef std::pair<index_type, double> neighbour;	// object index and its distance
+	typedef std::vector<neighbour> neighbour_vector;
+	typedef std::pair<index_type, T> object_update;	// object index and its new value
+	typedef std::vector<object_update> update_vector;
 	
 	rz_quadtree(const o_vector& objects_list);
 	rz_quadtree(const o_vector& objects_list, size_t objects_threshold, size_t depth_threshold);
+	rz_quadtree(const o_vector& objects_list, const rz_quadtree_options& options, const Alloc& allocator = Alloc());
 	virtual ~rz_quadtree();
 
-	void get_objects_from_point(const point2d& pt, o_vector& objects);
-	void get_objects_from_aabb(const aabb2d& pt, o_vector& objects);
+	// split cost model measured on this machine: the exact test on objects
+	// against the sample queries, and the node visits of these queries in a
+	// tree of the objects. query_size is the mean side of the queries, use
+	// empty boxes for point queries. the result is enabled
+	static rz_split_cost calibrate_split_cost(const o_vector& objects, const std::vector<aabb2d>& queries);
+
+	// queries are const and don't touch shared state, any number of threads
+	// may query one tree at once as long as nothing updates it. a query
+	// context given explicitly must not be shared between threads.
+	// queries filling vectors clear them first, results never accumulate
+	// over several calls.
+
+	// copies of the objects found, kept for compatibility
+	void get_objects_from_point(const point2d& pt, o_vector& objects, unsigned int flags = RZ_QUERY_DEFAULT) const;
+	void get_objects_from_aabb(const aabb2d& pt, o_vector& objects, unsigned int flags = RZ_QUERY_DEFAULT) const;
+
+	// indices into objects(), no object copies are made. RZ_QUERY_UNIQUE
+	// uses a context of the calling thread (rz_query_scope) unless one is
+	// given.
+	// without RZ_QUERY_EXACT whole contents of the leaves hit are reported
+	void get_indices_from_point(const point2d& pt, index_vector& indices, unsigned int flags = RZ_QUERY_DEFAULT) const;
+	void get_indices_from_aabb(const aabb2d& aabb, index_vector& indices, unsigned int flags = RZ_QUERY_DEFAULT) const;
+	void get_indices_from_aabb(const aabb2d& aabb, index_vector& indices, unsigned int flags, rz_query_context& context) const;
+
+	// batched point location, same results as one query per point. results
+	// of points[i] are [offsets[i], offsets[i + 1]), offsets gets
+	// points.size() + 1 entries. points are processed in z-order and share
+	// the descent with the other points falling into the same cells
+	void get_indices_from_points(const std::vector<point2d>& points, index_vector& indices, std::vector<size_t>& offsets, unsigned int flags = RZ_QUERY_DEFAULT) const;
+	void get_objects_from_points(const std::vector<point2d>& points, o_vector& objects, std::vector<size_t>& offsets, unsigned int flags = RZ_QUERY_DEFAULT) const;
+
+	// batched aabb queries, same results as one query per box, laid out as
+	// for points. with a pool boxes are split into small chunks run as pool
+	// tasks, idle workers steal chunks from busy ones. every chunk writes
+	// to its own buffer, buffers are stitched together at the end
+	void get_indices_from_aabbs(const std::vector<aabb2d>& boxes, index_vector& indices, std::vector<size_t>& offsets, unsigned int flags = RZ_QUERY_DEFAULT, rz_thread_pool* pool = NULL) const;
+	void get_objects_from_aabbs(const std::vector<aabb2d>& boxes, o_vector& objects, std::vector<size_t>& offsets, unsigned int flags = RZ_QUERY_DEFAULT, rz_thread_pool* pool = NULL) const;
+
+	// visitor queries, f(const T& object) is called for every object found
+	// and returns false to stop the traversal. nothing is copied or
+	// allocated. return false if the traversal was stopped by f. f may run
+	// queries of its own, they take the next context of the thread, an
+	// explicit context must not be passed down to them
+	template <typename F> bool query_point(const point2d& pt, F&& f, unsigned int flags = RZ_QUERY_DEFAULT) const;
+	template <typename F> bool query_aabb(const aabb2d& aabb, F&& f, unsigned int flags = RZ_QUERY_DEFAULT) const;
+	template <typename F> bool query_aabb(const aabb2d& aabb, F&& f, unsigned int flags, rz_query_context& context) const;
+
+	// point location, first object that contains the point. meant for
+	// meshes of non-overlapping objects, where it's the only one
+	bool find_object_from_point(const point2d& pt, index_type& index) const;
+
+	// objects hit by the segment, ordered along it starting from line.begin.
+	// only cells crossed by the segment are visited, front to back. needs
+	// intersect_2d(line, object, t) giving the parameter t of the first
+	// contact. query_line calls f(const T& object, double t)
+	void get_objects_from_line(const line2d& line, o_vector& objects) const;
+	void get_indices_from_line(const line2d& line, index_vector& indices) const;
+	template <typename F> bool query_line(const line2d& line, F&& f) const;
+	bool find_object_from_line(const line2d& line, index_type& index) const;
+
+	// k nearest objects, closest first, by distance_2d(object, pt). objects
+	// further than max_distance are ignored, which also prunes the search
+	void nearest(const point2d& pt, size_t k, neighbour_vector& neighbours, double max_distance = MAXF) const;
+	bool nearest(const point2d& pt, index_type& index, double max_distance = MAXF) const;
+
+	// spatial join, f(index_type index, index_type other_index) is called
+	// for every object of this tree intersecting an object of the other
+	// one by intersect_2d(object, other_object). both trees are descended
+	// at once, node pairs with disjoint cells are skipped. joining a tree
+	// with itself reports every pair once, with index < other_index.
+	// the descent gives the leaf pairs, then the pairs of every object are
+	// collected from the leaves holding it, the query context drops those
+	// met again in another leaf. f is called on the calling thread, in the
+	// order of the leaves, and returns false to stop. with a pool
+	// independent subtree pairs are descended in parallel and leaves are
+	// split into chunks, the result and its order are the same. without a
+	// pool f gets the pairs as they are found, with one they are collected
+	// by the tasks first, so stopping only cuts the reporting. trees must
+	// use the same point type
+	template <typename U, typename UAlloc, typename UInstrument, typename F>
+	bool join(const rz_quadtree<U, UAlloc, UInstrument>& other, F&& f, rz_thread_pool* pool = NULL) const;
+
+	const T& object(index_type index) const;
+	const o_vector& objects() const;
+	size_t size() const;
+
+	// dynamic updates, not thread safe. leaves split when they get more
+	// than objects_threshold objects, four leaf siblings merge back when
+	// they hold no more than half of it. the root grows to fit objects
+	// outside of it. indices of removed objects are reused by inserts
+	index_type insert(const T& object);
+	bool remove(index_type index);
+	bool remove(const T& object);
+	bool contains(index_type index) const;
+	size_t count() const;	// objects in the tree, size() includes removed slots
+
+	// leaf references per object, objects crossing cells are stored in
+	// every leaf they touch. see rz_loose_quadtree for a tree without it
+	double replication() const;
+
+	// counts nodes, leaves and memory by walking the whole tree. for
+	// diagnostics, not for hot paths
+	rz_quadtree_stats stats() const;
+
+	// writes every leaf cell with its depth and objects count, to look at
+	// the tree in a gis viewer or a spreadsheet
+	void save_leaves(const std::string& path, rz_leaves_format format = RZ_LEAVES_GEOJSON) const;
+
+	// query counters and latencies collected by the Instrument policy, the
+	// policy is safe to snapshot and reset while queries run. batched point
+	// location and line queries aren't instrumented
+	Instrument& instrumentation() const;
+
+	// moves objects, same thread safety as above. objects staying in the
+	// leaves they're stored in are updated in place, the rest is removed
+	// and reinserted as one batch, grouped by destination subtree. later
+	// updates of the same index in a batch win
+	bool update(index_type index, const T& object);
+	rz_quadtree_update_stats apply_updates(const update_vector& updates);
+	const rz_quadtree_update_stats& update_stats() const;	// totals since construction
+
+	// writes the tree as a binary image (see rz_quadtree_file.hpp), which
+	// rz_mapped_quadtree opens without parsing. T is written as raw bytes
+	void save(const std::string& path) const;
 
 private:
-	void build_tree(const o_vector& objects_list);
-	void build_sub_tree(q_node* node, const o_vector& objects_list, const point2d& box_origin, double box_size, size_t depth);
+	rz_quadtree(const rz_quadtree&);
+	rz_quadtree& operator = (const rz_quadtree&);
+
+	typedef rz_quadtree_node_arena<q_node, Alloc> node_arena;
+	typedef std::vector<index_type, typename std::allocator_traits<Alloc>::template rebind_alloc<index_type> > leaf_buffer;
+	typedef std::vector<float, typename std::allocator_traits<Alloc>::template rebind_alloc<float> > leaf_bounds_buffer;
+
+	// where a build puts nodes and leaf slices, the tree's own arena_ and
+	// leaf_indices_, or those of a parallel build task. tasks are joined
+	// into their parent's target when they're done
+	struct build_target {
+		build_target(node_arena& nodes, leaf_buffer& indices) : arena(nodes), leaves(indices) {
+		}
+
+		node_arena& arena;
+		leaf_buffer& leaves;
+	};
+
+	void build_tree();
+	void build_sub_tree(q_node* node, const index_type* indices, size_t count, size_t depth, build_target& target);
+	void build_children_parallel(q_node* node, const aabb2d* sub_boxes, const index_type* indices, size_t count, size_t depth, build_target& target);
+	void join_sub_targets(q_node* node, build_target** sub_targets, build_target& target);
+	static void offset_leaf_slices(q_node* node, size_t offset);
 	void get_min_max(const o_vector& objects_list, point2d& min, point2d& max);
-	void intersect_objects_with_cell(const o_vector& objects_list, const point2d& box_origin, double box_size, o_vector& intersected_objects_list);
+	void partition_objects(const aabb2d* sub_boxes, const index_type* indices, size_t count, unsigned char* masks, size_t* counts) const;
+	void scatter_objects(const index_type* indices, size_t count, const unsigned char* masks, index_type** offsets) const;
+	aabb2d get_root_box(const point2d& min, const point2d& max) const;
+	point2d get_split(const aabb2d& box, const index_type* indices, size_t count) const;
+	double get_sah_split(double box_min, double box_max, const index_type* indices, size_t count, bool y_axis) const;
+	static void get_sub_boxes(const aabb2d& box, const point2d& split, aabb2d* sub_boxes);
+	static point2d get_node_split(const q_node* node);
+	static void get_children_boxes(const q_node* node, aabb2d* sub_boxes);
+	unsigned int get_object_mask(const aabb2d* sub_boxes, const T& object, const aabb2d& bounds) const;
+	unsigned int get_object_mask(const q_node* node, const T& object, const aabb2d& bounds) const;
+	void count_children(const aabb2d* sub_boxes, const index_type* indices, size_t count, size_t* counts) const;
+	bool split_pays(const aabb2d& box, const aabb2d* sub_boxes, const size_t* counts, size_t count) const;
+	size_t count_nodes(const aabb2d& aabb, const q_node* node) const;
+	bool same_leaves(const q_node* node, const T& old_object, const aabb2d& old_bounds, const T& new_object, const aabb2d& new_bounds) const;
+
+	void grow_root(const aabb2d& bounds);
+	void insert_into_node(q_node* node, const index_type* indices, size_t count, size_t depth);
+	bool remove_from_node(q_node* node, index_type index);
+	void merge_children(q_node* node);
+	static bool boxes_overlap(const aabb2d& a, const aabb2d& b);
+
+	// nodes and leaf slices
+	void create_children(q_node* node, unsigned int mask);
+	bool create_present_children(q_node* node, const aabb2d* sub_boxes, const size_t* counts, node_arena& arena);
+	void destroy_children(q_node* node);
+	q_node* add_child(q_node* node, size_t index);		// leaf in an absent quadrant
+	void remove_child(q_node* node, size_t index);		// node must keep another child
+	const index_type* leaf_begin(const q_node* node) const;
+	void set_leaf_indices(q_node* node, const index_type* indices, size_t count);
+	void set_leaf_indices(q_node* node, const index_type* indices, size_t count, build_target& target);
+	void append_leaf_indices(q_node* node, const index_type* indices, size_t count);
+	void release_leaf_indices(q_node* node);
+	void compact_leaf_indices();
+	void compact_leaf_indices(q_node* node, leaf_buffer& buffer);
+	void resize_leaf_buffers(size_t size);
+	void write_leaf_bounds(size_t position, const index_type* indices, size_t count);
+	void refresh_leaf_bounds(q_node* node, index_type index);
+	size_t filter_leaf(const q_node* node, size_t first, size_t count, const rz_bounds_query& query, uint32_t* positions) const;
+	static const size_t leaf_filter_block = 256;	// leaf entries filtered at once
 	
-	void intersect_tree_with_point(const point2d& pt, o_vector& objects, q_node* node);
-	bool intersect_node_with_point(const point2d& pt, q_node* node);
+	// index visitors, visitor(index_type) returns false to stop
+	template <typename F> bool visit_point(const point2d& pt, unsigned int flags, F& visitor) const;
+	template <typename F> bool visit_aabb(const aabb2d& aabb, unsigned int flags, rz_query_context& context, F& visitor) const;
+
+	template <typename F> void visit_leaves(F& visitor) const;	// visitor(leaf, depth)
+
+	typedef typename Instrument::probe query_probe;
+	template <typename F> bool intersect_tree_with_point(const point2d& pt, const q_node* node, const rz_bounds_query* filter, query_probe& probe, F& visitor) const;
+	void intersect_tree_with_points(const q_node* node, const point2d* points, uint32_t* queries, uint32_t* scratch, unsigned char* children, size_t count,
+		unsigned int flags, index_vector& results, std::vector<std::pair<size_t, size_t> >& ranges) const;
+	bool intersect_node_with_point(const point2d& pt, const q_node* node) const;
 	
-	void intersect_tree_with_aabb(const aabb2d& pt, o_vector& objects, q_node* node);
-	bool intersect_node_with_aabb(const aabb2d& aabb, q_node* node);
+	template <typename F> bool intersect_tree_with_aabb(const aabb2d& aabb, const q_node* node, rz_query_context* unique_context, const rz_bounds_query* filter,
+		query_probe& probe, F& visitor) const;
+
+	typedef std::vector<std::pair<double, index_type> > hit_vector;
+	template <typename F> bool visit_line(const line2d& line, F& visitor) const;
+	template <typename F> bool intersect_tree_with_line(const line2d& line, const q_node* node, double t_out, rz_query_context& context, hit_vector& hits, F& visitor) const;
+	bool intersect_node_with_aabb(const aabb2d& aabb, const q_node* node) const;
+	aabb2d node_box(const q_node* node) const;
+
+	// joins read the nodes and leaves of the other tree
+	template <typename, typename, typename> friend class rz_quadtree;
+
+	typedef std::vector<std::pair<index_type, index_type> > pair_vector;
+	template <typename Other> void split_join_pair(const q_node* node, const typename Other::q_node* other_node, bool self,
+		std::vector<std::pair<const q_node*, const typename Other::q_node*> >& node_pairs) const;
+	template <typename Other> void join_nodes(const q_node* node, const typename Other::q_node* other_node, bool self,
+		std::vector<std::pair<const q_node*, const typename Other::q_node*> >& leaf_pairs) const;
+	template <typename Other, typename E> bool join_object(index_type index, const q_node* leaf, const Other& other, const typename Other::q_node* other_leaf, bool self,
+		rz_query_context& context, E& emit) const;
+
+	o_vector objects_;	// single copy of the objects, nodes refer to it by index
+	std::vector<aabb2d> bounds_;	// objects bounds, same order as objects_
+	std::vector<unsigned char> alive_;	// false for removed objects slots
+	index_vector free_indices_;		// removed objects slots to reuse
+	rz_quadtree_update_stats update_stats_;
 
 	point2d min_;		// actual data min (also used as root node coords origin)
 	point2d max_;		// actual data max
-	double box_size_;	// aligned root node size
 
-	std::auto_ptr<q_node> root_;
+	q_node root_;
+	node_arena arena_;		// every node but the root
+	leaf_buffer leaf_indices_;	// leaf slices one after another
+	leaf_bounds_buffer leaf_min_x_;	// bounds of the objects in leaf_indices_, floats rounded
+	leaf_bounds_buffer leaf_min_y_;	// outwards, for the vectorized bounds filter
+	leaf_bounds_buffer leaf_max_x_;
+	leaf_bounds_buffer leaf_max_y_;
+	size_t leaf_garbage_;		// buffer entries no leaf refers to
+
 	size_t objects_threshold_;
 	size_t depth_threshold_;
+
+	rz_thread_pool* thread_pool_;	// build only
+	size_t parallel_cutoff_;
+	rz_split_cost split_cost_;
+	rz_split_policy split_policy_;
+	bool rectangular_root_;
+
+	mutable Instrument instrumentation_;
 };
 
-template <typename T> inline
-rz_quadtree<T>::rz_quadtree(const o_vector& objects_list) :
-objects_threshold_(10), depth_threshold_(12) {
-	build_tree(objects_list);
+template <typename T, typename Alloc, typename Instrument>
+const size_t rz_quadtree<T, Alloc, Instrument>::leaf_filter_block;
+
+template <typename T, typename Alloc, typename Instrument> inline
+rz_quadtree<T, Alloc, Instrument>::rz_quadtree(const o_vector& objects_list) :
+objects_(objects_list), leaf_garbage_(0), objects_threshold_(10), depth_threshold_(12),
+thread_pool_(NULL), parallel_cutoff_(0), split_policy_(RZ_SPLIT_MIDPOINT), rectangular_root_(false) {
+	build_tree();
+}
+
+template <typename T, typename Alloc, typename Instrument> inline
+rz_quadtree<T, Alloc, Instrument>::rz_quadtree(const o_vector& objects_list, size_t objects_threshold, size_t depth_threshold) :
+objects_(objects_list), leaf_garbage_(0), objects_threshold_(objects_threshold), depth_threshold_(depth_threshold),
+thread_pool_(NULL), parallel_cutoff_(0), split_policy_(RZ_SPLIT_MIDPOINT), rectangular_root_(false) {
+	build_tree();
 }
 
-template <typename T> inline
-rz_quadtree<T>::rz_quadtree(const o_vector& objects_list, size_t objects_threshold, size_t depth_threshold) :
-objects_threshold_(objects_threshold), depth_threshold_(depth_threshold) {
-	build_tree(objects_list);
+template <typename T, typename Alloc, typename Instrument> inline
+rz_quadtree<T, Alloc, Instrument>::rz_quadtree(const o_vector& objects_list, const rz_quadtree_options& options, const Alloc& allocator) :
+objects_(objects_list), arena_(allocator), leaf_indices_(allocator),
+leaf_min_x_(allocator), leaf_min_y_(allocator), leaf_max_x_(allocator), leaf_max_y_(allocator), leaf_garbage_(0), objects_threshold_(options.objects_threshold), depth_threshold_(options.depth_threshold),
+thread_pool_(options.thread_pool), parallel_cutoff_(options.parallel_cutoff), split_cost_(options.split_cost),
+split_policy_(options.split_policy), rectangular_root_(options.rectangular_root) {
+	build_tree();
+	thread_pool_ = NULL;
 }
 	
-template <typename T> inline
-rz_quadtree<T>::~rz_quadtree() {
+template <typename T, typename Alloc, typename Instrument> inline
+rz_quadtree<T, Alloc, Instrument>::~rz_quadtree() {
+}
+
+template <typename T, typename Alloc, typename Instrument> inline const T&
+rz_quadtree<T, Alloc, Instrument>::object(index_type index) const {
+	return objects_[index];
+}
+
+template <typename T, typename Alloc, typename Instrument> inline const typename rz_quadtree<T, Alloc, Instrument>::o_vector&
+rz_quadtree<T, Alloc, Instrument>::objects() const {
+	return objects_;
 }
 
-template <typename T> inline void
-rz_quadtree<T>::get_min_max(const o_vector& objects_list, point2d& min, point2d& max) {
+template <typename T, typename Alloc, typename Instrument> inline size_t
+rz_quadtree<T, Alloc, Instrument>::size() const {
+	return objects_.size();
+}
+
+template <typename T, typename Alloc, typename Instrument> inline void
+rz_quadtree<T, Alloc, Instrument>::save(const std::string& path) const {
+	static_assert(std::is_standard_layout<T>::value, "rz_quadtree::save needs objects of standard layout");
+
+	// flatten nodes breadth first, so children of a node follow each other
+	std::vector<const q_node*> order(1, &root_);
+	std::vector<rz_quadtree_file_node> nodes;
+	index_vector indices;
+
+	for (size_t i = 0; i < order.size(); ++i) {
+		const q_node* node = order[i];
+
+		const aabb2d& box = node->box();
+
+		rz_quadtree_file_node file_node;
+		file_node.min_x = box.min.x;
+		file_node.min_y = box.min.y;
+		file_node.max_x = box.max.x;
+		file_node.max_y = box.max.y;
+		file_node.leaf = node->is_leaf() ? 1 : 0;
+		file_node.children = node->children_mask();
+
+		if (node->is_leaf()) {
+			const index_type* node_indices = leaf_begin(node);
+			file_node.first = (uint32_t)indices.size();
+			file_node.count = (uint32_t)node->count();
+			indices.insert(indices.end(), node_indices, node_indices + node->count());
+		}
+		else {
+			file_node.first = (uint32_t)order.size();
+			file_node.count = 0;
+			for (size_t j = 0; j < node->children_count(); ++j) {
+				order.push_back(node->children() + j);
+			}
+		}
+
+		nodes.push_back(file_node);
+	}
+
+	if (order.size() > (size_t)UINT32_MAX || indices.size() > (size_t)UINT32_MAX) {
+		throw std::runtime_error("rz_quadtree is too big to be saved!");
+	}
+
+	rz_quadtree_file_header header;
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, RZ_QUADTREE_FILE_MAGIC, sizeof(header.magic));
+	header.version = RZ_QUADTREE_FILE_VERSION;
+	header.byte_order = RZ_QUADTREE_FILE_BYTE_ORDER;
+	header.header_size = sizeof(rz_quadtree_file_header);
+	header.node_size = sizeof(rz_quadtree_file_node);
+	header.object_size = sizeof(T);
+	header.bounds_size = sizeof(aabb2d);
+	header.nodes_count = nodes.size();
+	header.indices_count = indices.size();
+	header.objects_count = objects_.size();
+	header.nodes_offset = rz_quadtree_file_align(sizeof(header));
+	header.indices_offset = rz_quadtree_file_align(header.nodes_offset + nodes.size() * sizeof(rz_quadtree_file_node));
+	header.bounds_offset = rz_quadtree_file_align(header.indices_offset + indices.size() * sizeof(index_type));
+	header.objects_offset = rz_quadtree_file_align(header.bounds_offset + bounds_.size() * sizeof(aabb2d));
+	header.file_size = header.objects_offset + objects_.size() * sizeof(T);
+	header.min_x = min_.x;
+	header.min_y = min_.y;
+	header.max_x = max_.x;
+	header.max_y = max_.y;
+	header.objects_threshold = objects_threshold_;
+	header.depth_threshold = depth_threshold_;
+
+	std::ofstream file(path.c_str(), std::ios::out | std::ios::binary | std::ios::trunc);
+	if (!file) {
+		throw std::runtime_error("rz_quadtree can't open file for writing!");
+	}
+
+	const char padding[16] = { 0 };
+	uint64_t offset = 0;
+
+	const char* sections[5] = {
+		(const char*)&header,
+		(const char*)nodes.data(),
+		(const char*)indices.data(),
+		(const char*)bounds_.data(),
+		(const char*)objects_.data()
+	};
+
+	uint64_t sections_offsets[5] = { 0, header.nodes_offset, header.indices_offset, header.bounds_offset, header.objects_offset };
+	uint64_t sections_sizes[5] = {
+		sizeof(header),
+		nodes.size() * sizeof(rz_quadtree_file_node),
+		indices.size() * sizeof(index_type),
+		bounds_.size() * sizeof(aabb2d),
+		objects_.size() * sizeof(T)
+	};
+
+	for (size_t i = 0; i < 5; ++i) {
+		file.write(padding, sections_offsets[i] - offset);
+		if (sections_sizes[i] > 0) {
+			file.write(sections[i], sections_sizes[i]);
+		}
+
+		offset = sections_offsets[i] + sections_sizes[i];
+	}
+
+	file.close();
+	if (!file) {
+		throw std::runtime_error("rz_quadtree failed to write file!");
+	}
+}
+
+template <typename T, typename Alloc, typename Instrument> inline void
+rz_quadtree<T, Alloc, Instrument>::get_min_max(const o_vector& objects_list, point2d& min, point2d& max) {
 	point2d common_min;
 	point2d common_max;
 
@@ -124,240 +615,2474 @@ rz_quadtree<T>::get_min_max(const o_vector& objects_list, point2d& min, point2d&
 	max = common_max;
 }
 
-template <typename T> inline void
-rz_quadtree<T>::build_tree(const o_vector& objects_list) {
+template <typename T, typename Alloc, typename Instrument> inline void
+rz_quadtree<T, Alloc, Instrument>::build_tree() {
+	if (objects_.size() > (size_t)UINT32_MAX) {
+		throw std::runtime_error("rz_quadtree can't index more than 2^32 - 1 objects!");
+	}
+
 	// calc objects min/max
-	get_min_max(objects_list, min_, max_);
+	get_min_max(objects_, min_, max_);
 
-	// calc max align size
-	double size_x = fabs(max_.x - min_.x);
-	double size_y = fabs(max_.y - min_.y);
+	// cache objects bounds and make root node refer to every object
+	bounds_.resize(objects_.size());
+	alive_.assign(objects_.size(), 1);
+	index_vector indices(objects_.size());
 
-	if (size_x > size_y) {
-		box_size_ = size_x;
-	}
-	else {
-		box_size_ = size_y;
+	for (size_t i = 0; i < objects_.size(); ++i) {
+		bounds_[i] = aabb2d(min_2d(objects_[i]), max_2d(objects_[i]));
+		indices[i] = (index_type)i;
 	}
 
-	// build tree!
-	root_.reset(new rz_quadtree_node<T>());
-	root_->set_parent(NULL);
-	root_->set_dimentions(min_, box_size_);
+	// build tree! most objects end up in a single leaf
+	leaf_indices_.reserve(objects_.size());
+	leaf_min_x_.reserve(objects_.size());
+	leaf_min_y_.reserve(objects_.size());
+	leaf_max_x_.reserve(objects_.size());
+	leaf_max_y_.reserve(objects_.size());
+
+	root_.set_box(get_root_box(min_, max_));
+
+	build_target target(arena_, leaf_indices_);
+	build_sub_tree(&root_, indices.data(), indices.size(), 0, target);
+}
+
+template <typename T, typename Alloc, typename Instrument> inline typename rz_quadtree<T, Alloc, Instrument>::aabb2d
+rz_quadtree<T, Alloc, Instrument>::get_root_box(const point2d& min, const point2d& max) const {
+	// the data box, or a square of its longer side. a flat side takes the
+	// length of the other one, a single point gets a unit cell
+	double size_x = fabs(max.x - min.x);
+	double size_y = fabs(max.y - min.y);
+
+	if (!rectangular_root_ || size_x <= 0.0 || size_y <= 0.0) {
+		double size = fmax(size_x, size_y) > 0.0 ? fmax(size_x, size_y) : 1.0;
+		size_x = size;
+		size_y = size;
+	}
 
-	build_sub_tree(root_.get(), objects_list, min_, box_size_, 0);
+	// the data max itself where it's the cell edge, min + size may round below it
+	point2d box_max(size_x == fabs(max.x - min.x) ? max.x : min.x + size_x, size_y == fabs(max.y - min.y) ? max.y : min.y + size_y);
+	return aabb2d(min, box_max);
 }
 
-template <typename T> inline void
-rz_quadtree<T>::build_sub_tree(q_node* node, const o_vector& objects_list, const point2d& box_origin, double box_size, size_t depth) {
+template <typename T, typename Alloc, typename Instrument> inline void
+rz_quadtree<T, Alloc, Instrument>::build_sub_tree(q_node* node, const index_type* indices, size_t count, size_t depth, build_target& target) {
 	if (!node) {
 		throw std::runtime_error("rz_quadtree build_sub_tree received null node!");
 	}
 
 	// check whether node box intersects with actual data
-	point2d box_max(box_origin.x + box_size, box_origin.y + box_size);
-	aabb2d cell_box(box_origin, box_max);
+	const aabb2d& cell_box = node->box();
 	aabb2d data_box(min_, max_);
 
-	if (false == intersect_2d(cell_box, data_box)) {
+	if (count == 0 || false == boxes_overlap(cell_box, data_box)) {
 		node->set_leaf(true);
 		return;
 	}
 
-	// store objects
-	o_vector& node_obj_list = node->objects_list();
-	node_obj_list.assign(objects_list.begin(), objects_list.end());
+	// check thresholds, only leaves store object indices
+	bool leaf = count <= objects_threshold_ || depth >= depth_threshold_;
 
-	// check thresholds
-	if (objects_list.size() <= objects_threshold_ ) {
+	aabb2d sub_boxes[4];
+	if (!leaf) {
+		get_sub_boxes(cell_box, get_split(cell_box, indices, count), sub_boxes);
+	}
+
+	// adaptive splits follow the objects down to their own size, where
+	// most of them cross the split lines and would be copied to every child
+	if (!leaf && (split_policy_ != RZ_SPLIT_MIDPOINT || split_cost_.enabled)) {
+		size_t counts[4];
+		count_children(sub_boxes, indices, count, counts);
+
+		leaf = (split_policy_ != RZ_SPLIT_MIDPOINT && counts[0] + counts[1] + counts[2] + counts[3] > RZ_SPLIT_REPLICATION_LIMIT * count) ||
+			(split_cost_.enabled && !split_pays(cell_box, sub_boxes, counts, count));
+	}
+
+	if (leaf) {
+		set_leaf_indices(node, indices, count, target);
 		node->set_leaf(true);
 		return;
 	}
 
-	if (depth >= depth_threshold_) {
+	if (thread_pool_ && count >= parallel_cutoff_) {
+		build_children_parallel(node, sub_boxes, indices, count, depth, target);
+		return;
+	}
+
+	// one pass over objects computes which children each of them goes to
+	std::vector<unsigned char> masks(count);
+	size_t counts[4] = { 0, 0, 0, 0 };
+	partition_objects(sub_boxes, indices, count, masks.data(), counts);
+
+	// children lists are consecutive slices of one buffer
+	index_type* offsets[4];
+	index_vector sub_indices(counts[0] + counts[1] + counts[2] + counts[3]);
+
+	offsets[0] = sub_indices.data();
+	for (size_t i = 1; i < 4; ++i) {
+		offsets[i] = offsets[i - 1] + counts[i - 1];
+	}
+
+	scatter_objects(indices, count, masks.data(), offsets);
+
+	if (!create_present_children(node, sub_boxes, counts, target.arena)) {
+		set_leaf_indices(node, indices, count, target);
 		node->set_leaf(true);
 		return;
 	}
 
-	// create children nodes
-	node->create_children();
+	index_type* sub_first = sub_indices.data();
+	for (size_t i = 0; i < 4; ++i) {
+		if (counts[i] > 0) {
+			build_sub_tree(node->child(i), sub_first, counts[i], depth + 1, target);
+		}
+
+		sub_first += counts[i];
+	}
+}
+
+template <typename T, typename Alloc, typename Instrument> inline typename rz_quadtree<T, Alloc, Instrument>::point2d
+rz_quadtree<T, Alloc, Instrument>::get_split(const aabb2d& box, const index_type* indices, size_t count) const {
+	point2d middle((box.min.x + box.max.x) / 2.0, (box.min.y + box.max.y) / 2.0);
+	point2d split = middle;
+
+	if (split_policy_ == RZ_SPLIT_MEDIAN) {
+		std::vector<double> centers(count);
+
+		for (size_t i = 0; i < count; ++i) {
+			centers[i] = bounds_[indices[i]].min.x + bounds_[indices[i]].max.x;
+		}
+
+		std::nth_element(centers.begin(), centers.begin() + count / 2, centers.end());
+		split.x = centers[count / 2] / 2.0;
 
-	double sub_box_size = box_size / 2.0;
+		for (size_t i = 0; i < count; ++i) {
+			centers[i] = bounds_[indices[i]].min.y + bounds_[indices[i]].max.y;
+		}
 
-	o_vector intersected_objects_list;
-	q_node* sub_node = NULL;
+		std::nth_element(centers.begin(), centers.begin() + count / 2, centers.end());
+		split.y = centers[count / 2] / 2.0;
+	}
+	else if (split_policy_ == RZ_SPLIT_SAH) {
+		split.x = get_sah_split(box.min.x, box.max.x, indices, count, false);
+		split.y = get_sah_split(box.min.y, box.max.y, indices, count, true);
+	}
 
-	// sub-box A
-	point2d sub_box_origin_a(box_origin.x, box_origin.y + sub_box_size);
-	intersect_objects_with_cell(objects_list, sub_box_origin_a, sub_box_size, intersected_objects_list);
-	sub_node = node->child_a();
-	sub_node->set_parent(node);
-	sub_node->set_dimentions(sub_box_origin_a, sub_box_size);
-	build_sub_tree(sub_node, intersected_objects_list, sub_box_origin_a, sub_box_size, depth + 1);
+	// children without area only catch objects lying on the cell border
+	if (!(split.x > box.min.x && split.x < box.max.x)) {
+		split.x = middle.x;
+	}
 
-	// sub-box B
-	point2d sub_box_origin_b(box_origin.x + sub_box_size, box_origin.y + sub_box_size);
-	intersect_objects_with_cell(objects_list, sub_box_origin_b, sub_box_size, intersected_objects_list);
-	sub_node = node->child_b();
-	sub_node->set_parent(node);
-	sub_node->set_dimentions(sub_box_origin_b, sub_box_size);
-	build_sub_tree(sub_node, intersected_objects_list, sub_box_origin_b, sub_box_size, depth + 1);
+	if (!(split.y > box.min.y && split.y < box.max.y)) {
+		split.y = middle.y;
+	}
 
-	// sub-box C
-	point2d sub_box_origin_c(box_origin.x, box_origin.y);
-	intersect_objects_with_cell(objects_list, sub_box_origin_c, sub_box_size, intersected_objects_list);
-	sub_node = node->child_c();
-	sub_node->set_parent(node);
-	sub_node->set_dimentions(sub_box_origin_c, sub_box_size);
-	build_sub_tree(sub_node, intersected_objects_list, sub_box_origin_c, sub_box_size, depth + 1);
+	// a long cell is only cut across, its short side would soon get
+	// smaller than the objects. the children along the border are flat
+	// and left out, see get_object_mask
+	if (box.width() > 2.0 * box.height()) {
+		split.y = box.min.y;
+	}
+	else if (box.height() > 2.0 * box.width()) {
+		split.x = box.min.x;
+	}
 
-	// sub-box D
-	point2d sub_box_origin_d(box_origin.x + sub_box_size, box_origin.y);
-	intersect_objects_with_cell(objects_list, sub_box_origin_d, sub_box_size, intersected_objects_list);
-	sub_node = node->child_d();
-	sub_node->set_parent(node);
-	sub_node->set_dimentions(sub_box_origin_d, sub_box_size);
-	build_sub_tree(sub_node, intersected_objects_list, sub_box_origin_d, sub_box_size, depth + 1);
+	return split;
 }
 
-template <typename T> inline void
-rz_quadtree<T>::intersect_objects_with_cell(const o_vector& objects_list, const point2d& box_origin, double box_size, o_vector& intersected_objects_list) {
-	point2d box_max(box_origin.x + box_size, box_origin.y + box_size);
-	aabb2d cell_box(box_origin, box_max);
+template <typename T, typename Alloc, typename Instrument> inline double
+rz_quadtree<T, Alloc, Instrument>::get_sah_split(double box_min, double box_max, const index_type* indices, size_t count, bool y_axis) const {
+	// a query of side q spread over the cell reaches the part left of s
+	// with probability (s - box_min + q) / (box_max - box_min + q), which
+	// is weighted by the objects touching that part. split positions are
+	// bin edges, objects are binned by their bounds
+	const size_t bins = 32;
+	size_t min_bins[bins] = { 0 };
+	size_t max_bins[bins] = { 0 };
 
-	intersected_objects_list.clear();
+	double width = box_max - box_min;
+	double scale = width > 0.0 ? bins / width : 0.0;
 
-	for (size_t i = 0; i < objects_list.size(); ++i) {
-		if (intersect_2d(cell_box, objects_list[i])) {
-			intersected_objects_list.push_back(objects_list[i]);
+	for (size_t i = 0; i < count; ++i) {
+		const aabb2d& bounds = bounds_[indices[i]];
+		double low = y_axis ? bounds.min.y : bounds.min.x;
+		double high = y_axis ? bounds.max.y : bounds.max.x;
+
+		min_bins[(size_t)std::min(std::max((low - box_min) * scale, 0.0), bins - 1.0)]++;
+		max_bins[(size_t)std::min(std::max((high - box_min) * scale, 0.0), bins - 1.0)]++;
+	}
+
+	// objects starting left of edge k and ending right of it
+	size_t left[bins];
+	size_t right[bins];
+	left[0] = 0;
+	right[bins - 1] = max_bins[bins - 1];
+
+	for (size_t k = 1; k < bins; ++k) {
+		left[k] = left[k - 1] + min_bins[k - 1];
+		right[bins - 1 - k] = right[bins - k] + max_bins[bins - 1 - k];
+	}
+
+	// ties keep the middle
+	double q = split_cost_.query_size;
+	size_t best = bins / 2;
+	double best_cost = MAXF;
+
+	for (size_t n = 0; n < bins - 1; ++n) {
+		size_t k = (n % 2) ? bins / 2 - (n + 1) / 2 : bins / 2 + n / 2;
+		double s = box_min + k * width / bins;
+		double cost = (s - box_min + q) * left[k] + (box_max - s + q) * right[k];
+
+		if (cost < best_cost) {
+			best_cost = cost;
+			best = k;
 		}
 	}
+
+	return box_min + best * width / bins;
 }
 
-template <typename T> inline void
-rz_quadtree<T>::get_objects_from_point(const point2d& pt, o_vector& objects) {
-	intersect_tree_with_point(pt, objects, root_.get());
+template <typename T, typename Alloc, typename Instrument> inline void
+rz_quadtree<T, Alloc, Instrument>::get_sub_boxes(const aabb2d& box, const point2d& split, aabb2d* sub_boxes) {
+	sub_boxes[0] = aabb2d(point2d(box.min.x, split.y), point2d(split.x, box.max.y));	// sub-box A
+	sub_boxes[1] = aabb2d(point2d(split.x, split.y), point2d(box.max.x, box.max.y));	// sub-box B
+	sub_boxes[2] = aabb2d(point2d(box.min.x, box.min.y), point2d(split.x, split.y));	// sub-box C
+	sub_boxes[3] = aabb2d(point2d(split.x, box.min.y), point2d(box.max.x, split.y));	// sub-box D
 }
 
-template <typename T> inline void
-rz_quadtree<T>::get_objects_from_aabb(const aabb2d& aabb, o_vector& objects) {
-	intersect_tree_with_aabb(aabb, objects, root_.get());
+template <typename T, typename Alloc, typename Instrument> inline void
+rz_quadtree<T, Alloc, Instrument>::get_children_boxes(const q_node* node, aabb2d* sub_boxes) {
+	get_sub_boxes(node->box(), get_node_split(node), sub_boxes);
 }
 
-template <typename T> inline void
-rz_quadtree<T>::intersect_tree_with_point(const point2d& pt, o_vector& objects, q_node* node) {
-	if (!node) {
-		throw std::runtime_error("rz_quadtree get_objects_from_point received null node!");
-	}
+template <typename T, typename Alloc, typename Instrument> inline typename rz_quadtree<T, Alloc, Instrument>::point2d
+rz_quadtree<T, Alloc, Instrument>::get_node_split(const q_node* node) {
+	// split point is the inner corner of any child, internal nodes have one
+	const aabb2d& box = node->children()->box();
 
-	// check wether we hit actual data bbox
-	aabb2d box(min_, max_);
-	if (false == intersect_2d(box, pt)) {
-		return;
+	switch (children_mask_first(node->children_mask())) {
+	case 0:
+		return point2d(box.max.x, box.min.y);	// A
+	case 1:
+		return box.min;				// B
+	case 2:
+		return box.max;				// C
+	default:
+		return point2d(box.min.x, box.max.y);	// D
 	}
+}
 
-	// intersect with currect node
-	if (intersect_node_with_point(pt, node)) {
-		if (node->is_leaf()) {
-			o_vector& node_objects = node->objects_list();
-			objects.assign(node_objects.begin(), node_objects.end());
-			return;
+template <typename T, typename Alloc, typename Instrument> inline unsigned int
+rz_quadtree<T, Alloc, Instrument>::get_object_mask(const aabb2d* sub_boxes, const T& object, const aabb2d& bounds) const {
+	// sub-boxes share the split lines, A and B are on top, A and C on the left
+	double mid_x = sub_boxes[0].max.x;
+	double mid_y = sub_boxes[0].min.y;
+
+	// cheap rejection, children which bounds don't even touch
+	bool left = bounds.min.x <= mid_x;
+	bool right = bounds.max.x >= mid_x;
+	bool bottom = bounds.min.y <= mid_y;
+	bool top = bounds.max.y >= mid_y;
+
+	unsigned int mask = (top && left ? 1 : 0) | (top && right ? 2 : 0) | (bottom && left ? 4 : 0) | (bottom && right ? 8 : 0);
+
+	// children without area, left by a cut across a long cell, aren't
+	// created. what touches them touches the full child next to them too
+	for (size_t j = 0; j < 4; ++j) {
+		if (false == (sub_boxes[j].width() > 0.0 && sub_boxes[j].height() > 0.0)) {
+			mask &= ~(1 << j);
 		}
-		else {
-			if (intersect_node_with_point(pt, node->child_a())) {
-				intersect_tree_with_point(pt, objects, node->child_a());
-				return;
-			}
+	}
 
-			if (intersect_node_with_point(pt, node->child_b())) {
-				intersect_tree_with_point(pt, objects, node->child_b());
-				return;
-			}
+	// bounds strictly inside one sub-box, otherwise exact test for every candidate
+	bool inside = false;
+	if (mask == 1 || mask == 2 || mask == 4 || mask == 8) {
+		const aabb2d& box = sub_boxes[mask == 1 ? 0 : (mask == 2 ? 1 : (mask == 4 ? 2 : 3))];
+		inside = bounds.min.x > box.min.x && bounds.max.x < box.max.x && bounds.min.y > box.min.y && bounds.max.y < box.max.y;
+	}
 
-			if (intersect_node_with_point(pt, node->child_c())) {
-				intersect_tree_with_point(pt, objects, node->child_c());
-				return;
+	if (!inside) {
+		for (size_t j = 0; j < 4; ++j) {
+			if ((mask & (1 << j)) && false == intersect_2d(sub_boxes[j], object)) {
+				mask &= ~(1 << j);
 			}
+		}
+	}
 
-			if (intersect_node_with_point(pt, node->child_d())) {
-				intersect_tree_with_point(pt, objects, node->child_d());
-				return;
-			}
+	return mask;
+}
+
+template <typename T, typename Alloc, typename Instrument> inline unsigned int
+rz_quadtree<T, Alloc, Instrument>::get_object_mask(const q_node* node, const T& object, const aabb2d& bounds) const {
+	aabb2d sub_boxes[4];
+	get_children_boxes(node, sub_boxes);
+
+	return get_object_mask(sub_boxes, object, bounds);
+}
+
+template <typename T, typename Alloc, typename Instrument> inline bool
+rz_quadtree<T, Alloc, Instrument>::same_leaves(const q_node* node, const T& old_object, const aabb2d& old_bounds, const T& new_object, const aabb2d& new_bounds) const {
+	if (node->is_leaf()) {
+		return true;
+	}
+
+	// new object takes the same path as long as it picks the same children
+	unsigned int mask = get_object_mask(node, old_object, old_bounds);
+	if (mask != get_object_mask(node, new_object, new_bounds)) {
+		return false;
+	}
+
+	for (size_t i = 0; i < 4; ++i) {
+		if ((mask & (1 << i)) && (!node->has_child(i) || false == same_leaves(node->child(i), old_object, old_bounds, new_object, new_bounds))) {
+			return false;
 		}
 	}
-	else {
+
+	return true;
+}
+
+template <typename T, typename Alloc, typename Instrument> inline bool
+rz_quadtree<T, Alloc, Instrument>::boxes_overlap(const aabb2d& a, const aabb2d& b) {
+	// closed boxes, touching counts
+	return !(a.max.x < b.min.x || a.min.x > b.max.x || a.max.y < b.min.y || a.min.y > b.max.y);
+}
+
+template <typename T, typename Alloc, typename Instrument> inline void
+rz_quadtree<T, Alloc, Instrument>::build_children_parallel(q_node* node, const aabb2d* sub_boxes, const index_type* indices, size_t count, size_t depth,
+	build_target& target) {
+	// split objects into chunks, each chunk is partitioned by its own task
+	size_t chunk_size = parallel_cutoff_ > 0 ? parallel_cutoff_ : 1;
+	size_t max_chunks = 4 * (thread_pool_->size() + 1);
+
+	if (count / chunk_size > max_chunks) {
+		chunk_size = (count + max_chunks - 1) / max_chunks;
+	}
+
+	size_t chunks_count = (count + chunk_size - 1) / chunk_size;
+	std::vector<unsigned char> masks(count);
+	std::vector<size_t> chunks_counts(chunks_count * 4, 0);
+
+	rz_task_group partition_group(*thread_pool_);
+
+	for (size_t chunk = 0; chunk < chunks_count; ++chunk) {
+		partition_group.run([&, chunk]() {
+			size_t first = chunk * chunk_size;
+			size_t last = std::min(first + chunk_size, count);
+			partition_objects(sub_boxes, indices + first, last - first, masks.data() + first, &chunks_counts[chunk * 4]);
+		});
+	}
+
+	partition_group.wait();
+
+	// chunk slices follow each other inside every child slice, so children
+	// get the same lists as in sequential build
+	index_vector sub_indices;
+	std::vector<index_type*> chunks_offsets(chunks_count * 4);
+	index_type* sub_firsts[4];
+	size_t sub_counts[4] = { 0, 0, 0, 0 };
+
+	for (size_t i = 0; i < 4; ++i) {
+		for (size_t chunk = 0; chunk < chunks_count; ++chunk) {
+			sub_counts[i] += chunks_counts[chunk * 4 + i];
+		}
+	}
+
+	sub_indices.resize(sub_counts[0] + sub_counts[1] + sub_counts[2] + sub_counts[3]);
+	index_type* offset = sub_indices.data();
+
+	for (size_t i = 0; i < 4; ++i) {
+		sub_firsts[i] = offset;
+		for (size_t chunk = 0; chunk < chunks_count; ++chunk) {
+			chunks_offsets[chunk * 4 + i] = offset;
+			offset += chunks_counts[chunk * 4 + i];
+		}
+	}
+
+	rz_task_group scatter_group(*thread_pool_);
+
+	for (size_t chunk = 0; chunk < chunks_count; ++chunk) {
+		scatter_group.run([&, chunk]() {
+			size_t first = chunk * chunk_size;
+			size_t last = std::min(first + chunk_size, count);
+			scatter_objects(indices + first, last - first, masks.data() + first, &chunks_offsets[chunk * 4]);
+		});
+	}
+
+	scatter_group.wait();
+
+	if (!create_present_children(node, sub_boxes, sub_counts, target.arena)) {
+		set_leaf_indices(node, indices, count, target);
+		node->set_leaf(true);
 		return;
 	}
+
+	// every child is built into nodes and leaf slices of its own, so the
+	// tasks share nothing but the objects
+	std::unique_ptr<node_arena> sub_arenas[4];
+	std::unique_ptr<leaf_buffer> sub_leaves[4];
+	std::unique_ptr<build_target> sub_targets[4];
+
+	rz_task_group children_group(*thread_pool_);
+
+	for (size_t i = 0; i < 4; ++i) {
+		if (sub_counts[i] == 0) {
+			continue;
+		}
+
+		sub_arenas[i].reset(new node_arena(Alloc(target.arena.get_allocator())));
+		sub_leaves[i].reset(new leaf_buffer(target.leaves.get_allocator()));
+		sub_targets[i].reset(new build_target(*sub_arenas[i], *sub_leaves[i]));
+
+		q_node* sub_node = node->child(i);
+		build_target* sub_target = sub_targets[i].get();
+
+		children_group.run([&, i, sub_node, sub_target]() {
+			build_sub_tree(sub_node, sub_firsts[i], sub_counts[i], depth + 1, *sub_target);
+		});
+	}
+
+	children_group.wait();
+
+	build_target* joined[4];
+	for (size_t i = 0; i < 4; ++i) {
+		joined[i] = sub_targets[i].get();
+	}
+
+	join_sub_targets(node, joined, target);
 }
 
-template <typename T> inline void
-rz_quadtree<T>::intersect_tree_with_aabb(const aabb2d& aabb, o_vector& objects, q_node* node) {
-	if (!node) {
-		throw std::runtime_error("rz_quadtree get_objects_from_aabb received null node!");
+template <typename T, typename Alloc, typename Instrument> inline void
+rz_quadtree<T, Alloc, Instrument>::join_sub_targets(q_node* node, build_target** sub_targets, build_target& target) {
+	// children slices go to the end of the target's buffer one after
+	// another, each child's part is copied by a task of its own
+	size_t firsts[4];
+	size_t size = target.leaves.size();
+
+	for (size_t i = 0; i < 4; ++i) {
+		firsts[i] = size;
+		size += sub_targets[i] ? sub_targets[i]->leaves.size() : 0;
 	}
-	
-	// check wether we hit actual data bbox
-	aabb2d box(min_, max_);
-	if (false == intersect_2d(box, aabb)) {
-		return;
+
+	// bounds are written once the slices reach the tree's buffer
+	bool tree_leaves = &target.leaves == &leaf_indices_;
+
+	if (tree_leaves) {
+		resize_leaf_buffers(size);
 	}
-	
-	// intersect with currect node
-	if (intersect_node_with_aabb(aabb, node)) {
-		if (node->is_leaf()) {
-			o_vector& node_objects = node->objects_list();
-			objects.insert(objects.end(), node_objects.begin(), node_objects.end());
-			return;
+	else {
+		target.leaves.resize(size);
+	}
+
+	rz_task_group join_group(*thread_pool_);
+
+	for (size_t i = 0; i < 4; ++i) {
+		if (!sub_targets[i]) {
+			continue;
 		}
-		else {
-			if (intersect_node_with_aabb(aabb, node->child_a())) {
-				intersect_tree_with_aabb(aabb, objects, node->child_a());
-			}
-			
-			if (intersect_node_with_aabb(aabb, node->child_b())) {
-				intersect_tree_with_aabb(aabb, objects, node->child_b());
-			}
-			
-			if (intersect_node_with_aabb(aabb, node->child_c())) {
-				intersect_tree_with_aabb(aabb, objects, node->child_c());
-			}
-			
-			if (intersect_node_with_aabb(aabb, node->child_d())) {
-				intersect_tree_with_aabb(aabb, objects, node->child_d());
+
+		q_node* sub_node = node->child(i);
+		join_group.run([&, i, sub_node]() {
+			const leaf_buffer& leaves = sub_targets[i]->leaves;
+
+			std::copy(leaves.begin(), leaves.end(), target.leaves.begin() + firsts[i]);
+			if (tree_leaves) {
+				write_leaf_bounds(firsts[i], leaves.data(), leaves.size());
 			}
+
+			offset_leaf_slices(sub_node, firsts[i]);
+		});
+	}
+
+	join_group.wait();
+
+	// nodes stay where the tasks allocated them
+	for (size_t i = 0; i < 4; ++i) {
+		if (sub_targets[i]) {
+			target.arena.splice(sub_targets[i]->arena);
 		}
 	}
-	else {
+}
+
+template <typename T, typename Alloc, typename Instrument> inline void
+rz_quadtree<T, Alloc, Instrument>::offset_leaf_slices(q_node* node, size_t offset) {
+	if (node->is_leaf()) {
+		node->set_slice(node->first() + offset, node->count(), node->capacity());
 		return;
 	}
-}
-	
-template <typename T> inline bool
-rz_quadtree<T>::intersect_node_with_point(const point2d& pt, q_node* node) {
-	if (!node) {
-		throw std::runtime_error("rz_quadtree intersect_node_with_point received null node!");
+
+	for (size_t i = 0; i < node->children_count(); ++i) {
+		offset_leaf_slices(node->children() + i, offset);
 	}
+}
+
+template <typename T, typename Alloc, typename Instrument> inline void
+rz_quadtree<T, Alloc, Instrument>::count_children(const aabb2d* sub_boxes, const index_type* indices, size_t count, size_t* counts) const {
+	// from the bounds only, a bit above the exact counts for objects near
+	// the split lines, but a fraction of the partition cost
+	double split_x = sub_boxes[0].max.x;
+	double split_y = sub_boxes[0].min.y;
+	std::fill(counts, counts + 4, 0);
 
-	point2d origin;
-	double size;
-	node->get_dimentions(origin, size);
+	for (size_t i = 0; i < count; ++i) {
+		const aabb2d& bounds = bounds_[indices[i]];
+		bool left = bounds.min.x <= split_x;
+		bool right = bounds.max.x >= split_x;
+		bool bottom = bounds.min.y <= split_y;
+		bool top = bounds.max.y >= split_y;
+
+		counts[0] += (top && left) ? 1 : 0;
+		counts[1] += (top && right) ? 1 : 0;
+		counts[2] += (bottom && left) ? 1 : 0;
+		counts[3] += (bottom && right) ? 1 : 0;
+	}
 
-	aabb2d box(origin, point2d(origin.x + size, origin.y + size));
-	return intersect_2d(box, pt);
+	// children without area aren't created
+	for (size_t j = 0; j < 4; ++j) {
+		if (false == (sub_boxes[j].width() > 0.0 && sub_boxes[j].height() > 0.0)) {
+			counts[j] = 0;
+		}
+	}
 }
 
-template <typename T> inline bool
-rz_quadtree<T>::intersect_node_with_aabb(const aabb2d& aabb, q_node* node) {
-	if (!node) {
-		throw std::runtime_error("rz_quadtree intersect_node_with_aabb received null node!");
+template <typename T, typename Alloc, typename Instrument> inline bool
+rz_quadtree<T, Alloc, Instrument>::split_pays(const aabb2d& box, const aabb2d* sub_boxes, const size_t* counts, size_t count) const {
+	double q = split_cost_.query_size;
+	double reach_area = (box.width() + q) * (box.height() + q);
+
+	double leaf_cost = count * split_cost_.test_cost;
+	double split_cost = 0.0;
+
+	for (size_t i = 0; i < 4; ++i) {
+		double reach = reach_area > 0.0 ? (sub_boxes[i].width() + q) * (sub_boxes[i].height() + q) / reach_area : 1.0;
+		split_cost += reach * (split_cost_.node_cost + counts[i] * split_cost_.test_cost);
 	}
-	
-	point2d origin;
-	double size;
-	node->get_dimentions(origin, size);
-	
-	aabb2d box(origin, point2d(origin.x + size, origin.y + size));
-	return intersect_2d(box, aabb);
+
+	return split_cost < leaf_cost;
+}
+
+template <typename T, typename Alloc, typename Instrument> inline size_t
+rz_quadtree<T, Alloc, Instrument>::count_nodes(const aabb2d& aabb, const q_node* node) const {
+	size_t visited = 1;
+
+	if (!node->is_leaf()) {
+		for (size_t i = 0; i < node->children_count(); ++i) {
+			if (intersect_node_with_aabb(aabb, node->children() + i)) {
+				visited += count_nodes(aabb, node->children() + i);
+			}
+		}
+	}
+
+	return visited;
+}
+
+template <typename T, typename Alloc, typename Instrument> inline rz_split_cost
+rz_quadtree<T, Alloc, Instrument>::calibrate_split_cost(const o_vector& objects, const std::vector<aabb2d>& queries) {
+	typedef std::chrono::steady_clock clock;
+
+	rz_split_cost cost;
+	cost.enabled = true;
+
+	if (objects.empty() || queries.empty()) {
+		return cost;
+	}
+
+	double query_size = 0.0;
+	for (size_t i = 0; i < queries.size(); ++i) {
+		query_size += (queries[i].width() + queries[i].height()) / 2.0;
+	}
+
+	cost.query_size = query_size / queries.size();
+
+	// exact tests, objects picked by a multiplicative hash to defeat caching
+	const size_t tests = 1 << 16;
+	size_t hits = 0;
+
+	clock::time_point start = clock::now();
+
+	for (size_t i = 0; i < tests; ++i) {
+		const aabb2d& query = queries[i % queries.size()];
+		const T& object = objects[(size_t)((i * 2654435761u) % objects.size())];
+		hits += (boxes_overlap(query, aabb2d(min_2d(object), max_2d(object))) && intersect_2d(query, object)) ? 1 : 0;
+	}
+
+	double test_seconds = std::chrono::duration<double>(clock::now() - start).count();
+
+	// stored where the optimizer can't drop it, so the tests stay in
+	volatile size_t hits_sink = hits;
+	(void)hits_sink;
+
+	// node visits of the queries in a tree of up to 64k of the objects, split finely
+	o_vector sample;
+	size_t step = objects.size() / 65536 + 1;
+
+	for (size_t i = 0; i < objects.size(); i += step) {
+		sample.push_back(objects[i]);
+	}
+
+	rz_quadtree tree(sample, 1, 10);
+	size_t visited = 0;
+
+	start = clock::now();
+
+	for (size_t round = 0; round * queries.size() < tests; ++round) {
+		for (size_t i = 0; i < queries.size(); ++i) {
+			if (boxes_overlap(aabb2d(tree.min_, tree.max_), queries[i]) && tree.intersect_node_with_aabb(queries[i], &tree.root_)) {
+				visited += tree.count_nodes(queries[i], &tree.root_);
+			}
+		}
+	}
+
+	double node_seconds = std::chrono::duration<double>(clock::now() - start).count();
+
+	// nanoseconds
+	cost.test_cost = std::max(test_seconds * 1e9 / tests, 1e-3);
+	cost.node_cost = visited > 0 ? std::max(node_seconds * 1e9 / visited, 1e-3) : 4.0 * cost.test_cost;
+
+	return cost;
+}
+
+template <typename T, typename Alloc, typename Instrument> inline void
+rz_quadtree<T, Alloc, Instrument>::partition_objects(const aabb2d* sub_boxes, const index_type* indices, size_t count, unsigned char* masks, size_t* counts) const {
+	for (size_t i = 0; i < count; ++i) {
+		unsigned int mask = get_object_mask(sub_boxes, objects_[indices[i]], bounds_[indices[i]]);
+
+		masks[i] = (unsigned char)mask;
+
+		for (size_t j = 0; j < 4; ++j) {
+			counts[j] += (mask >> j) & 1;
+		}
+	}
+}
+
+template <typename T, typename Alloc, typename Instrument> inline void
+rz_quadtree<T, Alloc, Instrument>::scatter_objects(const index_type* indices, size_t count, const unsigned char* masks, index_type** offsets) const {
+	for (size_t i = 0; i < count; ++i) {
+		for (size_t j = 0; j < 4; ++j) {
+			if (masks[i] & (1 << j)) {
+				*offsets[j]++ = indices[i];
+			}
+		}
+	}
+}
+
+template <typename T, typename Alloc, typename Instrument> inline bool
+rz_quadtree<T, Alloc, Instrument>::contains(index_type index) const {
+	return index < alive_.size() && alive_[index];
+}
+
+template <typename T, typename Alloc, typename Instrument> inline size_t
+rz_quadtree<T, Alloc, Instrument>::count() const {
+	return objects_.size() - free_indices_.size();
+}
+
+template <typename T, typename Alloc, typename Instrument> inline double
+rz_quadtree<T, Alloc, Instrument>::replication() const {
+	if (count() == 0) {
+		return 0.0;
+	}
+
+	size_t references = 0;
+	std::vector<const q_node*> nodes(1, &root_);
+
+	while (!nodes.empty()) {
+		const q_node* node = nodes.back();
+		nodes.pop_back();
+
+		if (node->is_leaf()) {
+			references += node->count();
+			continue;
+		}
+
+		for (size_t i = 0; i < node->children_count(); ++i) {
+			nodes.push_back(node->children() + i);
+		}
+	}
+
+	return (double)references / (double)count();
+}
+
+template <typename T, typename Alloc, typename Instrument> template <typename F> inline void
+rz_quadtree<T, Alloc, Instrument>::visit_leaves(F& visitor) const {
+	std::vector<std::pair<const q_node*, size_t> > nodes(1, std::make_pair(&root_, (size_t)0));
+
+	while (!nodes.empty()) {
+		const q_node* node = nodes.back().first;
+		size_t depth = nodes.back().second;
+		nodes.pop_back();
+
+		if (node->is_leaf()) {
+			visitor(node, depth);
+			continue;
+		}
+
+		// reversed, so leaves come in A, B, C, D order
+		for (size_t i = node->children_count(); i-- > 0;) {
+			nodes.push_back(std::make_pair(node->children() + i, depth + 1));
+		}
+	}
+}
+
+template <typename T, typename Alloc, typename Instrument> inline rz_quadtree_stats
+rz_quadtree<T, Alloc, Instrument>::stats() const {
+	rz_quadtree_stats result;
+
+	auto count_leaf = [&](const q_node* leaf, size_t depth) {
+		size_t count = leaf->count();
+
+		result.leaves++;
+		result.empty_leaves += count == 0 ? 1 : 0;
+		result.overfull_leaves += (depth >= depth_threshold_ && count > objects_threshold_) ? 1 : 0;
+		result.max_depth = std::max(result.max_depth, depth);
+		result.references += count;
+
+		if (result.depth_histogram.size() <= depth) {
+			result.depth_histogram.resize(depth + 1, 0);
+		}
+
+		result.depth_histogram[depth]++;
+
+		size_t bucket = 0;
+		while (count >> bucket) {
+			++bucket;
+		}
+
+		if (result.occupancy_histogram.size() <= bucket) {
+			result.occupancy_histogram.resize(bucket + 1, 0);
+		}
+
+		result.occupancy_histogram[bucket]++;
+	};
+
+	visit_leaves(count_leaf);
+
+	// all nodes but the root come from the arena
+	result.nodes = arena_.nodes_count() + 1;
+
+	result.objects = count();
+	result.replication = result.objects == 0 ? 0.0 : (double)result.references / (double)result.objects;
+
+	result.objects_bytes = objects_.capacity() * sizeof(T);
+	result.bounds_bytes = bounds_.capacity() * sizeof(aabb2d);
+	result.bookkeeping_bytes = alive_.capacity() * sizeof(unsigned char) + free_indices_.capacity() * sizeof(index_type);
+	result.nodes_bytes = arena_.allocated_bytes();
+	result.leaf_indices_bytes = leaf_indices_.capacity() * sizeof(index_type);
+	result.leaf_bounds_bytes = (leaf_min_x_.capacity() + leaf_min_y_.capacity() + leaf_max_x_.capacity() + leaf_max_y_.capacity()) * sizeof(float);
+	result.unused_leaf_entries = leaf_garbage_;
+	result.total_bytes = sizeof(*this) + result.objects_bytes + result.bounds_bytes + result.bookkeeping_bytes +
+		result.nodes_bytes + result.leaf_indices_bytes + result.leaf_bounds_bytes;
+
+	return result;
+}
+
+template <typename T, typename Alloc, typename Instrument> inline void
+rz_quadtree<T, Alloc, Instrument>::save_leaves(const std::string& path, rz_leaves_format format) const {
+	std::ofstream file(path.c_str(), std::ios::out | std::ios::trunc);
+	if (!file) {
+		throw std::runtime_error("rz_quadtree can't open file for writing!");
+	}
+
+	file << std::setprecision(17);
+
+	if (format == RZ_LEAVES_CSV) {
+		file << "min_x,min_y,max_x,max_y,depth,count,overfull\n";
+	}
+	else {
+		file << "{\"type\":\"FeatureCollection\",\"features\":[";
+	}
+
+	bool first = true;
+
+	auto write_leaf = [&](const q_node* leaf, size_t depth) {
+		aabb2d box = node_box(leaf);
+		bool overfull = depth >= depth_threshold_ && leaf->count() > objects_threshold_;
+
+		if (format == RZ_LEAVES_CSV) {
+			file << box.min.x << ',' << box.min.y << ',' << box.max.x << ',' << box.max.y << ',' <<
+				depth << ',' << leaf->count() << ',' << (overfull ? 1 : 0) << '\n';
+			return;
+		}
+
+		file << (first ? "\n" : ",\n");
+		file << "{\"type\":\"Feature\",\"geometry\":{\"type\":\"Polygon\",\"coordinates\":[[" <<
+			'[' << box.min.x << ',' << box.min.y << "],[" << box.max.x << ',' << box.min.y << "],[" <<
+			box.max.x << ',' << box.max.y << "],[" << box.min.x << ',' << box.max.y << "],[" <<
+			box.min.x << ',' << box.min.y << "]]]},\"properties\":{\"depth\":" << depth <<
+			",\"count\":" << leaf->count() << ",\"overfull\":" << (overfull ? "true" : "false") << "}}";
+		first = false;
+	};
+
+	visit_leaves(write_leaf);
+
+	if (format == RZ_LEAVES_GEOJSON) {
+		file << "\n]}\n";
+	}
+
+	if (!file) {
+		throw std::runtime_error("rz_quadtree failed to write leaves file!");
+	}
+}
+
+template <typename T, typename Alloc, typename Instrument> inline Instrument&
+rz_quadtree<T, Alloc, Instrument>::instrumentation() const {
+	return instrumentation_;
+}
+
+template <typename T, typename Alloc, typename Instrument> inline typename rz_quadtree<T, Alloc, Instrument>::index_type
+rz_quadtree<T, Alloc, Instrument>::insert(const T& object) {
+	index_type index;
+
+	if (!free_indices_.empty()) {
+		index = free_indices_.back();
+		free_indices_.pop_back();
+		objects_[index] = object;
+		bounds_[index] = aabb2d(min_2d(object), max_2d(object));
+		alive_[index] = 1;
+	}
+	else {
+		if (objects_.size() >= (size_t)UINT32_MAX) {
+			throw std::runtime_error("rz_quadtree can't index more than 2^32 - 1 objects!");
+		}
+
+		index = (index_type)objects_.size();
+		objects_.push_back(object);
+		bounds_.push_back(aabb2d(min_2d(object), max_2d(object)));
+		alive_.push_back(1);
+	}
+
+	const aabb2d& bounds = bounds_[index];
+
+	// first object of an empty tree, place the root around it
+	if (count() == 1) {
+		min_ = bounds.min;
+		max_ = bounds.max;
+
+		destroy_children(&root_);
+		release_leaf_indices(&root_);
+		root_.set_box(get_root_box(min_, max_));
+		root_.set_leaf(true);
+	}
+
+	min_.x = fmin(min_.x, bounds.min.x);
+	min_.y = fmin(min_.y, bounds.min.y);
+	max_.x = fmax(max_.x, bounds.max.x);
+	max_.y = fmax(max_.y, bounds.max.y);
+
+	grow_root(bounds);
+	insert_into_node(&root_, &index, 1, 0);
+	compact_leaf_indices();
+
+	return index;
+}
+
+template <typename T, typename Alloc, typename Instrument> inline bool
+rz_quadtree<T, Alloc, Instrument>::remove(index_type index) {
+	if (!contains(index)) {
+		return false;
+	}
+
+	remove_from_node(&root_, index);
+	compact_leaf_indices();
+
+	alive_[index] = 0;
+	free_indices_.push_back(index);
+	return true;
+}
+
+template <typename T, typename Alloc, typename Instrument> inline bool
+rz_quadtree<T, Alloc, Instrument>::remove(const T& object) {
+	if (objects_.empty()) {
+		return false;
+	}
+
+	// the object is stored in every leaf along its path, look at the first one
+	aabb2d bounds(min_2d(object), max_2d(object));
+	const q_node* node = &root_;
+
+	if (!boxes_overlap(node_box(node), bounds)) {
+		return false;
+	}
+
+	while (!node->is_leaf()) {
+		// the children insert picks, flat ones left out
+		unsigned int mask = get_object_mask(node, object, bounds);
+		size_t i = children_mask_first(mask);
+
+		// an empty quadrant has no node, so the object isn't stored
+		if (mask == 0 || !node->has_child(i)) {
+			return false;
+		}
+
+		node = node->child(i);
+	}
+
+	const index_type* node_indices = leaf_begin(node);
+	for (size_t i = 0; i < node->count(); ++i) {
+		if (objects_[node_indices[i]] == object) {
+			return remove(node_indices[i]);
+		}
+	}
+
+	return false;
+}
+
+template <typename T, typename Alloc, typename Instrument> inline bool
+rz_quadtree<T, Alloc, Instrument>::update(index_type index, const T& object) {
+	update_vector updates(1, object_update(index, object));
+	return apply_updates(updates).skipped == 0;
+}
+
+template <typename T, typename Alloc, typename Instrument> inline rz_quadtree_update_stats
+rz_quadtree<T, Alloc, Instrument>::apply_updates(const update_vector& updates) {
+	rz_quadtree_update_stats stats;
+	index_vector relocated;
+
+	// objects already taken out of the tree by this batch
+	rz_query_scope scope;
+	rz_query_context& context = scope.context();
+	context.begin_query(objects_.size());
+
+	for (size_t i = 0; i < updates.size(); ++i) {
+		index_type index = updates[i].first;
+		const T& object = updates[i].second;
+
+		if (!contains(index)) {
+			++stats.skipped;
+			continue;
+		}
+
+		aabb2d bounds(min_2d(object), max_2d(object));
+		aabb2d root_box = node_box(&root_);
+		bool inside_root = bounds.min.x >= root_box.min.x && bounds.min.y >= root_box.min.y && bounds.max.x <= root_box.max.x && bounds.max.y <= root_box.max.y;
+
+		if (context.marked(index)) {
+			++stats.repeated;
+		}
+		else if (inside_root && same_leaves(&root_, objects_[index], bounds_[index], object, bounds)) {
+			++stats.in_place;
+		}
+		else {
+			remove_from_node(&root_, index);
+			context.mark(index);
+			relocated.push_back(index);
+			++stats.relocated;
+		}
+
+		objects_[index] = object;
+		bounds_[index] = bounds;
+
+		if (!context.marked(index)) {
+			refresh_leaf_bounds(&root_, index);
+		}
+
+		// data box only grows, same as with inserts
+		min_.x = fmin(min_.x, bounds.min.x);
+		min_.y = fmin(min_.y, bounds.min.y);
+		max_.x = fmax(max_.x, bounds.max.x);
+		max_.y = fmax(max_.y, bounds.max.y);
+	}
+
+	if (!relocated.empty()) {
+		for (size_t i = 0; i < relocated.size(); ++i) {
+			grow_root(bounds_[relocated[i]]);
+		}
+
+		insert_into_node(&root_, relocated.data(), relocated.size(), 0);
+		compact_leaf_indices();
+	}
+
+	update_stats_.in_place += stats.in_place;
+	update_stats_.relocated += stats.relocated;
+	update_stats_.repeated += stats.repeated;
+	update_stats_.skipped += stats.skipped;
+
+	return stats;
+}
+
+template <typename T, typename Alloc, typename Instrument> inline const rz_quadtree_update_stats&
+rz_quadtree<T, Alloc, Instrument>::update_stats() const {
+	return update_stats_;
+}
+
+template <typename T, typename Alloc, typename Instrument> inline void
+rz_quadtree<T, Alloc, Instrument>::grow_root(const aabb2d& bounds) {
+	for (;;) {
+		aabb2d box = root_.box();
+
+		if (bounds.min.x >= box.min.x && bounds.min.y >= box.min.y && bounds.max.x <= box.max.x && bounds.max.y <= box.max.y) {
+			return;
+		}
+
+		double size_x = box.width() > 0.0 ? box.width() : 1.0;
+		double size_y = box.height() > 0.0 ? box.height() : 1.0;
+
+		// double the root towards the object, old root becomes its only
+		// child, split at its corner. other quadrants get nodes on inserts
+		bool grow_left = bounds.min.x < box.min.x;
+		bool grow_down = bounds.min.y < box.min.y;
+
+		aabb2d new_box(point2d(grow_left ? box.min.x - size_x : box.min.x, grow_down ? box.min.y - size_y : box.min.y),
+			point2d(grow_left ? box.max.x : box.min.x + 2.0 * size_x, grow_down ? box.max.y : box.min.y + 2.0 * size_y));
+
+		// A top-left, B top-right, C bottom-left, D bottom-right
+		size_t old_root_slot = (grow_down ? 0 : 2) + (grow_left ? 1 : 0);
+
+		q_node old_root = root_;
+
+		root_ = q_node();
+		root_.set_box(new_box);
+		create_children(&root_, 1u << old_root_slot);
+
+		// keep the old root's exact coordinates, rounding could shift them.
+		// its corner at the split is where get_node_split finds it
+		*root_.child(old_root_slot) = old_root;
+	}
+}
+
+template <typename T, typename Alloc, typename Instrument> inline void
+rz_quadtree<T, Alloc, Instrument>::insert_into_node(q_node* node, const index_type* indices, size_t count, size_t depth) {
+	if (node->is_leaf()) {
+		append_leaf_indices(node, indices, count);
+
+		if (node->count() <= objects_threshold_ || depth >= depth_threshold_) {
+			return;
+		}
+
+		// the cost model keeps big leaves, it's asked again when the leaf doubled
+		size_t before = node->count() - count;
+		if (split_cost_.enabled && before > objects_threshold_ && (before ^ node->count()) <= before) {
+			return;
+		}
+
+		// split, the leaf is rebuilt as a sub-tree from its own objects
+		index_vector leaf_indices(leaf_begin(node), leaf_begin(node) + node->count());
+		release_leaf_indices(node);
+		node->set_leaf(false);
+
+		build_target target(arena_, leaf_indices_);
+		build_sub_tree(node, leaf_indices.data(), leaf_indices.size(), depth, target);
+		return;
+	}
+
+	// single object, just follow its path. empty quadrants get a leaf
+	if (count == 1) {
+		unsigned int mask = get_object_mask(node, objects_[indices[0]], bounds_[indices[0]]);
+
+		for (size_t i = 0; i < 4; ++i) {
+			if (mask & (1 << i)) {
+				insert_into_node(node->has_child(i) ? node->child(i) : add_child(node, i), indices, 1, depth + 1);
+			}
+		}
+
+		return;
+	}
+
+	// group the objects by child, same as the build does
+	aabb2d sub_boxes[4];
+	get_children_boxes(node, sub_boxes);
+
+	std::vector<unsigned char> masks(count);
+	size_t counts[4] = { 0, 0, 0, 0 };
+	partition_objects(sub_boxes, indices, count, masks.data(), counts);
+
+	index_vector sub_indices(counts[0] + counts[1] + counts[2] + counts[3]);
+	index_type* sub_firsts[4];
+	index_type* offsets[4];
+
+	sub_firsts[0] = sub_indices.data();
+	for (size_t i = 1; i < 4; ++i) {
+		sub_firsts[i] = sub_firsts[i - 1] + counts[i - 1];
+	}
+
+	std::copy(sub_firsts, sub_firsts + 4, offsets);
+	scatter_objects(indices, count, masks.data(), offsets);
+
+	for (size_t i = 0; i < 4; ++i) {
+		if (counts[i] > 0) {
+			insert_into_node(node->has_child(i) ? node->child(i) : add_child(node, i), sub_firsts[i], counts[i], depth + 1);
+		}
+	}
+}
+
+template <typename T, typename Alloc, typename Instrument> inline bool
+rz_quadtree<T, Alloc, Instrument>::remove_from_node(q_node* node, index_type index) {
+	if (node->is_leaf()) {
+		index_type* first = leaf_indices_.data() + node->first();
+		index_type* last = first + node->count();
+		index_type* it = std::find(first, last, index);
+
+		if (it == last) {
+			return false;
+		}
+
+		size_t position = node->first() + (it - first);
+		size_t end = node->first() + node->count();
+
+		std::copy(it + 1, last, it);
+		std::copy(leaf_min_x_.begin() + position + 1, leaf_min_x_.begin() + end, leaf_min_x_.begin() + position);
+		std::copy(leaf_min_y_.begin() + position + 1, leaf_min_y_.begin() + end, leaf_min_y_.begin() + position);
+		std::copy(leaf_max_x_.begin() + position + 1, leaf_max_x_.begin() + end, leaf_max_x_.begin() + position);
+		std::copy(leaf_max_y_.begin() + position + 1, leaf_max_y_.begin() + end, leaf_max_y_.begin() + position);
+
+		node->set_count(node->count() - 1);
+		return true;
+	}
+
+	unsigned int mask = get_object_mask(node, objects_[index], bounds_[index]);
+	bool removed = false;
+
+	for (size_t i = 0; i < 4; ++i) {
+		if ((mask & (1 << i)) && node->has_child(i) && remove_from_node(node->child(i), index)) {
+			removed = true;
+		}
+	}
+
+	if (removed) {
+		merge_children(node);
+	}
+
+	return removed;
+}
+
+template <typename T, typename Alloc, typename Instrument> inline void
+rz_quadtree<T, Alloc, Instrument>::merge_children(q_node* node) {
+	// only leaf siblings with few objects left are merged
+	index_vector indices;
+	bool leaves = true;
+
+	for (size_t i = 0; i < node->children_count(); ++i) {
+		const q_node* sub_node = node->children() + i;
+		leaves = leaves && sub_node->is_leaf();
+
+		if (leaves) {
+			indices.insert(indices.end(), leaf_begin(sub_node), leaf_begin(sub_node) + sub_node->count());
+		}
+	}
+
+	std::sort(indices.begin(), indices.end());
+	indices.erase(std::unique(indices.begin(), indices.end()), indices.end());
+
+	if (leaves && indices.size() <= objects_threshold_ / 2) {
+		destroy_children(node);
+		set_leaf_indices(node, indices.data(), indices.size());
+		node->set_leaf(true);
+		return;
+	}
+
+	// children emptied by the removal go away, there's always one left
+	for (size_t i = 4; i-- > 0;) {
+		if (node->has_child(i) && node->child(i)->is_leaf() && node->child(i)->empty()) {
+			remove_child(node, i);
+		}
+	}
+}
+
+template <typename T, typename Alloc, typename Instrument> inline void
+rz_quadtree<T, Alloc, Instrument>::create_children(q_node* node, unsigned int mask) {
+	node->set_children(arena_.allocate(children_mask_count(mask)), mask);
+}
+
+template <typename T, typename Alloc, typename Instrument> inline bool
+rz_quadtree<T, Alloc, Instrument>::create_present_children(q_node* node, const aabb2d* sub_boxes, const size_t* counts, node_arena& arena) {
+	// empty quadrants get no node, false when none has objects
+	unsigned int mask = 0;
+	for (size_t i = 0; i < 4; ++i) {
+		mask |= counts[i] > 0 ? (1u << i) : 0;
+	}
+
+	if (mask == 0) {
+		return false;
+	}
+
+	node->set_children(arena.allocate(children_mask_count(mask)), mask);
+
+	for (size_t i = 0; i < 4; ++i) {
+		if (mask & (1u << i)) {
+			node->child(i)->set_box(sub_boxes[i]);
+		}
+	}
+
+	return true;
+}
+
+template <typename T, typename Alloc, typename Instrument> inline void
+rz_quadtree<T, Alloc, Instrument>::destroy_children(q_node* node) {
+	q_node* children = node->children();
+	if (!children) {
+		return;
+	}
+
+	size_t count = node->children_count();
+
+	for (size_t i = 0; i < count; ++i) {
+		destroy_children(children + i);
+		release_leaf_indices(children + i);
+	}
+
+	node->set_children(NULL, 0);
+	arena_.deallocate(children, count);
+}
+
+template <typename T, typename Alloc, typename Instrument> inline typename rz_quadtree<T, Alloc, Instrument>::q_node*
+rz_quadtree<T, Alloc, Instrument>::add_child(q_node* node, size_t index) {
+	// siblings move to a block one node bigger, nodes are plain values
+	aabb2d sub_boxes[4];
+	get_children_boxes(node, sub_boxes);
+
+	q_node* children = node->children();
+	size_t count = node->children_count();
+	unsigned int mask = node->children_mask() | (1u << index);
+
+	q_node* block = arena_.allocate(count + 1);
+	for (size_t i = 0, j = 0; i < 4; ++i) {
+		if (i == index) {
+			block[j].set_box(sub_boxes[i]);
+			block[j].set_leaf(true);
+			++j;
+		}
+		else if (node->has_child(i)) {
+			block[j++] = *node->child(i);
+		}
+	}
+
+	arena_.deallocate(children, count);
+	node->set_children(block, mask);
+
+	return node->child(index);
+}
+
+template <typename T, typename Alloc, typename Instrument> inline void
+rz_quadtree<T, Alloc, Instrument>::remove_child(q_node* node, size_t index) {
+	q_node* children = node->children();
+	size_t count = node->children_count();
+	unsigned int mask = node->children_mask() & ~(1u << index);
+
+	q_node* removed = node->child(index);
+	destroy_children(removed);
+	release_leaf_indices(removed);
+
+	q_node* block = arena_.allocate(count - 1);
+	for (size_t i = 0, j = 0; i < 4; ++i) {
+		if (i != index && node->has_child(i)) {
+			block[j++] = *node->child(i);
+		}
+	}
+
+	arena_.deallocate(children, count);
+	node->set_children(block, mask);
+}
+
+template <typename T, typename Alloc, typename Instrument> inline const typename rz_quadtree<T, Alloc, Instrument>::index_type*
+rz_quadtree<T, Alloc, Instrument>::leaf_begin(const q_node* node) const {
+	return leaf_indices_.data() + node->first();
+}
+
+template <typename T, typename Alloc, typename Instrument> inline void
+rz_quadtree<T, Alloc, Instrument>::set_leaf_indices(q_node* node, const index_type* indices, size_t count) {
+	release_leaf_indices(node);
+
+	size_t first = leaf_indices_.size();
+	resize_leaf_buffers(first + count);
+	std::copy(indices, indices + count, leaf_indices_.begin() + first);
+	write_leaf_bounds(first, indices, count);
+	node->set_slice(first, count, count);
+}
+
+template <typename T, typename Alloc, typename Instrument> inline void
+rz_quadtree<T, Alloc, Instrument>::set_leaf_indices(q_node* node, const index_type* indices, size_t count, build_target& target) {
+	if (&target.leaves == &leaf_indices_) {
+		set_leaf_indices(node, indices, count);
+		return;
+	}
+
+	// new node of a build task, slice of the task's buffer
+	size_t first = target.leaves.size();
+	target.leaves.insert(target.leaves.end(), indices, indices + count);
+	node->set_slice(first, count, count);
+}
+
+template <typename T, typename Alloc, typename Instrument> inline void
+rz_quadtree<T, Alloc, Instrument>::append_leaf_indices(q_node* node, const index_type* indices, size_t count) {
+	size_t node_count = node->count();
+
+	// slice is full, move it to the end of the buffer with some room to grow
+	if (node_count + count > node->capacity()) {
+		size_t capacity = std::max(node_count + count, 2 * node->capacity());
+		size_t first = leaf_indices_.size();
+
+		resize_leaf_buffers(first + capacity);
+		std::copy(leaf_indices_.begin() + node->first(), leaf_indices_.begin() + node->first() + node_count, leaf_indices_.begin() + first);
+		write_leaf_bounds(first, leaf_indices_.data() + first, node_count);
+
+		leaf_garbage_ += node->capacity();
+		node->set_slice(first, node_count, capacity);
+	}
+
+	std::copy(indices, indices + count, leaf_indices_.begin() + node->first() + node_count);
+	write_leaf_bounds(node->first() + node_count, indices, count);
+	node->set_count(node_count + count);
+}
+
+template <typename T, typename Alloc, typename Instrument> inline void
+rz_quadtree<T, Alloc, Instrument>::release_leaf_indices(q_node* node) {
+	leaf_garbage_ += node->capacity();
+	node->set_slice(0, 0, 0);
+}
+
+template <typename T, typename Alloc, typename Instrument> inline void
+rz_quadtree<T, Alloc, Instrument>::compact_leaf_indices() {
+	// updates leave unused slices behind, drop them once they take half of the buffer
+	if (leaf_garbage_ < 1024 || leaf_garbage_ < leaf_indices_.size() / 2) {
+		return;
+	}
+
+	leaf_buffer buffer(leaf_indices_.get_allocator());
+	buffer.reserve(leaf_indices_.size() - leaf_garbage_);
+
+	compact_leaf_indices(&root_, buffer);
+
+	leaf_indices_.swap(buffer);
+	leaf_garbage_ = 0;
+
+	resize_leaf_buffers(leaf_indices_.size());
+	write_leaf_bounds(0, leaf_indices_.data(), leaf_indices_.size());
+
+	leaf_min_x_.shrink_to_fit();
+	leaf_min_y_.shrink_to_fit();
+	leaf_max_x_.shrink_to_fit();
+	leaf_max_y_.shrink_to_fit();
+}
+
+template <typename T, typename Alloc, typename Instrument> inline void
+rz_quadtree<T, Alloc, Instrument>::compact_leaf_indices(q_node* node, leaf_buffer& buffer) {
+	if (!node->is_leaf()) {
+		for (size_t i = 0; i < node->children_count(); ++i) {
+			compact_leaf_indices(node->children() + i, buffer);
+		}
+
+		return;
+	}
+
+	size_t first = buffer.size();
+	buffer.insert(buffer.end(), leaf_begin(node), leaf_begin(node) + node->count());
+	node->set_slice(first, node->count(), node->count());
+}
+
+template <typename T, typename Alloc, typename Instrument> inline void
+rz_quadtree<T, Alloc, Instrument>::resize_leaf_buffers(size_t size) {
+	leaf_indices_.resize(size);
+	leaf_min_x_.resize(size);
+	leaf_min_y_.resize(size);
+	leaf_max_x_.resize(size);
+	leaf_max_y_.resize(size);
+}
+
+template <typename T, typename Alloc, typename Instrument> inline void
+rz_quadtree<T, Alloc, Instrument>::write_leaf_bounds(size_t position, const index_type* indices, size_t count) {
+	for (size_t i = 0; i < count; ++i) {
+		const aabb2d& bounds = bounds_[indices[i]];
+
+		leaf_min_x_[position + i] = float_down_2d(bounds.min.x);
+		leaf_min_y_[position + i] = float_down_2d(bounds.min.y);
+		leaf_max_x_[position + i] = float_up_2d(bounds.max.x);
+		leaf_max_y_[position + i] = float_up_2d(bounds.max.y);
+	}
+}
+
+template <typename T, typename Alloc, typename Instrument> inline void
+rz_quadtree<T, Alloc, Instrument>::refresh_leaf_bounds(q_node* node, index_type index) {
+	if (node->is_leaf()) {
+		const index_type* node_indices = leaf_begin(node);
+
+		for (size_t i = 0; i < node->count(); ++i) {
+			if (node_indices[i] == index) {
+				write_leaf_bounds(node->first() + i, &index, 1);
+			}
+		}
+
+		return;
+	}
+
+	unsigned int mask = get_object_mask(node, objects_[index], bounds_[index]);
+
+	for (size_t i = 0; i < 4; ++i) {
+		if ((mask & (1 << i)) && node->has_child(i)) {
+			refresh_leaf_bounds(node->child(i), index);
+		}
+	}
+}
+
+template <typename T, typename Alloc, typename Instrument> inline size_t
+rz_quadtree<T, Alloc, Instrument>::filter_leaf(const q_node* node, size_t first, size_t count, const rz_bounds_query& query, uint32_t* positions) const {
+	size_t offset = node->first() + first;
+	return filter_bounds_2d(leaf_min_x_.data() + offset, leaf_min_y_.data() + offset, leaf_max_x_.data() + offset, leaf_max_y_.data() + offset, count, query, positions);
+}
+
+template <typename T, typename Alloc, typename Instrument> inline void
+rz_quadtree<T, Alloc, Instrument>::get_objects_from_point(const point2d& pt, o_vector& objects, unsigned int flags) const {
+	objects.clear();
+	query_point(pt, [&objects](const T& object) {
+		objects.push_back(object);
+		return true;
+	}, flags);
+}
+
+template <typename T, typename Alloc, typename Instrument> inline void
+rz_quadtree<T, Alloc, Instrument>::get_objects_from_aabb(const aabb2d& aabb, o_vector& objects, unsigned int flags) const {
+	objects.clear();
+	query_aabb(aabb, [&objects](const T& object) {
+		objects.push_back(object);
+		return true;
+	}, flags);
+}
+
+template <typename T, typename Alloc, typename Instrument> inline void
+rz_quadtree<T, Alloc, Instrument>::get_indices_from_point(const point2d& pt, index_vector& indices, unsigned int flags) const {
+	indices.clear();
+
+	auto visitor = [&indices](index_type index) {
+		indices.push_back(index);
+		return true;
+	};
+
+	visit_point(pt, flags, visitor);
+}
+
+template <typename T, typename Alloc, typename Instrument> inline void
+rz_quadtree<T, Alloc, Instrument>::get_indices_from_aabb(const aabb2d& aabb, index_vector& indices, unsigned int flags) const {
+	rz_query_scope scope;
+	get_indices_from_aabb(aabb, indices, flags, scope.context());
+}
+
+template <typename T, typename Alloc, typename Instrument> inline void
+rz_quadtree<T, Alloc, Instrument>::get_indices_from_aabb(const aabb2d& aabb, index_vector& indices, unsigned int flags, rz_query_context& context) const {
+	indices.clear();
+
+	auto visitor = [&indices](index_type index) {
+		indices.push_back(index);
+		return true;
+	};
+
+	visit_aabb(aabb, flags, context, visitor);
+}
+
+template <typename T, typename Alloc, typename Instrument> inline void
+rz_quadtree<T, Alloc, Instrument>::get_indices_from_points(const std::vector<point2d>& points, index_vector& indices, std::vector<size_t>& offsets, unsigned int flags) const {
+	if (points.size() > (size_t)UINT32_MAX) {
+		throw std::runtime_error("rz_quadtree get_indices_from_points received more than 2^32 - 1 points!");
+	}
+
+	indices.clear();
+	offsets.assign(points.size() + 1, 0);
+
+	// z-order keys over the root box, 16 bits per axis, point number in low bits
+	aabb2d data_box(min_, max_);
+	aabb2d root_box = node_box(&root_);
+	double scale_x = root_box.width() > 0.0 ? 65535.0 / root_box.width() : 0.0;
+	double scale_y = root_box.height() > 0.0 ? 65535.0 / root_box.height() : 0.0;
+
+	std::vector<uint64_t> keys;
+	keys.reserve(points.size());
+
+	for (size_t i = 0; i < points.size(); ++i) {
+		const point2d& pt = points[i];
+
+		if (false == intersect_2d(data_box, pt) || false == intersect_2d(root_box, pt)) {
+			continue;
+		}
+
+		uint32_t x = (uint32_t)fmin((pt.x - root_box.min.x) * scale_x, 65535.0);
+		uint32_t y = (uint32_t)fmin((pt.y - root_box.min.y) * scale_y, 65535.0);
+		keys.push_back((morton_encode_2d(x, y) << 32) | i);
+	}
+
+	std::sort(keys.begin(), keys.end());
+
+	std::vector<uint32_t> queries(keys.size());
+	std::vector<uint32_t> scratch(keys.size());
+	std::vector<unsigned char> children(keys.size());
+
+	for (size_t i = 0; i < keys.size(); ++i) {
+		queries[i] = (uint32_t)keys[i];
+	}
+
+	// results in z-order first, then gathered in the order of the points
+	index_vector results;
+	std::vector<std::pair<size_t, size_t> > ranges(points.size(), std::make_pair(0, 0));
+
+	if (!queries.empty()) {
+		intersect_tree_with_points(&root_, points.data(), queries.data(), scratch.data(), children.data(), queries.size(), flags, results, ranges);
+	}
+
+	for (size_t i = 0; i < points.size(); ++i) {
+		offsets[i + 1] = offsets[i] + ranges[i].second;
+	}
+
+	indices.resize(results.size());
+
+	for (size_t i = 0; i < points.size(); ++i) {
+		std::copy(results.begin() + ranges[i].first, results.begin() + ranges[i].first + ranges[i].second, indices.begin() + offsets[i]);
+	}
+}
+
+template <typename T, typename Alloc, typename Instrument> inline void
+rz_quadtree<T, Alloc, Instrument>::get_objects_from_points(const std::vector<point2d>& points, o_vector& objects, std::vector<size_t>& offsets, unsigned int flags) const {
+	index_vector indices;
+	get_indices_from_points(points, indices, offsets, flags);
+
+	objects.clear();
+	objects.reserve(indices.size());
+
+	for (size_t i = 0; i < indices.size(); ++i) {
+		objects.push_back(objects_[indices[i]]);
+	}
+}
+
+template <typename T, typename Alloc, typename Instrument> inline void
+rz_quadtree<T, Alloc, Instrument>::get_indices_from_aabbs(const std::vector<aabb2d>& boxes, index_vector& indices, std::vector<size_t>& offsets, unsigned int flags, rz_thread_pool* pool) const {
+	indices.clear();
+	offsets.assign(boxes.size() + 1, 0);
+
+	// small chunks keep workers balanced when some boxes hit much more than others
+	size_t chunk_size = boxes.size();
+	if (pool) {
+		chunk_size = std::max((size_t)1, std::min((size_t)64, boxes.size() / (8 * (pool->size() + 1))));
+	}
+
+	size_t chunks_count = chunk_size > 0 ? (boxes.size() + chunk_size - 1) / chunk_size : 0;
+	std::vector<index_vector> chunks_results(chunks_count);
+
+	// counts go straight to offsets[i + 1], prefix sums come later
+	auto run_chunk = [&, chunk_size](size_t chunk) {
+		size_t first = chunk * chunk_size;
+		size_t last = std::min(first + chunk_size, boxes.size());
+
+		index_vector& results = chunks_results[chunk];
+		rz_query_scope scope;
+		rz_query_context& context = scope.context();
+
+		auto visitor = [&results](index_type index) {
+			results.push_back(index);
+			return true;
+		};
+
+		for (size_t i = first; i < last; ++i) {
+			size_t results_count = results.size();
+			visit_aabb(boxes[i], flags, context, visitor);
+			offsets[i + 1] = results.size() - results_count;
+		}
+	};
+
+	if (pool && chunks_count > 1) {
+		rz_task_group group(*pool);
+
+		for (size_t chunk = 0; chunk < chunks_count; ++chunk) {
+			group.run([&run_chunk, chunk]() {
+				run_chunk(chunk);
+			});
+		}
+
+		group.wait();
+	}
+	else {
+		for (size_t chunk = 0; chunk < chunks_count; ++chunk) {
+			run_chunk(chunk);
+		}
+	}
+
+	for (size_t i = 0; i < boxes.size(); ++i) {
+		offsets[i + 1] += offsets[i];
+	}
+
+	// chunks follow each other in box order, so a chunk starts where its first box does
+	indices.resize(offsets[boxes.size()]);
+
+	for (size_t chunk = 0; chunk < chunks_count; ++chunk) {
+		std::copy(chunks_results[chunk].begin(), chunks_results[chunk].end(), indices.begin() + offsets[chunk * chunk_size]);
+	}
+}
+
+template <typename T, typename Alloc, typename Instrument> inline void
+rz_quadtree<T, Alloc, Instrument>::get_objects_from_aabbs(const std::vector<aabb2d>& boxes, o_vector& objects, std::vector<size_t>& offsets, unsigned int flags, rz_thread_pool* pool) const {
+	index_vector indices;
+	get_indices_from_aabbs(boxes, indices, offsets, flags, pool);
+
+	objects.clear();
+	objects.reserve(indices.size());
+
+	for (size_t i = 0; i < indices.size(); ++i) {
+		objects.push_back(objects_[indices[i]]);
+	}
+}
+
+template <typename T, typename Alloc, typename Instrument> template <typename F> inline bool
+rz_quadtree<T, Alloc, Instrument>::query_point(const point2d& pt, F&& f, unsigned int flags) const {
+	auto visitor = [this, &f](index_type index) -> bool {
+		return f(objects_[index]);
+	};
+
+	return visit_point(pt, flags, visitor);
+}
+
+template <typename T, typename Alloc, typename Instrument> template <typename F> inline bool
+rz_quadtree<T, Alloc, Instrument>::query_aabb(const aabb2d& aabb, F&& f, unsigned int flags) const {
+	rz_query_scope scope;
+	return query_aabb(aabb, f, flags, scope.context());
+}
+
+template <typename T, typename Alloc, typename Instrument> template <typename F> inline bool
+rz_quadtree<T, Alloc, Instrument>::query_aabb(const aabb2d& aabb, F&& f, unsigned int flags, rz_query_context& context) const {
+	auto visitor = [this, &f](index_type index) -> bool {
+		return f(objects_[index]);
+	};
+
+	return visit_aabb(aabb, flags, context, visitor);
+}
+
+template <typename T, typename Alloc, typename Instrument> inline bool
+rz_quadtree<T, Alloc, Instrument>::find_object_from_point(const point2d& pt, index_type& index) const {
+	auto visitor = [&index](index_type found) {
+		index = found;
+		return false;
+	};
+
+	return false == visit_point(pt, RZ_QUERY_EXACT, visitor);
+}
+
+template <typename T, typename Alloc, typename Instrument> inline void
+rz_quadtree<T, Alloc, Instrument>::get_objects_from_line(const line2d& line, o_vector& objects) const {
+	objects.clear();
+	query_line(line, [&objects](const T& object, double) {
+		objects.push_back(object);
+		return true;
+	});
+}
+
+template <typename T, typename Alloc, typename Instrument> inline void
+rz_quadtree<T, Alloc, Instrument>::get_indices_from_line(const line2d& line, index_vector& indices) const {
+	indices.clear();
+
+	auto visitor = [&indices](index_type index, double) {
+		indices.push_back(index);
+		return true;
+	};
+
+	visit_line(line, visitor);
+}
+
+template <typename T, typename Alloc, typename Instrument> template <typename F> inline bool
+rz_quadtree<T, Alloc, Instrument>::query_line(const line2d& line, F&& f) const {
+	auto visitor = [this, &f](index_type index, double t) -> bool {
+		return f(objects_[index], t);
+	};
+
+	return visit_line(line, visitor);
+}
+
+template <typename T, typename Alloc, typename Instrument> inline bool
+rz_quadtree<T, Alloc, Instrument>::find_object_from_line(const line2d& line, index_type& index) const {
+	auto visitor = [&index](index_type found, double) {
+		index = found;
+		return false;
+	};
+
+	return false == visit_line(line, visitor);
+}
+
+template <typename T, typename Alloc, typename Instrument> inline void
+rz_quadtree<T, Alloc, Instrument>::nearest(const point2d& pt, size_t k, neighbour_vector& neighbours, double max_distance) const {
+	neighbours.clear();
+
+	if (k == 0 || objects_.empty()) {
+		return;
+	}
+
+	// nodes to visit, closest cell on top
+	typedef std::pair<double, const q_node*> node_entry;
+	std::priority_queue<node_entry, std::vector<node_entry>, std::greater<node_entry> > nodes;
+
+	// best k objects found so far, worst one on top
+	typedef std::pair<double, index_type> object_entry;
+	std::priority_queue<object_entry> best;
+
+	// objects are stored in several leaves, measure each one once
+	rz_query_scope scope;
+	rz_query_context& context = scope.context();
+	context.begin_query(objects_.size());
+
+	nodes.push(node_entry(distance_2d(node_box(&root_), pt), &root_));
+
+	while (!nodes.empty()) {
+		node_entry entry = nodes.top();
+		nodes.pop();
+
+		// every cell left is further than the current k-th object
+		double cutoff = (best.size() < k) ? max_distance : best.top().first;
+		if (entry.first > cutoff) {
+			break;
+		}
+
+		const q_node* node = entry.second;
+
+		if (!node->is_leaf()) {
+			const q_node* children = node->children();
+
+			for (size_t i = 0; i < node->children_count(); ++i) {
+				double distance = distance_2d(node_box(children + i), pt);
+				if (distance <= cutoff) {
+					nodes.push(node_entry(distance, children + i));
+				}
+			}
+
+			continue;
+		}
+
+		const index_type* node_indices = leaf_begin(node);
+
+		for (size_t i = 0; i < node->count(); ++i) {
+			index_type index = node_indices[i];
+
+			if (false == context.mark(index)) {
+				continue;
+			}
+
+			// bounds distance never exceeds the exact one
+			cutoff = (best.size() < k) ? max_distance : best.top().first;
+			if (distance_2d(bounds_[index], pt) > cutoff) {
+				continue;
+			}
+
+			double distance = distance_2d(objects_[index], pt);
+			if (distance > cutoff || (best.size() == k && distance == cutoff)) {
+				continue;
+			}
+
+			if (best.size() == k) {
+				best.pop();
+			}
+
+			best.push(object_entry(distance, index));
+		}
+	}
+
+	neighbours.resize(best.size());
+	for (size_t i = best.size(); i > 0; --i) {
+		neighbours[i - 1] = neighbour(best.top().second, best.top().first);
+		best.pop();
+	}
+}
+
+template <typename T, typename Alloc, typename Instrument> inline bool
+rz_quadtree<T, Alloc, Instrument>::nearest(const point2d& pt, index_type& index, double max_distance) const {
+	neighbour_vector neighbours;
+	nearest(pt, 1, neighbours, max_distance);
+
+	if (neighbours.empty()) {
+		return false;
+	}
+
+	index = neighbours[0].first;
+	return true;
+}
+
+template <typename T, typename Alloc, typename Instrument> template <typename U, typename UAlloc, typename UInstrument, typename F> inline bool
+rz_quadtree<T, Alloc, Instrument>::join(const rz_quadtree<U, UAlloc, UInstrument>& other, F&& f, rz_thread_pool* pool) const {
+	typedef rz_quadtree<U, UAlloc, UInstrument> other_tree;
+	typedef std::pair<const q_node*, const typename other_tree::q_node*> node_pair;
+
+	static_assert(std::is_same<point2d, typename other_tree::point2d>::value, "rz_quadtree join needs trees of the same point type");
+
+	if (count() == 0 || other.count() == 0 || false == boxes_overlap(root_.box(), other.root_.box())) {
+		return true;
+	}
+
+	bool self = (const void*)this == (const void*)&other;
+
+	// with a pool the descent goes breadth first until there are enough
+	// independent node pairs to keep the workers busy, a task each. a self
+	// join pairs every leaf with itself only, see split_join_pair
+	std::vector<node_pair> node_pairs(1, node_pair(&root_, &other.root_));
+
+	if (pool) {
+		size_t tasks_count = 8 * (pool->size() + 1);
+		bool split = true;
+
+		while (split && node_pairs.size() < tasks_count) {
+			std::vector<node_pair> next;
+			split = false;
+
+			for (size_t i = 0; i < node_pairs.size(); ++i) {
+				if (node_pairs[i].first->is_leaf() && node_pairs[i].second->is_leaf()) {
+					next.push_back(node_pairs[i]);
+					continue;
+				}
+
+				split_join_pair<other_tree>(node_pairs[i].first, node_pairs[i].second, self, next);
+				split = true;
+			}
+
+			node_pairs.swap(next);
+		}
+	}
+
+	std::vector<std::vector<node_pair> > tasks_leaf_pairs(node_pairs.size());
+
+	auto run_task = [&](size_t task) {
+		join_nodes<other_tree>(node_pairs[task].first, node_pairs[task].second, self, tasks_leaf_pairs[task]);
+	};
+
+	if (pool && node_pairs.size() > 1) {
+		rz_task_group group(*pool);
+
+		for (size_t task = 0; task < node_pairs.size(); ++task) {
+			group.run([&run_task, task]() {
+				run_task(task);
+			});
+		}
+
+		group.wait();
+	}
+	else if (!node_pairs.empty()) {
+		run_task(0);
+	}
+
+	// leaf pairs grouped by the leaf of this tree. leaves are keyed by
+	// their slices, first and count, unique for leaves holding objects, so
+	// the order of the pairs doesn't depend on node addresses or on the pool
+	std::vector<node_pair> leaf_pairs;
+
+	for (size_t task = 0; task < tasks_leaf_pairs.size(); ++task) {
+		leaf_pairs.insert(leaf_pairs.end(), tasks_leaf_pairs[task].begin(), tasks_leaf_pairs[task].end());
+	}
+
+	std::sort(leaf_pairs.begin(), leaf_pairs.end(), [](const node_pair& a, const node_pair& b) {
+		return std::make_tuple(a.first->first(), a.first->count(), a.second->first(), a.second->count()) <
+			std::make_tuple(b.first->first(), b.first->count(), b.second->first(), b.second->count());
+	});
+
+	// leaves of this tree with a pair, their pairs are
+	// leaf_pairs[pairs_offsets[i]] to leaf_pairs[pairs_offsets[i + 1]]
+	std::vector<const q_node*> leaves;
+	std::vector<size_t> pairs_offsets;
+
+	for (size_t i = 0; i < leaf_pairs.size(); ++i) {
+		if (leaves.empty() || leaves.back() != leaf_pairs[i].first) {
+			leaves.push_back(leaf_pairs[i].first);
+			pairs_offsets.push_back(i);
+		}
+	}
+
+	pairs_offsets.push_back(leaf_pairs.size());
+
+	// which of these leaves hold every object, leaves_ranks[leaves_offsets[i]]
+	// on, in the order of leaves. only references of paired leaves are kept
+	std::vector<size_t> leaves_offsets(objects_.size() + 1, 0);
+	std::vector<size_t> leaves_ranks;
+
+	for (size_t l = 0; l < leaves.size(); ++l) {
+		const index_type* indices = leaf_begin(leaves[l]);
+
+		for (size_t i = 0; i < leaves[l]->count(); ++i) {
+			++leaves_offsets[indices[i] + 1];
+		}
+	}
+
+	for (size_t i = 0; i < objects_.size(); ++i) {
+		leaves_offsets[i + 1] += leaves_offsets[i];
+	}
+
+	leaves_ranks.resize(leaves_offsets[objects_.size()]);
+	std::vector<size_t> leaves_ends(leaves_offsets.begin(), leaves_offsets.end() - 1);
+
+	for (size_t l = 0; l < leaves.size(); ++l) {
+		const index_type* indices = leaf_begin(leaves[l]);
+
+		for (size_t i = 0; i < leaves[l]->count(); ++i) {
+			leaves_ranks[leaves_ends[indices[i]]++] = l;
+		}
+	}
+
+	// an object is joined in the first leaf holding it, so neighbours in
+	// the tree are joined one after another. pairs go to f as they are
+	// found, or to the buffer of a chunk when given one
+	auto join_leaves = [&](size_t first, size_t last, pair_vector* pairs) -> bool {
+		rz_query_scope scope;
+		rz_query_context& context = scope.context();
+
+		auto emit = [&f, pairs](index_type index, index_type other_index) -> bool {
+			if (pairs) {
+				pairs->push_back(std::make_pair(index, other_index));
+				return true;
+			}
+
+			return f(index, other_index);
+		};
+
+		for (size_t l = first; l < last; ++l) {
+			const index_type* indices = leaf_begin(leaves[l]);
+
+			for (size_t i = 0; i < leaves[l]->count(); ++i) {
+				index_type index = indices[i];
+
+				if (leaves_ranks[leaves_offsets[index]] != l) {
+					continue;
+				}
+
+				context.begin_query(other.objects_.size());
+
+				for (size_t k = leaves_offsets[index]; k < leaves_offsets[index + 1]; ++k) {
+					size_t rank = leaves_ranks[k];
+
+					for (size_t p = pairs_offsets[rank]; p < pairs_offsets[rank + 1]; ++p) {
+						if (!join_object(index, leaves[rank], other, leaf_pairs[p].second, self, context, emit)) {
+							return false;
+						}
+					}
+				}
+			}
+		}
+
+		return true;
+	};
+
+	if (!pool || leaves.size() < 2) {
+		return join_leaves(0, leaves.size(), NULL);
+	}
+
+	// leaves in chunks run as pool tasks, a chunk keeps its pairs
+	size_t chunk_size = std::max((size_t)1, std::min((size_t)64, leaves.size() / (8 * (pool->size() + 1))));
+	size_t chunks_count = (leaves.size() + chunk_size - 1) / chunk_size;
+	std::vector<pair_vector> chunks_pairs(chunks_count);
+
+	rz_task_group group(*pool);
+
+	for (size_t chunk = 0; chunk < chunks_count; ++chunk) {
+		group.run([&join_leaves, &chunks_pairs, &leaves, chunk, chunk_size]() {
+			size_t first = chunk * chunk_size;
+			join_leaves(first, std::min(first + chunk_size, leaves.size()), &chunks_pairs[chunk]);
+		});
+	}
+
+	group.wait();
+
+	for (size_t chunk = 0; chunk < chunks_count; ++chunk) {
+		const pair_vector& pairs = chunks_pairs[chunk];
+
+		for (size_t i = 0; i < pairs.size(); ++i) {
+			if (!f(pairs[i].first, pairs[i].second)) {
+				return false;
+			}
+		}
+	}
+
+	return true;
+}
+
+template <typename T, typename Alloc, typename Instrument> template <typename Other> inline void
+rz_quadtree<T, Alloc, Instrument>::split_join_pair(const q_node* node, const typename Other::q_node* other_node, bool self,
+	std::vector<std::pair<const q_node*, const typename Other::q_node*> >& node_pairs) const {
+	typedef std::pair<const q_node*, const typename Other::q_node*> node_pair;
+
+	// objects touching at a point are both stored in every leaf holding
+	// that point, so a self join only pairs every node with itself
+	if (self) {
+		for (size_t i = 0; i < node->children_count(); ++i) {
+			node_pairs.push_back(node_pair(node->children() + i, other_node->children() + i));
+		}
+
+		return;
+	}
+
+	// the internal node with the bigger cell is split, so both sides go
+	// down at about the same pace
+	const aabb2d& box = node->box();
+	const aabb2d& other_box = other_node->box();
+
+	if (!node->is_leaf() && (other_node->is_leaf() || box.width() + box.height() >= other_box.width() + other_box.height())) {
+		for (size_t i = 0; i < node->children_count(); ++i) {
+			const q_node* child = node->children() + i;
+
+			if (boxes_overlap(child->box(), other_box)) {
+				node_pairs.push_back(node_pair(child, other_node));
+			}
+		}
+	}
+	else {
+		for (size_t i = 0; i < other_node->children_count(); ++i) {
+			const typename Other::q_node* other_child = other_node->children() + i;
+
+			if (boxes_overlap(box, other_child->box())) {
+				node_pairs.push_back(node_pair(node, other_child));
+			}
+		}
+	}
+}
+
+template <typename T, typename Alloc, typename Instrument> template <typename Other> inline void
+rz_quadtree<T, Alloc, Instrument>::join_nodes(const q_node* node, const typename Other::q_node* other_node, bool self,
+	std::vector<std::pair<const q_node*, const typename Other::q_node*> >& leaf_pairs) const {
+	typedef std::pair<const q_node*, const typename Other::q_node*> node_pair;
+
+	// node pairs given here have overlapping cells, leaf pairs without
+	// objects on either side are dropped
+	std::vector<node_pair> node_pairs(1, node_pair(node, other_node));
+
+	while (!node_pairs.empty()) {
+		node_pair current = node_pairs.back();
+		node_pairs.pop_back();
+
+		if (!current.first->is_leaf() || !current.second->is_leaf()) {
+			split_join_pair<Other>(current.first, current.second, self, node_pairs);
+		}
+		else if (!current.first->empty() && !current.second->empty()) {
+			leaf_pairs.push_back(current);
+		}
+	}
+}
+
+template <typename T, typename Alloc, typename Instrument> template <typename Other, typename E> inline bool
+rz_quadtree<T, Alloc, Instrument>::join_object(index_type index, const q_node* leaf, const Other& other, const typename Other::q_node* other_leaf, bool self,
+	rz_query_context& context, E& emit) const {
+	// object bounds clipped to the common part of the cells filter the
+	// other leaf. objects touching at a point are found at least in the
+	// leaves holding it, so the parts outside these cells aren't needed
+	const aabb2d& bounds = bounds_[index];
+	const aabb2d& box = leaf->box();
+	const aabb2d& other_box = other_leaf->box();
+
+	rz_bounds_query query(std::max(bounds.min.x, std::max(box.min.x, other_box.min.x)), std::max(bounds.min.y, std::max(box.min.y, other_box.min.y)),
+		std::min(bounds.max.x, std::min(box.max.x, other_box.max.x)), std::min(bounds.max.y, std::min(box.max.y, other_box.max.y)));
+
+	if (query.box[0] > query.box[2] || query.box[1] > query.box[3]) {
+		return true;
+	}
+
+	const index_type* other_indices = other.leaf_begin(other_leaf);
+	uint32_t positions[leaf_filter_block];
+
+	for (size_t first = 0; first < other_leaf->count(); first += leaf_filter_block) {
+		size_t found = other.filter_leaf(other_leaf, first, std::min(leaf_filter_block, other_leaf->count() - first), query, positions);
+
+		for (size_t i = 0; i < found; ++i) {
+			index_type other_index = other_indices[first + positions[i]];
+
+			// a self join reports a pair from its smaller index
+			if ((self && other_index <= index) || false == context.mark(other_index)) {
+				continue;
+			}
+
+			if (intersect_2d(objects_[index], other.objects_[other_index]) && !emit(index, other_index)) {
+				return false;
+			}
+		}
+	}
+
+	return true;
+}
+
+template <typename T, typename Alloc, typename Instrument> template <typename F> inline bool
+rz_quadtree<T, Alloc, Instrument>::visit_point(const point2d& pt, unsigned int flags, F& visitor) const {
+	query_probe probe(instrumentation_, RZ_POINT_QUERY);
+
+	// check wether we hit actual data bbox
+	aabb2d box(min_, max_);
+	if (false == intersect_2d(box, pt) || false == intersect_node_with_point(pt, &root_)) {
+		return true;
+	}
+
+	auto emit_visitor = [&probe, &visitor](index_type index) -> bool {
+		probe.emit();
+		return visitor(index);
+	};
+
+	if (flags & RZ_QUERY_EXACT) {
+		// leaf bounds filter rejects most of the leaf before the exact test
+		rz_bounds_query filter(pt.x, pt.y, pt.x, pt.y);
+
+		auto exact_visitor = [this, &pt, &probe, &emit_visitor](index_type index) -> bool {
+			probe.exact_test();
+
+			if (false == intersect_2d(objects_[index], pt)) {
+				return true;
+			}
+
+			return emit_visitor(index);
+		};
+
+		return intersect_tree_with_point(pt, &root_, &filter, probe, exact_visitor);
+	}
+
+	return intersect_tree_with_point(pt, &root_, NULL, probe, emit_visitor);
+}
+
+template <typename T, typename Alloc, typename Instrument> template <typename F> inline bool
+rz_quadtree<T, Alloc, Instrument>::visit_aabb(const aabb2d& aabb, unsigned int flags, rz_query_context& context, F& visitor) const {
+	query_probe probe(instrumentation_, RZ_AABB_QUERY);
+
+	// check wether we hit actual data bbox
+	aabb2d box(min_, max_);
+	if (false == boxes_overlap(box, aabb) || false == intersect_node_with_aabb(aabb, &root_)) {
+		return true;
+	}
+
+	rz_query_context* unique_context = NULL;
+
+	if (flags & RZ_QUERY_UNIQUE) {
+		context.begin_query(objects_.size());
+		unique_context = &context;
+	}
+
+	auto emit_visitor = [&probe, &visitor](index_type index) -> bool {
+		probe.emit();
+		return visitor(index);
+	};
+
+	if (flags & RZ_QUERY_EXACT) {
+		// leaf bounds filter and duplicates are dropped before this, so
+		// every object is tested once
+		rz_bounds_query filter(aabb.min.x, aabb.min.y, aabb.max.x, aabb.max.y);
+
+		auto exact_visitor = [this, &aabb, &probe, &emit_visitor](index_type index) -> bool {
+			probe.exact_test();
+
+			if (false == intersect_2d(aabb, objects_[index])) {
+				return true;
+			}
+
+			return emit_visitor(index);
+		};
+
+		return intersect_tree_with_aabb(aabb, &root_, unique_context, &filter, probe, exact_visitor);
+	}
+
+	return intersect_tree_with_aabb(aabb, &root_, unique_context, NULL, probe, emit_visitor);
+}
+
+template <typename T, typename Alloc, typename Instrument> template <typename F> inline bool
+rz_quadtree<T, Alloc, Instrument>::intersect_tree_with_point(const point2d& pt, const q_node* node, const rz_bounds_query* filter, query_probe& probe, F& visitor) const {
+	// node is known to contain the point, descend to the leaf
+	while (!node->is_leaf()) {
+		probe.node();
+
+		// first present child holding the point, it has every object
+		// touching the point. none means the point is in empty quadrants
+		const q_node* children = node->children();
+		size_t i = 0;
+
+		while (i < node->children_count() && !intersect_node_with_point(pt, children + i)) {
+			++i;
+		}
+
+		if (i == node->children_count()) {
+			return true;
+		}
+
+		node = children + i;
+	}
+
+	probe.node();
+	probe.leaf();
+
+	const index_type* node_indices = leaf_begin(node);
+
+	if (filter) {
+		uint32_t positions[leaf_filter_block];
+
+		for (size_t first = 0; first < node->count(); first += leaf_filter_block) {
+			size_t found = filter_leaf(node, first, std::min(leaf_filter_block, node->count() - first), *filter, positions);
+
+			for (size_t i = 0; i < found; ++i) {
+				if (!visitor(node_indices[first + positions[i]])) {
+					return false;
+				}
+			}
+		}
+
+		return true;
+	}
+
+	for (size_t i = 0; i < node->count(); ++i) {
+		if (!visitor(node_indices[i])) {
+			return false;
+		}
+	}
+
+	return true;
+}
+
+template <typename T, typename Alloc, typename Instrument> inline void
+rz_quadtree<T, Alloc, Instrument>::intersect_tree_with_points(const q_node* node, const point2d* points, uint32_t* queries, uint32_t* scratch, unsigned char* children, size_t count,
+	unsigned int flags, index_vector& results, std::vector<std::pair<size_t, size_t> >& ranges) const {
+	// every query of the range is known to be inside the node
+	if (node->is_leaf()) {
+		const index_type* node_indices = leaf_begin(node);
+
+		for (size_t i = 0; i < count; ++i) {
+			const point2d& pt = points[queries[i]];
+			size_t first = results.size();
+
+			if (flags & RZ_QUERY_EXACT) {
+				rz_bounds_query filter(pt.x, pt.y, pt.x, pt.y);
+				uint32_t positions[leaf_filter_block];
+
+				for (size_t block = 0; block < node->count(); block += leaf_filter_block) {
+					size_t found = filter_leaf(node, block, std::min(leaf_filter_block, node->count() - block), filter, positions);
+
+					for (size_t j = 0; j < found; ++j) {
+						index_type index = node_indices[block + positions[j]];
+
+						if (intersect_2d(objects_[index], pt)) {
+							results.push_back(index);
+						}
+					}
+				}
+			}
+			else {
+				results.insert(results.end(), node_indices, node_indices + node->count());
+			}
+
+			ranges[queries[i]] = std::make_pair(first, results.size() - first);
+		}
+
+		return;
+	}
+
+	// same child choice as the single point descent, first present child
+	// holding the point
+	aabb2d sub_boxes[4];
+	get_children_boxes(node, sub_boxes);
+
+	size_t counts[5] = { 0, 0, 0, 0, 0 };
+
+	for (size_t i = 0; i < count; ++i) {
+		const point2d& pt = points[queries[i]];
+		unsigned char child = 4;
+
+		for (unsigned char j = 0; j < 4; ++j) {
+			if (node->has_child(j) && intersect_2d(sub_boxes[j], pt)) {
+				child = j;
+				break;
+			}
+		}
+
+		children[i] = child;
+		++counts[child];
+	}
+
+	// stable split into per child ranges, z-order is kept inside each one
+	size_t firsts[5];
+	size_t offsets[5];
+	firsts[0] = 0;
+
+	for (size_t i = 1; i < 5; ++i) {
+		firsts[i] = firsts[i - 1] + counts[i - 1];
+	}
+
+	std::copy(firsts, firsts + 5, offsets);
+
+	for (size_t i = 0; i < count; ++i) {
+		scratch[offsets[children[i]]++] = queries[i];
+	}
+
+	std::copy(scratch, scratch + count, queries);
+
+	for (size_t i = 0; i < 4; ++i) {
+		if (counts[i] > 0) {
+			intersect_tree_with_points(node->child(i), points, queries + firsts[i], scratch + firsts[i], children + firsts[i], counts[i], flags, results, ranges);
+		}
+	}
+}
+
+template <typename T, typename Alloc, typename Instrument> template <typename F> inline bool
+rz_quadtree<T, Alloc, Instrument>::intersect_tree_with_aabb(const aabb2d& aabb, const q_node* node, rz_query_context* unique_context, const rz_bounds_query* filter,
+	query_probe& probe, F& visitor) const {
+	if (!node) {
+		throw std::runtime_error("rz_quadtree get_objects_from_aabb received null node!");
+	}
+
+	probe.node();
+
+	// node is known to intersect the aabb
+	if (node->is_leaf()) {
+		probe.leaf();
+
+		const index_type* node_indices = leaf_begin(node);
+
+		if (filter) {
+			uint32_t positions[leaf_filter_block];
+
+			for (size_t first = 0; first < node->count(); first += leaf_filter_block) {
+				size_t found = filter_leaf(node, first, std::min(leaf_filter_block, node->count() - first), *filter, positions);
+
+				for (size_t i = 0; i < found; ++i) {
+					index_type index = node_indices[first + positions[i]];
+
+					if (unique_context && false == unique_context->mark(index)) {
+						continue;
+					}
+
+					if (!visitor(index)) {
+						return false;
+					}
+				}
+			}
+
+			return true;
+		}
+
+		for (size_t i = 0; i < node->count(); ++i) {
+			if (unique_context && false == unique_context->mark(node_indices[i])) {
+				continue;
+			}
+
+			if (!visitor(node_indices[i])) {
+				return false;
+			}
+		}
+
+		return true;
+	}
+
+	// absent quadrants hold no objects
+	const q_node* children = node->children();
+
+	for (size_t i = 0; i < node->children_count(); ++i) {
+		if (intersect_node_with_aabb(aabb, children + i) && !intersect_tree_with_aabb(aabb, children + i, unique_context, filter, probe, visitor)) {
+			return false;
+		}
+	}
+
+	return true;
+}
+	
+template <typename T, typename Alloc, typename Instrument> template <typename F> inline bool
+rz_quadtree<T, Alloc, Instrument>::visit_line(const line2d& line, F& visitor) const {
+	double t_in, t_out;
+	if (objects_.empty() || false == clip_2d(line, node_box(&root_), t_in, t_out)) {
+		return true;
+	}
+
+	// objects are reported once, from the leaf where the segment first touches them
+	rz_query_scope scope;
+	rz_query_context& context = scope.context();
+	context.begin_query(objects_.size());
+
+	return intersect_tree_with_line(line, &root_, t_out, context, context.line_hits(), visitor);
+}
+
+template <typename T, typename Alloc, typename Instrument> template <typename F> inline bool
+rz_quadtree<T, Alloc, Instrument>::intersect_tree_with_line(const line2d& line, const q_node* node, double t_out, rz_query_context& context, hit_vector& hits, F& visitor) const {
+	if (!node) {
+		throw std::runtime_error("rz_quadtree get_objects_from_line received null node!");
+	}
+
+	if (node->is_leaf()) {
+		const index_type* node_indices = leaf_begin(node);
+		hits.clear();
+
+		// leaves are visited front to back, so everything touched before the
+		// segment leaves this cell comes before anything in the next cells.
+		// objects first touched further along are left to later leaves
+		for (size_t i = 0; i < node->count(); ++i) {
+			index_type index = node_indices[i];
+
+			if (context.marked(index)) {
+				continue;
+			}
+
+			double t_bounds_in, t_bounds_out;
+			if (false == clip_2d(line, bounds_[index], t_bounds_in, t_bounds_out)) {
+				context.mark(index);
+				continue;
+			}
+
+			if (t_bounds_in > t_out + EPS) {
+				continue;
+			}
+
+			double t = 0.0;
+			if (false == intersect_2d(line, objects_[index], t)) {
+				context.mark(index);
+				continue;
+			}
+
+			if (t > t_out + EPS) {
+				continue;
+			}
+
+			context.mark(index);
+			hits.push_back(std::make_pair(t, index));
+		}
+
+		std::sort(hits.begin(), hits.end());
+
+		for (size_t i = 0; i < hits.size(); ++i) {
+			if (!visitor(hits[i].second, hits[i].first)) {
+				return false;
+			}
+		}
+
+		return true;
+	}
+
+	// children crossed by the segment, ordered by where it enters them
+	const q_node* children = node->children();
+	double children_in[4];
+	double children_out[4];
+	size_t order[4];
+	size_t count = 0;
+
+	for (size_t i = 0; i < node->children_count(); ++i) {
+		if (false == clip_2d(line, node_box(children + i), children_in[i], children_out[i])) {
+			continue;
+		}
+
+		size_t j = count++;
+		for (; j > 0 && children_in[order[j - 1]] > children_in[i]; --j) {
+			order[j] = order[j - 1];
+		}
+
+		order[j] = i;
+	}
+
+	for (size_t i = 0; i < count; ++i) {
+		if (!intersect_tree_with_line(line, children + order[i], children_out[order[i]], context, hits, visitor)) {
+			return false;
+		}
+	}
+
+	return true;
+}
+
+template <typename T, typename Alloc, typename Instrument> inline bool
+rz_quadtree<T, Alloc, Instrument>::intersect_node_with_point(const point2d& pt, const q_node* node) const {
+	if (!node) {
+		throw std::runtime_error("rz_quadtree intersect_node_with_point received null node!");
+	}
+
+	return intersect_2d(node->box(), pt);
+}
+
+template <typename T, typename Alloc, typename Instrument> inline bool
+rz_quadtree<T, Alloc, Instrument>::intersect_node_with_aabb(const aabb2d& aabb, const q_node* node) const {
+	if (!node) {
+		throw std::runtime_error("rz_quadtree intersect_node_with_aabb received null node!");
+	}
+
+	// closed, like the object tests, so a flat query box still finds the
+	// objects lying along it
+	return boxes_overlap(node->box(), aabb);
+}
+
+template <typename T, typename Alloc, typename Instrument> inline typename rz_quadtree<T, Alloc, Instrument>::aabb2d
+rz_quadtree<T, Alloc, Instrument>::node_box(const q_node* node) const {
+	return node->box();
+}
+
+// join(tree_a, tree_b, f) is tree_a.join(tree_b, f), join(tree, tree, f)
+// is the self join
+template <typename TA, typename AllocA, typename InstrumentA, typename TB, typename AllocB, typename InstrumentB, typename F>
+inline bool join(const rz_quadtree<TA, AllocA, InstrumentA>& tree_a, const rz_quadtree<TB, AllocB, InstrumentB>& tree_b, F&& f, rz_thread_pool* pool = NULL) {
+	return tree_a.join(tree_b, std::forward<F>(f), pool);
 }
 
 } // namespace rimz
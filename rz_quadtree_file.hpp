@@ -0,0 +1,90 @@
+/** @file rz_quadtree_file.hpp */
+// classes: rz_quadtree_file_header, rz_quadtree_file_node
+// description: binary index format written by rz_quadtree::save and
+// mapped by rz_mapped_quadtree. all sections are addressed by offsets
+// from the start of the file, so the image is position independent and
+// can be used in place. layout:
+//   header | nodes | leaf indices | objects bounds | objects
+// every section starts at a 16 byte aligned offset. nodes are stored
+// breadth first, the present children of a node (of A, B, C, D) are
+// stored one after another. numbers are in the byte order of the writing host,
+// readers reject files written with another byte order.
+// last updated: aug.28.2011
+
+// Copyright (C) 2011 Rim Zaidullin <tinybit@yandex.ru>
+
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+
+#ifndef _RZ_QUADTREE_FILE_HPP_INCLUDED_
+#define _RZ_QUADTREE_FILE_HPP_INCLUDED_
+
+#include <stdint.h>
+
+namespace rimz {
+
+static const char RZ_QUADTREE_FILE_MAGIC[8] = { 'R', 'Z', 'Q', 'T', 'R', 'E', 'E', '\0' };
+static const uint32_t RZ_QUADTREE_FILE_VERSION = 1;
+static const uint32_t RZ_QUADTREE_FILE_BYTE_ORDER = 0x01020304;
+
+struct rz_quadtree_file_header {
+	char magic[8];
+	uint32_t version;
+	uint32_t byte_order;
+
+	// element sizes, a reader must be instantiated with the same types
+	uint32_t header_size;
+	uint32_t node_size;
+	uint32_t object_size;
+	uint32_t bounds_size;
+
+	uint64_t nodes_count;
+	uint64_t indices_count;
+	uint64_t objects_count;
+
+	uint64_t nodes_offset;
+	uint64_t indices_offset;
+	uint64_t bounds_offset;
+	uint64_t objects_offset;
+	uint64_t file_size;
+
+	// tree geometry and build parameters
+	double min_x;
+	double min_y;
+	double max_x;
+	double max_y;
+	uint64_t objects_threshold;
+	uint64_t depth_threshold;
+};
+
+// cells aren't always squares, split points are anywhere inside them.
+// internal nodes only have children in non empty quadrants
+struct rz_quadtree_file_node {
+	double min_x;
+	double min_y;
+	double max_x;
+	double max_y;
+	uint32_t first;		// leaf: first leaf index, internal: first child node
+	uint32_t count;		// leaf: number of leaf indices
+	uint32_t leaf;
+	uint32_t children;	// internal: mask of present children, bit 0 is A
+};
+
+inline uint64_t rz_quadtree_file_align(uint64_t offset) {
+	return (offset + 15) & ~(uint64_t)15;
+}
+
+} // namespace rimz
+
+#endif // _RZ_QUADTREE_FILE_HPP_INCLUDED_
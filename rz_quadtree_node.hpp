@@ -1,7 +1,10 @@
 /** @file rz_quadtree_node.hpp */
-// class: rz_quadtree_node
-// description: class used as quadtree node (KO), can store list
-// of any objects that you specify
+// classes: rz_quadtree_node, rz_quadtree_node_arena
+// description: class used as quadtree node (KO), leaf nodes refer to a
+// slice of the index buffer owned by the tree, indices point into the
+// object array owned by the tree. children are only made for quadrants
+// with objects, a mask tells which ones exist. siblings are allocated
+// together from an arena, the arena releases them all at once.
 // last updated: aug.28.2011
 
 // Copyright (C) 2011 Rim Zaidullin <tinybit@yandex.ru>
@@ -23,36 +26,70 @@
 #ifndef _RZ_QUADTREE_NODE_HPP_INCLUDED_
 #define _RZ_QUADTREE_NODE_HPP_INCLUDED_
 
+#include <new>
 #include <cmath>
 #include <memory>
 #include <vector>
+#include <utility>
+#include <type_traits>
+#include <stdint.h>
 
 #include "rz_geometry_structs.hpp"
 
 namespace rimz {
 
+// children masks have 4 bits, bit i for child i (A, B, C, D). tables
+// instead of compiler builtins keep the header portable
+inline size_t children_mask_count(unsigned int mask) {
+	static const unsigned char counts[16] = { 0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4 };
+	return counts[mask & 15];
+}
+
+// first child of a non empty mask
+inline size_t children_mask_first(unsigned int mask) {
+	static const unsigned char firsts[16] = { 0, 0, 1, 0, 2, 0, 1, 0, 3, 0, 1, 0, 2, 0, 1, 0 };
+	return firsts[mask & 15];
+}
+
 template <typename T>
 class rz_quadtree_node {
 public:
 	typedef typename T::point_type point2d;
-	rz_quadtree_node() : is_leaf_(false), parent_(NULL) {
+	typedef rz_aabb<point2d> aabb2d;
+	typedef uint32_t index_type;
+	typedef std::vector<index_type> index_vector;
+
+	rz_quadtree_node() : children_(NULL), first_(0), count_(0), capacity_(0), is_leaf_(false), children_mask_(0) {
 	};
 
-	virtual ~rz_quadtree_node() {}
+	bool empty() const {
+		return count_ == 0;
+	}
+
+	// leaf slice of the tree's index buffer, internal nodes keep it empty
+	size_t first() const {
+		return first_;
+	}
+
+	size_t count() const {
+		return count_;
+	}
 
-	bool empty() {
-		return objects_list_.empty();
+	size_t capacity() const {
+		return capacity_;
 	}
 
-	std::vector<T>& objects_list() {
-		return objects_list_;
+	void set_slice(size_t first, size_t count, size_t capacity) {
+		first_ = first;
+		count_ = (index_type)count;
+		capacity_ = (index_type)capacity;
 	}
 
-	void set_objects_list(const std::vector<T>& objects_list) {
-		objects_list_.assign(objects_list.begin(), objects_list.end());
+	void set_count(size_t count) {
+		count_ = (index_type)count;
 	}
 
-	bool is_leaf() {
+	bool is_leaf() const {
 		return is_leaf_;
 	}
 
@@ -60,59 +97,219 @@ public:
 		is_leaf_ = value;
 	}
 
-	const rz_quadtree_node* parent() {
-		return parent_;
+	// present children, bit i for child i (A, B, C, D). absent quadrants
+	// hold no objects, they have no node
+	unsigned int children_mask() const {
+		return children_mask_;
 	}
 
-	void set_parent(rz_quadtree_node* parent) {
-		parent_ = parent;
+	bool has_child(size_t index) const {
+		return (children_mask_ >> index) & 1;
 	}
 
-	void create_children() {
-		child_a_.reset(new rz_quadtree_node<T>());
-		child_b_.reset(new rz_quadtree_node<T>());
-		child_c_.reset(new rz_quadtree_node<T>());
-		child_d_.reset(new rz_quadtree_node<T>());
+	size_t children_count() const {
+		return children_mask_count(children_mask_);
 	}
 
-	rz_quadtree_node<T>* child_a() {
-		return child_a_.get();
+	// block of the present children in A, B, C, D order, NULL for leaves
+	rz_quadtree_node<T>* children() const {
+		return children_;
 	}
 
-	rz_quadtree_node<T>* child_b() {
-		return child_b_.get();
+	void set_children(rz_quadtree_node<T>* children, unsigned int mask) {
+		children_ = children;
+		children_mask_ = (unsigned char)mask;
 	}
 
-	rz_quadtree_node<T>* child_c() {
-		return child_c_.get();
+	// child in a present quadrant
+	rz_quadtree_node<T>* child(size_t index) const {
+		return children_ + children_mask_count(children_mask_ & ((1u << index) - 1));
 	}
 
-	rz_quadtree_node<T>* child_d() {
-		return child_d_.get();
+	// cell of the node. children cells share the split point of their
+	// parent, which isn't necessarily the middle of its cell
+	const aabb2d& box() const {
+		return box_;
 	}
 
-	void set_dimentions(const point2d& origin, double& size) {
-		origin_ = origin;
-		size_ = size;
+	void set_box(const aabb2d& box) {
+		box_ = box;
 	}
 
-	void get_dimentions(point2d& origin, double& size) {
-		origin = origin_;
-		size = size_;
+private:
+	aabb2d box_;
+	rz_quadtree_node<T>* children_;
+
+	size_t first_;
+	index_type count_;
+	index_type capacity_;
+
+	bool is_leaf_;
+	unsigned char children_mask_;
+};
+
+// hands out blocks of one to four sibling nodes. memory is taken from the
+// allocator in chunks, every chunk twice as big as the previous one, so
+// a tree of n nodes costs O(log n) allocations. blocks given back are
+// kept for reuse by size, memory returns to the allocator only with the
+// arena.
+// nodes are never destroyed one by one, they must be trivially
+// destructible. not thread safe, parallel builds give every task an
+// arena of its own and splice them together afterwards.
+template <typename N, typename Alloc = std::allocator<N> >
+class rz_quadtree_node_arena {
+public:
+	typedef typename std::allocator_traits<Alloc>::template rebind_alloc<N> node_allocator;
+
+	explicit rz_quadtree_node_arena(const Alloc& allocator = Alloc()) :
+	allocator_(allocator), used_(0), capacity_(0), blocks_count_(0), nodes_count_(0) {
+	}
+
+	~rz_quadtree_node_arena() {
+		clear();
+	}
+
+	// count default constructed nodes, count is 1 to 4
+	N* allocate(size_t count) {
+		N* block;
+		std::vector<N*>& free_blocks = free_blocks_[count - 1];
+
+		if (!free_blocks.empty()) {
+			block = free_blocks.back();
+			free_blocks.pop_back();
+		}
+		else {
+			if (used_ + count > capacity_) {
+				add_chunk();
+			}
+
+			block = chunks_.back().first + used_;
+			used_ += count;
+		}
+
+		for (size_t i = 0; i < count; ++i) {
+			new (block + i) N();
+		}
+
+		++blocks_count_;
+		nodes_count_ += count;
+		return block;
+	}
+
+	void deallocate(N* block, size_t count) {
+		free_blocks_[count - 1].push_back(block);
+		--blocks_count_;
+		nodes_count_ -= count;
+	}
+
+	// takes over the memory and blocks of other, which is left empty.
+	// blocks of other stay where they are, so nodes keep their addresses.
+	// both arenas must use equal allocators
+	void splice(rz_quadtree_node_arena& other) {
+		if (other.chunks_.empty()) {
+			return;
+		}
+
+		// the unused end of other's last chunk becomes free blocks
+		N* tail = other.chunks_.back().first + other.used_;
+		for (size_t left = other.capacity_ - other.used_; left > 0;) {
+			size_t count = left < 4 ? left : 4;
+			free_blocks_[count - 1].push_back(tail);
+			tail += count;
+			left -= count;
+		}
+
+		// this arena keeps allocating from its own last chunk, if it has one
+		typename std::vector<std::pair<N*, size_t> >::iterator position = chunks_.empty() ? chunks_.end() : chunks_.end() - 1;
+		chunks_.insert(position, other.chunks_.begin(), other.chunks_.end());
+
+		for (size_t i = 0; i < 4; ++i) {
+			free_blocks_[i].insert(free_blocks_[i].end(), other.free_blocks_[i].begin(), other.free_blocks_[i].end());
+			other.free_blocks_[i].clear();
+		}
+
+		blocks_count_ += other.blocks_count_;
+		nodes_count_ += other.nodes_count_;
+
+		other.chunks_.clear();
+		other.used_ = 0;
+		other.capacity_ = 0;
+		other.blocks_count_ = 0;
+		other.nodes_count_ = 0;
+	}
+
+	node_allocator get_allocator() const {
+		return allocator_;
+	}
+
+	// releases every block at once
+	void clear() {
+		for (size_t i = 0; i < chunks_.size(); ++i) {
+			std::allocator_traits<node_allocator>::deallocate(allocator_, chunks_[i].first, chunks_[i].second);
+		}
+
+		chunks_.clear();
+		for (size_t i = 0; i < 4; ++i) {
+			free_blocks_[i].clear();
+		}
+
+		used_ = 0;
+		capacity_ = 0;
+		blocks_count_ = 0;
+		nodes_count_ = 0;
+	}
+
+	size_t blocks_count() const {
+		return blocks_count_;
+	}
+
+	// nodes in the blocks in use
+	size_t nodes_count() const {
+		return nodes_count_;
+	}
+
+	// memory taken from the allocator, free blocks included
+	size_t allocated_bytes() const {
+		size_t bytes = chunks_.capacity() * sizeof(chunks_[0]);
+
+		for (size_t i = 0; i < 4; ++i) {
+			bytes += free_blocks_[i].capacity() * sizeof(N*);
+		}
+
+		for (size_t i = 0; i < chunks_.size(); ++i) {
+			bytes += chunks_[i].second * sizeof(N);
+		}
+
+		return bytes;
 	}
 
 private:
-	std::vector<T> objects_list_;
-	bool is_leaf_;
-	rz_quadtree_node<T>* parent_;
+	rz_quadtree_node_arena(const rz_quadtree_node_arena&);
+	rz_quadtree_node_arena& operator = (const rz_quadtree_node_arena&);
+
+	void add_chunk() {
+		static_assert(std::is_trivially_destructible<N>::value, "rz_quadtree_node_arena needs trivially destructible nodes");
 
-	std::auto_ptr<rz_quadtree_node<T> > child_a_;
-	std::auto_ptr<rz_quadtree_node<T> > child_b_;
-	std::auto_ptr<rz_quadtree_node<T> > child_c_;
-	std::auto_ptr<rz_quadtree_node<T> > child_d_;
+		// the end of the last chunk is kept as a free block
+		if (used_ < capacity_) {
+			free_blocks_[capacity_ - used_ - 1].push_back(chunks_.back().first + used_);
+		}
+
+		size_t chunk_size = chunks_.empty() ? 64 : chunks_.back().second * 2;
+		N* chunk = std::allocator_traits<node_allocator>::allocate(allocator_, chunk_size);
+
+		chunks_.push_back(std::make_pair(chunk, chunk_size));
+		used_ = 0;
+		capacity_ = chunk_size;
+	}
 
-	point2d origin_;
-	double size_;
+	node_allocator allocator_;
+	std::vector<std::pair<N*, size_t> > chunks_;	// memory and nodes count
+	std::vector<N*> free_blocks_[4];	// by nodes count - 1
+	size_t used_;		// nodes taken from the last chunk
+	size_t capacity_;	// nodes in the last chunk
+	size_t blocks_count_;	// blocks in use
+	size_t nodes_count_;	// nodes in the blocks in use
 };
 
 } // namespace rimz
@@ -0,0 +1,141 @@
+/** @file rz_query.hpp */
+// classes: rz_query_context, rz_query_scope
+// description: query flags and per-thread query state shared by the trees
+// last updated: aug.28.2011
+
+// Copyright (C) 2011 Rim Zaidullin <tinybit@yandex.ru>
+
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+
+#ifndef _RZ_QUERY_HPP_INCLUDED_
+#define _RZ_QUERY_HPP_INCLUDED_
+
+#include <vector>
+#include <memory>
+#include <utility>
+#include <algorithm>
+#include <stdint.h>
+
+namespace rimz {
+
+// query modifiers, can be or-ed together
+enum rz_query_flags {
+	RZ_QUERY_DEFAULT = 0,
+	RZ_QUERY_UNIQUE = 1,		// report each object once, even if it's stored in several leaves
+	RZ_QUERY_EXACT = 2		// report only objects that really contain the point / intersect the aabb
+};
+
+// scratch state of a query, keeps a per-object stamp of the last query
+// that reported the object. a context is reused from query to query
+// (and from tree to tree), so it allocates only when it meets a bigger
+// tree. one context serves one query at a time, concurrent queries must
+// use separate contexts. queries given no context take one from
+// rz_query_scope, thread_context() is a context per thread for callers
+// passing it explicitly, it's never used by the trees themselves.
+class rz_query_context {
+public:
+	rz_query_context() : epoch_(0) {}
+
+	// starts a new query over objects_count objects
+	void begin_query(size_t objects_count) {
+		if (stamps_.size() < objects_count) {
+			stamps_.resize(objects_count, 0);
+		}
+
+		if (++epoch_ == 0) {
+			std::fill(stamps_.begin(), stamps_.end(), 0);
+			epoch_ = 1;
+		}
+	}
+
+	bool marked(uint32_t index) const {
+		return stamps_[index] == epoch_;
+	}
+
+	// true if object wasn't reported yet by the current query
+	bool mark(uint32_t index) {
+		if (stamps_[index] == epoch_) {
+			return false;
+		}
+
+		stamps_[index] = epoch_;
+		return true;
+	}
+
+	// hits of a line query in the leaf it is in, as (t along the segment,
+	// object index). kept here so line queries reuse its capacity
+	std::vector<std::pair<double, uint32_t> >& line_hits() {
+		return line_hits_;
+	}
+
+	static rz_query_context& thread_context() {
+		static thread_local rz_query_context context;
+		return context;
+	}
+
+private:
+	std::vector<uint32_t> stamps_;
+	std::vector<std::pair<double, uint32_t> > line_hits_;
+	uint32_t epoch_;
+};
+
+// context of the calling thread for one query, taken from a per-thread
+// stack for the scope's lifetime. a query started from the callback of
+// another one gets the next context of the stack, so it doesn't restart
+// the outer query. contexts stay allocated for the thread's next queries
+class rz_query_scope {
+public:
+	rz_query_scope() : context_(push()) {}
+
+	~rz_query_scope() {
+		--thread_stack().depth;
+	}
+
+	rz_query_context& context() {
+		return context_;
+	}
+
+private:
+	rz_query_scope(const rz_query_scope&);
+	rz_query_scope& operator = (const rz_query_scope&);
+
+	struct context_stack {
+		context_stack() : depth(0) {}
+
+		std::vector<std::unique_ptr<rz_query_context> > contexts;	// never moved, the scopes refer to them
+		size_t depth;
+	};
+
+	static context_stack& thread_stack() {
+		static thread_local context_stack stack;
+		return stack;
+	}
+
+	static rz_query_context& push() {
+		context_stack& stack = thread_stack();
+
+		if (stack.depth == stack.contexts.size()) {
+			stack.contexts.push_back(std::unique_ptr<rz_query_context>(new rz_query_context()));
+		}
+
+		return *stack.contexts[stack.depth++];
+	}
+
+	rz_query_context& context_;
+};
+
+} // namespace rimz
+
+#endif // _RZ_QUERY_HPP_INCLUDED_
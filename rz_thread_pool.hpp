@@ -0,0 +1,286 @@
+/** @file rz_thread_pool.hpp */
+// classes: rz_thread_pool, rz_task_group
+// description: small work-stealing thread pool used for parallel tree
+// construction. every worker owns a task deque, it takes its own tasks
+// LIFO and steals from the other deques FIFO. tasks submitted from
+// outside the pool go to a shared deque. threads waiting on a task group
+// keep executing pending tasks, so tasks may spawn and wait for subtasks
+// without deadlocking the pool.
+// last updated: aug.28.2011
+
+// Copyright (C) 2011 Rim Zaidullin <tinybit@yandex.ru>
+
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+
+#ifndef _RZ_THREAD_POOL_HPP_INCLUDED_
+#define _RZ_THREAD_POOL_HPP_INCLUDED_
+
+#include <deque>
+#include <vector>
+#include <memory>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <exception>
+#include <functional>
+#include <condition_variable>
+
+namespace rimz {
+
+class rz_thread_pool {
+public:
+	typedef std::function<void()> task_type;
+
+	// threads_count == 0 means one worker per hardware thread
+	explicit rz_thread_pool(size_t threads_count = 0);
+	~rz_thread_pool();
+
+	size_t size() const {
+		return threads_.size();
+	}
+
+	void submit(const task_type& task);
+
+	// runs one queued task on the calling thread, false if there was none
+	bool run_pending_task();
+
+private:
+	rz_thread_pool(const rz_thread_pool&);
+	rz_thread_pool& operator = (const rz_thread_pool&);
+
+	struct task_queue {
+		std::mutex mutex;
+		std::deque<task_type> tasks;
+	};
+
+	size_t own_queue_index() const;
+	bool pop_task(task_type& task);
+	void worker_loop(size_t index);
+
+	// pool and queue index of the calling thread, set for workers only
+	static rz_thread_pool*& current_pool() {
+		static thread_local rz_thread_pool* pool = NULL;
+		return pool;
+	}
+
+	static size_t& current_index() {
+		static thread_local size_t index = 0;
+		return index;
+	}
+
+	std::vector<std::thread> threads_;
+	std::vector<std::unique_ptr<task_queue> > queues_;	// one per worker + shared one
+	std::atomic<size_t> queued_;
+
+	std::mutex wake_mutex_;
+	std::condition_variable wake_;
+	bool stop_;
+};
+
+// set of tasks that can be waited for as a whole
+class rz_task_group {
+public:
+	explicit rz_task_group(rz_thread_pool& pool) : pool_(pool), pending_(0) {}
+
+	~rz_task_group() {
+		wait_pending();
+	}
+
+	template <typename F>
+	void run(F task);
+
+	// helps executing pool tasks until the group is done, then rethrows
+	// the first exception thrown by a task of the group
+	void wait();
+
+private:
+	rz_task_group(const rz_task_group&);
+	rz_task_group& operator = (const rz_task_group&);
+
+	void wait_pending();
+
+	rz_thread_pool& pool_;
+	std::atomic<size_t> pending_;
+	std::mutex error_mutex_;
+	std::exception_ptr error_;
+};
+
+inline rz_thread_pool::rz_thread_pool(size_t threads_count) : queued_(0), stop_(false) {
+	if (threads_count == 0) {
+		threads_count = std::thread::hardware_concurrency();
+	}
+
+	if (threads_count == 0) {
+		threads_count = 1;
+	}
+
+	for (size_t i = 0; i <= threads_count; ++i) {
+		queues_.push_back(std::unique_ptr<task_queue>(new task_queue()));
+	}
+
+	for (size_t i = 0; i < threads_count; ++i) {
+		threads_.push_back(std::thread(&rz_thread_pool::worker_loop, this, i));
+	}
+}
+
+inline rz_thread_pool::~rz_thread_pool() {
+	{
+		std::lock_guard<std::mutex> lock(wake_mutex_);
+		stop_ = true;
+	}
+
+	wake_.notify_all();
+
+	for (size_t i = 0; i < threads_.size(); ++i) {
+		threads_[i].join();
+	}
+}
+
+inline size_t
+rz_thread_pool::own_queue_index() const {
+	if (current_pool() == this) {
+		return current_index();
+	}
+
+	return queues_.size() - 1;
+}
+
+inline void
+rz_thread_pool::submit(const task_type& task) {
+	task_queue& queue = *queues_[own_queue_index()];
+
+	{
+		std::lock_guard<std::mutex> lock(queue.mutex);
+		queue.tasks.push_back(task);
+	}
+
+	{
+		std::lock_guard<std::mutex> lock(wake_mutex_);
+		++queued_;
+	}
+
+	wake_.notify_one();
+}
+
+inline bool
+rz_thread_pool::pop_task(task_type& task) {
+	size_t own_index = own_queue_index();
+
+	// own tasks first, newest one is the hottest in cache
+	{
+		task_queue& queue = *queues_[own_index];
+		std::lock_guard<std::mutex> lock(queue.mutex);
+
+		if (!queue.tasks.empty()) {
+			task = queue.tasks.back();
+			queue.tasks.pop_back();
+			--queued_;
+			return true;
+		}
+	}
+
+	// steal the oldest task from somebody else
+	for (size_t i = 1; i < queues_.size(); ++i) {
+		task_queue& queue = *queues_[(own_index + i) % queues_.size()];
+		std::lock_guard<std::mutex> lock(queue.mutex);
+
+		if (!queue.tasks.empty()) {
+			task = queue.tasks.front();
+			queue.tasks.pop_front();
+			--queued_;
+			return true;
+		}
+	}
+
+	return false;
+}
+
+inline bool
+rz_thread_pool::run_pending_task() {
+	task_type task;
+	if (!pop_task(task)) {
+		return false;
+	}
+
+	task();
+	return true;
+}
+
+inline void
+rz_thread_pool::worker_loop(size_t index) {
+	current_pool() = this;
+	current_index() = index;
+
+	for (;;) {
+		if (run_pending_task()) {
+			continue;
+		}
+
+		std::unique_lock<std::mutex> lock(wake_mutex_);
+		wake_.wait(lock, [this]() { return stop_ || queued_ > 0; });
+
+		if (stop_ && queued_ == 0) {
+			return;
+		}
+	}
+}
+
+template <typename F> inline void
+rz_task_group::run(F task) {
+	++pending_;
+
+	pool_.submit([this, task]() {
+		try {
+			task();
+		}
+		catch (...) {
+			std::lock_guard<std::mutex> lock(error_mutex_);
+			if (!error_) {
+				error_ = std::current_exception();
+			}
+		}
+
+		--pending_;
+	});
+}
+
+inline void
+rz_task_group::wait_pending() {
+	while (pending_ > 0) {
+		if (!pool_.run_pending_task()) {
+			std::this_thread::yield();
+		}
+	}
+}
+
+inline void
+rz_task_group::wait() {
+	wait_pending();
+
+	std::exception_ptr error;
+	{
+		std::lock_guard<std::mutex> lock(error_mutex_);
+		error = error_;
+		error_ = std::exception_ptr();
+	}
+
+	if (error) {
+		std::rethrow_exception(error);
+	}
+}
+
+} // namespace rimz
+
+#endif // _RZ_THREAD_POOL_HPP_INCLUDED_